@@ -0,0 +1,118 @@
+/*********************************************************************************************************************
+ *
+ * camera.cpp
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#include "camera.h"
+
+#include <cmath>
+#include <algorithm>
+
+
+// scene Y axis points down
+const glm::vec3 WORLD_UP(0.0f, -1.0f, 0.0f);
+
+
+Camera::Camera()
+    : m_mode(MODE_ORBIT), m_isChanged(true)
+{
+    reset();
+}
+
+
+void Camera::setMode(Mode _mode)
+{
+    if(_mode == MODE_ORBIT && m_mode != MODE_ORBIT)
+        m_target = m_position + m_forward * m_distance;
+    m_mode = _mode;
+}
+
+
+void Camera::setOrbit(float _yaw, float _pitch, float _distance)
+{
+    m_yaw = _yaw;
+    m_pitch = glm::clamp(_pitch, -MAX_PITCH, MAX_PITCH);
+    m_distance = std::max(_distance, 1e-3f);
+    m_mode = MODE_ORBIT;
+    updateBasis();
+}
+
+
+void Camera::reset()
+{
+    // image plane at the origin (just in front of the front wall), box center 10 units away
+    m_target = glm::vec3(0.0f, 0.0f, -10.0f);
+    m_distance = 10.0f;
+    m_yaw = 0.0f;
+    m_pitch = 0.0f;
+    m_position = glm::vec3(0.0f);
+    m_focal = 3.0f;
+    m_halfHeight = 2.5f;
+    updateBasis();
+    // same position in fly mode (updateBasis() only moves the camera in orbit mode)
+    m_position = glm::vec3(0.0f);
+}
+
+
+void Camera::rotate(float _dx, float _dy)
+{
+    // cursor right: look to the right, cursor up: look up
+    m_yaw += _dx * ROTATE_SPEED;
+    m_pitch = glm::clamp(m_pitch - _dy * ROTATE_SPEED, -MAX_PITCH, MAX_PITCH);
+    updateBasis();
+}
+
+
+void Camera::pan(float _dx, float _dy)
+{
+    // the scene follows the cursor
+    glm::vec3 offset = (m_right * _dx + m_down * _dy) * (-PAN_SPEED * m_distance);
+    m_target += offset;
+    if(m_mode == MODE_FLY)
+        m_position += offset;
+    updateBasis();
+}
+
+
+void Camera::zoom(float _steps)
+{
+    if(m_mode == MODE_ORBIT)
+        m_distance = std::max(m_distance * std::pow(ZOOM_FACTOR, _steps), 1e-3f);
+    else
+        m_position += m_forward * (_steps * (1.0f - ZOOM_FACTOR) * m_distance);
+    updateBasis();
+}
+
+
+void Camera::move(const glm::vec3& _direction, float _distance)
+{
+    if(m_mode != MODE_FLY || glm::length(_direction) <= 0.0f)
+        return;
+    glm::vec3 direction = glm::normalize(_direction);
+    m_position += (m_right * direction.x + m_down * direction.y + m_forward * direction.z) * _distance;
+    updateBasis();
+}
+
+
+bool Camera::isChanged()
+{
+    bool isChanged = m_isChanged;
+    m_isChanged = false;
+    return isChanged;
+}
+
+
+void Camera::updateBasis()
+{
+    // yaw 0 and pitch 0 look along -Z; pitch > 0 looks up (towards -Y)
+    m_forward = glm::vec3(std::cos(m_pitch) * std::sin(m_yaw), -std::sin(m_pitch), -std::cos(m_pitch) * std::cos(m_yaw));
+    m_right = glm::normalize(glm::cross(WORLD_UP, m_forward));
+    m_down = glm::cross(m_right, m_forward);
+    if(m_mode == MODE_ORBIT)
+        m_position = m_target - m_forward * m_distance;
+    m_isChanged = true;
+}
@@ -0,0 +1,166 @@
+/*********************************************************************************************************************
+ *
+ * camera.h
+ *
+ * Interactive camera of the ray tracer (orbit and fly modes)
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef CAMERA_H
+#define CAMERA_H
+
+
+#include "utils.h"
+
+
+
+/*!
+* \class Camera
+* \brief Camera of the compute shaders (cf. cameraRay() in rtCommon.glsl): camera rays start on an image plane
+* of half height getHalfHeight() centered at getPosition(), and converge to the eye, getFocal() behind the plane.
+* Orientation is given by yaw and pitch angles (scene Y axis points down, the camera never rolls).
+* Orbit mode turns around a target point at a given distance, fly mode turns and moves the camera itself.
+* Default view is the fixed camera of the original demo (image plane at the origin, looking along -Z).
+*/
+class Camera
+{
+    public:
+
+        enum Mode { MODE_ORBIT, MODE_FLY };
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                        CONSTRUCTORS / DESTRUCTORS                                           |
+        +------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn Camera
+        * \brief Constructor of Camera, default view of the Cornell box (orbit mode)
+        */
+        Camera();
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                              GETTERS/SETTERS                                                |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        inline Mode getMode() const { return m_mode; }
+        inline const glm::vec3& getPosition() const { return m_position; }
+        inline const glm::vec3& getRight() const { return m_right; }
+        inline const glm::vec3& getDown() const { return m_down; }
+        inline const glm::vec3& getForward() const { return m_forward; }
+        inline float getFocal() const { return m_focal; }
+        inline float getHalfHeight() const { return m_halfHeight; }
+        inline float getYaw() const { return m_yaw; }
+        inline float getPitch() const { return m_pitch; }
+        inline float getDistance() const { return m_distance; }
+
+        /*!
+        * \fn setMode
+        * \brief Switch between orbit and fly modes, the view is unchanged
+        * (the orbit target is placed at the current distance in front of the camera)
+        */
+        void setMode(Mode _mode);
+
+        /*!
+        * \fn setOrbit
+        * \brief Switch to orbit mode and place the camera around the current target
+        * \param _yaw : angle around the vertical axis (radians, 0 looks along -Z)
+        * \param _pitch : angle above the horizontal plane (radians)
+        * \param _distance : distance to the target
+        */
+        void setOrbit(float _yaw, float _pitch, float _distance);
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn reset
+        * \brief Back to the default view (mode is kept)
+        */
+        void reset();
+
+
+        /*!
+        * \fn rotate
+        * \brief Turn the camera (around the target in orbit mode, around itself in fly mode)
+        * \param _dx, _dy : cursor motion in pixels
+        */
+        void rotate(float _dx, float _dy);
+
+
+        /*!
+        * \fn pan
+        * \brief Move the camera in its image plane (with the target in orbit mode)
+        * \param _dx, _dy : cursor motion in pixels
+        */
+        void pan(float _dx, float _dy);
+
+
+        /*!
+        * \fn zoom
+        * \brief Move towards the target (orbit mode) or forward (fly mode)
+        * \param _steps : scroll wheel steps
+        */
+        void zoom(float _steps);
+
+
+        /*!
+        * \fn move
+        * \brief Fly mode: move the camera (ignored in orbit mode)
+        * \param _direction : direction in camera space (x: right, y: down, z: forward), not normalized
+        * \param _distance : length of the move
+        */
+        void move(const glm::vec3& _direction, float _distance);
+
+
+        /*!
+        * \fn isChanged
+        * \brief Check if the view changed since the last call (i.e., accumulated samples are obsolete)
+        */
+        bool isChanged();
+
+
+    protected:
+
+        static constexpr float ROTATE_SPEED = 0.005f;   /*!< radians per pixel */
+        static constexpr float PAN_SPEED = 0.002f;      /*!< fraction of the target distance per pixel */
+        static constexpr float ZOOM_FACTOR = 0.9f;      /*!< target distance factor per scroll step */
+        static constexpr float MAX_PITCH = 1.55f;       /*!< pitch limit (radians), so that the basis is defined */
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                                ATTRIBUTES                                                   |
+        +------------------------------------------------------------------------------------------------------------*/
+
+        Mode m_mode;                /*!< orbit or fly mode */
+        glm::vec3 m_target;         /*!< orbit mode: point the camera turns around */
+        float m_distance;           /*!< distance between the camera and the target */
+        float m_yaw;                /*!< angle around the vertical axis (radians) */
+        float m_pitch;              /*!< angle above the horizontal plane (radians) */
+
+        glm::vec3 m_position;       /*!< center of the image plane */
+        glm::vec3 m_right;          /*!< image X axis */
+        glm::vec3 m_down;           /*!< image Y axis (pixel rows) */
+        glm::vec3 m_forward;        /*!< viewing direction */
+        float m_focal;              /*!< distance between the image plane and the eye */
+        float m_halfHeight;         /*!< half height of the image plane (field of view) */
+
+        bool m_isChanged;           /*!< view changed since the last isChanged() */
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn updateBasis
+        * \brief Compute the axes from the angles, and the position from the target in orbit mode
+        */
+        void updateBasis();
+
+};
+#endif // CAMERA_H
@@ -0,0 +1,137 @@
+/*********************************************************************************************************************
+ *
+ * gputimer.cpp
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#include "gputimer.h"
+
+#include <algorithm>
+
+
+GpuTimer::GpuTimer(const std::vector<std::string>& _stageNames)
+    : m_stageNames(_stageNames), m_currentSet(0), m_isFrameSkipped(true), m_activeStage(-1)
+    , m_historyOffset(0), m_nbMeasuredFrames(0)
+{
+    m_queries.resize(NB_QUERY_SETS * m_stageNames.size());
+    glGenQueries((GLsizei)m_queries.size(), m_queries.data());
+    m_isIssued.assign(m_queries.size(), false);
+
+    m_history.assign(m_stageNames.size(), std::vector<float>(HISTORY_SIZE, 0.0f));
+    m_frameHistory.assign(HISTORY_SIZE, 0.0f);
+}
+
+
+GpuTimer::~GpuTimer()
+{
+    glDeleteQueries((GLsizei)m_queries.size(), m_queries.data());
+}
+
+
+void GpuTimer::beginFrame()
+{
+    if(m_activeStage >= 0)
+        end();
+
+    // reuse the queries of the oldest frame in flight, once their results are read
+    m_currentSet = (m_currentSet + 1) % NB_QUERY_SETS;
+    m_isFrameSkipped = !collect(m_currentSet);
+}
+
+
+void GpuTimer::begin(int _stage)
+{
+    if(_stage < 0 || _stage >= getNbStages())
+    {
+        std::cerr << "[ERROR] GpuTimer::begin(): invalid stage " << _stage << std::endl;
+        return;
+    }
+    if(m_activeStage >= 0)
+    {
+        std::cerr << "[WARNING] GpuTimer::begin(): stage " << m_stageNames[m_activeStage] << " was not ended" << std::endl;
+        end();
+    }
+    if(m_isFrameSkipped)
+        return;
+
+    size_t query = getQuery(m_currentSet, _stage);
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[query]);
+    m_isIssued[query] = true;
+    m_activeStage = _stage;
+}
+
+
+void GpuTimer::end()
+{
+    if(m_activeStage < 0)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    m_activeStage = -1;
+}
+
+
+float GpuTimer::getLastTime(int _stage) const
+{
+    if(m_nbMeasuredFrames == 0)
+        return 0.0f;
+
+    return m_history.at(_stage)[(m_historyOffset + HISTORY_SIZE - 1) % HISTORY_SIZE];
+}
+
+
+float GpuTimer::getAverageTime(int _stage) const
+{
+    int nbValues = std::min(m_nbMeasuredFrames, HISTORY_SIZE);
+    if(nbValues == 0)
+        return 0.0f;
+
+    // the ring buffer is filled from index 0, unused values are 0
+    float sum = 0.0f;
+    for(float time : m_history.at(_stage))
+        sum += time;
+    return sum / (float)nbValues;
+}
+
+
+bool GpuTimer::collect(int _set)
+{
+    bool isIssued = false;
+    for(int stage = 0; stage < getNbStages(); stage++)
+    {
+        size_t query = getQuery(_set, stage);
+        if(!m_isIssued[query])
+            continue;
+
+        GLint isAvailable = GL_FALSE;
+        glGetQueryObjectiv(m_queries[query], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+        if(isAvailable == GL_FALSE)
+            return false;
+        isIssued = true;
+    }
+    if(!isIssued)
+        return true;
+
+    // stages which were not issued in this frame count as 0
+    float frameTime = 0.0f;
+    for(int stage = 0; stage < getNbStages(); stage++)
+    {
+        size_t query = getQuery(_set, stage);
+        GLuint64 time = 0;
+        if(m_isIssued[query])
+            glGetQueryObjectui64v(m_queries[query], GL_QUERY_RESULT, &time);
+        m_isIssued[query] = false;
+
+        m_history[stage][m_historyOffset] = (float)(time * 1e-6);
+        frameTime += m_history[stage][m_historyOffset];
+    }
+    m_frameHistory[m_historyOffset] = frameTime;
+
+    m_historyOffset = (m_historyOffset + 1) % HISTORY_SIZE;
+    m_nbMeasuredFrames++;
+
+    return true;
+}
@@ -0,0 +1,161 @@
+/*********************************************************************************************************************
+ *
+ * gputimer.h
+ *
+ * GPU time of the rendering stages, measured with timer queries
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+
+#include <vector>
+#include <string>
+
+#include "utils.h"
+
+
+
+/*!
+* \class GpuTimer
+* \brief GL_TIME_ELAPSED queries around each stage of a frame (e.g. ray tracing, display, GUI)
+* Queries are double-buffered: results of a frame are read when the next-but-one frame starts, and only
+* if they are available, so that timing never stalls the pipeline (a frame is skipped instead).
+* Keeps a rolling history of the time of each stage, in milliseconds.
+* Stages cannot be nested (a single GL_TIME_ELAPSED query can be active at a time).
+*/
+class GpuTimer
+{
+    public:
+
+        static const int NB_QUERY_SETS = 2;     /*!< number of frames whose queries can be in flight */
+        static const int HISTORY_SIZE = 128;    /*!< number of measured frames kept for the graphs */
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                        CONSTRUCTORS / DESTRUCTORS                                           |
+        +------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn GpuTimer
+        * \brief Constructor of GpuTimer, creates the query objects
+        * \param _stageNames : name of each timed stage (stage ids are indices in this list)
+        */
+        GpuTimer(const std::vector<std::string>& _stageNames);
+
+
+        /*!
+        * \fn ~GpuTimer
+        * \brief Destructor of GpuTimer
+        */
+        ~GpuTimer();
+
+        /*! the query objects are deleted by the destructor: not copyable */
+        GpuTimer(const GpuTimer&) = delete;
+        GpuTimer& operator=(const GpuTimer&) = delete;
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                              GETTERS/SETTERS                                                |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        inline int getNbStages() const { return (int)m_stageNames.size(); }
+        inline const std::string& getStageName(int _stage) const { return m_stageNames.at(_stage); }
+        /*! history of a stage (ms) as a ring buffer, oldest value at getHistoryOffset() */
+        inline const std::vector<float>& getHistory(int _stage) const { return m_history.at(_stage); }
+        /*! history of the sum of all the stages (ms) */
+        inline const std::vector<float>& getFrameHistory() const { return m_frameHistory; }
+        inline int getHistoryOffset() const { return m_historyOffset; }
+        inline int getNbMeasuredFrames() const { return m_nbMeasuredFrames; }
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn beginFrame
+        * \brief Collect the results of the oldest frame in flight (if available) and select its queries for the new frame
+        */
+        void beginFrame();
+
+
+        /*!
+        * \fn begin
+        * \brief Start timing a stage of the current frame
+        * \param _stage : stage id
+        */
+        void begin(int _stage);
+
+
+        /*!
+        * \fn end
+        * \brief Stop timing the current stage
+        */
+        void end();
+
+
+        /*!
+        * \fn getLastTime
+        * \brief Last measured time of a stage
+        * \param _stage : stage id
+        * \return time in ms (0 if never measured)
+        */
+        float getLastTime(int _stage) const;
+
+
+        /*!
+        * \fn getAverageTime
+        * \brief Average time of a stage over the history
+        * \param _stage : stage id
+        * \return time in ms (0 if never measured)
+        */
+        float getAverageTime(int _stage) const;
+
+
+    protected:
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                                ATTRIBUTES                                                   |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        std::vector<std::string> m_stageNames;  /*!< name of each stage */
+
+        std::vector<GLuint> m_queries;          /*!< query objects, NB_QUERY_SETS sets of one query per stage */
+        std::vector<bool> m_isIssued;           /*!< true if the query was issued and its result not read yet */
+        int m_currentSet;                       /*!< set of queries used by the current frame */
+        bool m_isFrameSkipped;                  /*!< true if the current frame is not timed (results of its set still pending) */
+        int m_activeStage;                      /*!< stage being timed, -1 if none */
+
+        std::vector<std::vector<float>> m_history; /*!< ring buffer of the times (ms) of each stage */
+        std::vector<float> m_frameHistory;      /*!< ring buffer of the sum of the stages (ms) */
+        int m_historyOffset;                    /*!< index of the oldest value in the ring buffers */
+        int m_nbMeasuredFrames;                 /*!< number of frames read back so far */
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn getQuery
+        * \param _set : set of queries
+        * \param _stage : stage id
+        * \return index of the query of a stage in m_queries
+        */
+        inline size_t getQuery(int _set, int _stage) const { return (size_t)_set * m_stageNames.size() + _stage; }
+
+
+        /*!
+        * \fn collect
+        * \brief Read the results of a set of queries and push them in the history, unless they are not available yet
+        * \param _set : set of queries
+        * \return false if some results are not available yet (nothing is read)
+        */
+        bool collect(int _set);
+
+};
+#endif // GPUTIMER_H
@@ -16,55 +16,154 @@
 #include <math.h>
 #include <cstdlib>
 #include <algorithm>
+#include <random>
+#include <chrono>
+#include <map>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
 #include "drawablemesh.h"
+#include "scenebuffer.h"
+#include "gputimer.h"
+#include "texturereadback.h"
+#include "shadermanager.h"
+#include "camera.h"
+#include "ray_tracer/benchmark.h"
 
 
 // Window
 GLFWwindow *m_window;               /*!<  GLFW window */
 int m_winWidth = 1024;              /*!<  window width (XGA) */
 int m_winHeight = 720;              /*!<  window height (XGA) */
-const unsigned int TEX_WIDTH = 512, TEX_HEIGHT = 512  ; /*!< textures dimensions  */
+unsigned int m_texWidth = 0, m_texHeight = 0; /*!< textures dimensions (render resolution: window size x m_renderScale) */
+
+float m_renderScale = 1.0f;         /*!<  render resolution relative to the window (upscaled for display) */
+const float MIN_RENDER_SCALE = 0.25f; /*!< lowest render scale */
+bool m_isAdaptiveResolution = false; /*!<  adjust m_renderScale to hold m_targetFrameTime */
+float m_targetFrameTime = 16.7f;    /*!<  GPU frame time (ms) held by the adaptive resolution */
+int m_scaleChangeFrame = 0;         /*!<  number of GPU timer frames at the last render scale change */
 
 int m_nbSamples = 1;                /*!<  number of samples per pixel */
 int m_nbBounces = 2;                /*!<  number of bounces (i.e., depth of path tracing) */
 float m_lightIntensity = 1000.0f;   /*!<  light emission */
 
+const std::vector<int> m_tileSizes = { 1, 4, 8, 16 };  /*!< available work group sizes (tiles of N x N pixels) */
+const char* m_tileSizeNames[] = { "1 x 1", "4 x 4", "8 x 8", "16 x 16" };
+int m_tileSizeId = 2;               /*!<  index of the current work group size in m_tileSizes */
+bool m_isWavefront = false;         /*!<  trace rays with the wavefront kernels (wavefront.comp) instead of the megakernel (--wavefront) */
+
+// compile-time variants of the megakernel (cf. getRayProgram())
+enum ShadingModel { SHADING_PATH_TRACING, SHADING_PHONG, SHADING_PBR };  /*!< same values as SHADING_* in rayTrace.comp */
+const char* m_shadingModelNames[] = { "Path tracing", "Phong", "PBR" };
+enum RngType { RNG_PCG, RNG_XORSHIFT };     /*!< same values as RNG_* in rtCommon.glsl */
+const char* m_rngTypeNames[] = { "PCG hash", "Xorshift" };
+bool m_isSpecialized = false;       /*!<  number of samples and bounces are compile-time constants of the megakernel (--specialize) */
+int m_shadingModel = SHADING_PATH_TRACING; /*!< direct lighting of the megakernel (--shading) */
+int m_rngType = RNG_PCG;            /*!<  random number generator of the megakernel (--rng) */
+
+bool m_isProgressive = true;        /*!<  accumulate samples over frames (true) or redraw each frame from scratch (false) */
+unsigned int m_frameIndex = 0;      /*!<  number of frames accumulated since last reset */
+int m_maxSamples = 0;               /*!<  progressive accumulation stops at this number of samples per pixel, 0 for no limit (--max-spp) */
+
+bool m_isAdaptiveSampling = false;  /*!<  converged pixels stop receiving samples (--adaptive) */
+float m_adaptiveThreshold = 0.05f;  /*!<  relative error (95% confidence interval of the mean luminance) of a converged pixel */
+int m_adaptiveMinFrames = 8;        /*!<  frames accumulated before a pixel can converge */
+float m_timeBudget = 0.0f;          /*!<  headless mode: rendering stops after this time in seconds, 0 for no limit (--time-budget) */
+
+bool m_isDenoiseOn = false;         /*!<  filter the accumulated image before display (--denoise in headless mode) */
+int m_nbDenoiseIterations = 4;      /*!<  number of A-Trous iterations (filter width 2^(N+2) - 3 pixels) */
+float m_denoiseColorPhi = 4.0f;     /*!<  denoiser tolerance on illumination differences (for one sample per pixel) */
+float m_denoiseNormalPhi = 0.1f;    /*!<  denoiser tolerance on normal differences */
+float m_denoiseDepthPhi = 1.0f;     /*!<  denoiser tolerance on depth differences (relative to the depth gradient) */
+
+
+// Camera
+Camera m_camera;                    /*!<  view of the scene, sent to the shaders with the frame parameters */
+const char* m_cameraModeNames[] = { "Orbit", "Fly" };  /*!< same order as Camera::Mode */
+float m_flySpeed = 5.0f;            /*!<  fly mode: camera speed (scene units per second, x4 with shift) */
+bool m_isCameraPreview = true;      /*!<  while the camera moves, frames trace one sample per pixel and m_previewBounces bounces */
+int m_previewBounces = 1;           /*!<  number of bounces of the preview frames */
+const double PREVIEW_DELAY = 0.2;   /*!<  time (s) after the last camera move at which full quality rendering restarts */
+bool m_isPreviewFrame = false;      /*!<  current frame is a preview (set by updateCamera()) */
+double m_lastCameraMove = -1e9;     /*!<  time of the last camera move (glfwGetTime()) */
+double m_lastUpdateTime = 0.0;      /*!<  time of the previous updateCamera() */
+int m_mouseButton = -1;             /*!<  mouse button held in the viewport, -1 if none */
+double m_cursorX = 0.0, m_cursorY = 0.0; /*!< last cursor position (screen coords) */
 
 // 3D objects
 std::unique_ptr<DrawableMesh> m_drawQuad;   /*!<  drawable object: screen quad */
-std::vector<Sphere> m_spheres;              /*!<  Cornell box sphere geometry */
+std::unique_ptr<SceneBuffer> m_scene;       /*!<  scene geometry (spheres and triangles) stored on the GPU */
+enum SceneMaterialId { MATERIAL_ID_DIFFUSE, MATERIAL_ID_MIRROR, MATERIAL_ID_GLASS, MATERIAL_ID_LIGHT };  /*!< material table of the Cornell box */
+
+// GPU timings
+enum GpuStage { STAGE_RAYS, STAGE_DENOISE, STAGE_DISPLAY, STAGE_GUI, NB_STAGES };  /*!< timed stages of a frame */
+std::unique_ptr<GpuTimer> m_gpuTimer;       /*!<  GPU time of each stage of the frame */
 
 GLuint m_defaultVAO;            /*!<  default VAO */
-GLuint m_uboSpheres;            /*!<  Sphere geometry Uniform Buffer Object */
-GLuint m_ubo;
+GLuint m_uboFrame;              /*!<  Per-frame parameters Uniform Buffer Object */
 
 
 // Textures
 GLuint m_screenTex;             /*!< Destination texture for screen-space processing (stores final lighting result) */
-GLuint m_perlinR;
-GLuint m_perlinG;
-GLuint m_perlinB;
+GLuint m_accumTex;              /*!< Float texture storing the running average of all samples accumulated since last reset */
+GLuint m_gNormalDepthTex;       /*!< G-buffer of the denoiser: normal and depth of the first hit (accumulated as the color) */
+GLuint m_gAlbedoTex;            /*!< G-buffer of the denoiser: albedo of the first hit */
+GLuint m_pixelStatsTex;         /*!< Float texture of the statistics of the frames accumulated in each pixel, for adaptive sampling */
+GLuint m_denoiseTex[2];         /*!< Float textures for the iterations of the denoiser (ping-pong) */
 
 // shader programs
+std::unique_ptr<ShaderManager> m_shaderManager; /*!< builds the programs (binary cache) and reloads them when the shader files change */
+std::string m_shaderCacheDir = "shader_cache/"; /*!< directory of the cached program binaries, empty to disable the cache (--no-shader-cache) */
+bool m_isShaderHotReload = false; /*!< rebuild the programs when the shader files are modified (--hot-reload) */
 GLuint m_programQuad;           /*!< handle of the program object (i.e. shaders) for screen quad rendering */
-GLuint m_programRay;            /*!< compute shader for ray tracing*/
-
-
-std::vector<glm::vec3> m_ssaoKernel;
-GLuint m_noiseTex;          
+std::vector<GLuint> m_programsRay; /*!< compute shaders for ray tracing (one per work group size in m_tileSizes) */
+std::map<std::string, GLuint> m_programsRayVariants; /*!< specialized ray tracing programs compiled on demand, by defines */
+GLuint m_programDenoise;        /*!< compute shader for one iteration of the denoiser */
+
+// wavefront pipeline (cf. wavefront.comp)
+enum WavefrontKernel { KERNEL_GENERATE, KERNEL_INTERSECT, KERNEL_SHADE_DIFFUSE, KERNEL_SHADE_MIRROR, KERNEL_SHADE_GLASS,
+                       KERNEL_SHADOW, KERNEL_ACCUMULATE, KERNEL_PREPARE, NB_KERNELS };  /*!< kernels, one program each */
+enum WavefrontQueue { QUEUE_RAYS_0, QUEUE_RAYS_1, QUEUE_DIFFUSE, QUEUE_MIRROR, QUEUE_GLASS, QUEUE_SHADOW, NB_QUEUES };  /*!< queues of path indices */
+enum WavefrontStage { PREPARE_INTERSECT, PREPARE_SHADE, PREPARE_SHADOW, PREPARE_GENERATE };  /*!< dispatch arguments computed by KERNEL_PREPARE */
+const GLuint WAVEFRONT_PATH_SIZE = 144;     /*!< size of struct Path in wavefront.comp (bytes) */
+GLuint m_programsWavefront[NB_KERNELS];     /*!< compute shaders of the wavefront kernels */
+GLuint m_ssboPaths;             /*!< wavefront pipeline: state of the path of each pixel (binding = 7) */
+GLuint m_ssboQueueCounters;     /*!< wavefront pipeline: queue sizes and indirect dispatch arguments (binding = 8) */
+GLuint m_ssboQueues;            /*!< wavefront pipeline: path indices of the queues (binding = 9) */
+unsigned int m_wavefrontCapacity = 0;   /*!< number of pixels the wavefront buffers are allocated for */
 
 std::string shaderDir = "../../src/shaders/";   /*!< relative path to shaders folder  */
 std::string modelDir = "../../models/";   /*!< relative path to meshes and textures files folder  */
+std::string m_meshFilename;                 /*!< optional OBJ mesh placed in the Cornell box (command line argument) */
+std::string m_benchmarkFilename;            /*!< benchmark results (.json or .csv, --benchmark argument), empty in interactive mode */
+const int m_benchmarkPrimitives = 10000;    /*!< number of primitives of the random benchmark scenes */
+std::string m_outputFilename;               /*!< headless mode: rendered image (.png or .ppm, --output argument), empty in interactive mode */
+int m_nbHeadlessFrames = 64;                /*!< headless mode: number of progressive frames to render (--frames) */
+int m_snapshotInterval = 0;                 /*!< headless mode: write the image every N frames while rendering (--snapshot), 0 for the final image only */
 
 void initialize();
+void addCornellBoxWalls();
+void loadMesh(const std::string& _filename);
 void setupImgui(GLFWwindow *window);
 void update();
+void updateCamera();
+void resizeRenderTargets();
+void updateRenderScale();
+void resetAccumulation();
+bool isSampleBudgetReached();
+int getFrameSamples();
+int getFrameBounces();
 void renderRays();
+void setupRayTracing();
+GLuint getRayProgram();
+void dispatchRays(GLuint _programRay, GLuint _tileSize);
+void dispatchWavefront(std::vector<GLuint>* _bounceQueries = nullptr);
+void denoise();
+bool runBenchmark();
+bool runHeadless();
+bool parseArguments(int argc, char** argv);
 void displayScreen();
 void resizeCallback(GLFWwindow* window, int width, int height);
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
@@ -83,20 +182,16 @@ int main(int argc, char** argv);
 
 void initialize()
 {
-    // Cornell box geometry described as spheres
-    m_spheres = { Sphere( glm::vec3( -1e5 - 5,      0.0,      -10.0), glm::vec3(0.75, 0.25, 0.25), 1e5 ) ,	/* Left wall */
-				  Sphere( glm::vec3(  1e5 + 5,      0.0,      -10.0), glm::vec3(0.25, 0.25, 0.75), 1e5 ) ,	/* Right wall */
-				  Sphere( glm::vec3(      0.0,      0.0,  -1e5 - 15), glm::vec3(0.75, 0.75, 0.75), 1e5 ) ,	/* Back wall */
-				  Sphere( glm::vec3(      0.0,      0.0,  1e5 + 0.1), glm::vec3(0.75, 0.75, 0.75), 1e5 ) ,	/* Front wall (just behing the camera) */
-				  Sphere( glm::vec3(      0.0,  1e5 + 5,      -10.0), glm::vec3(0.75, 0.75, 0.75), 1e5 ) ,	/* Floor */
-				  Sphere( glm::vec3(      0.0, -1e5 - 5,      -10.0), glm::vec3(0.75, 0.75, 0.75), 1e5 ) ,	/* Ceiling */
-				  Sphere( glm::vec3(     -2.5,      3.0,      -12.5), glm::vec3(0.95,  0.5, 0.25), 2.0 ) ,	/* Mirror sphere */
-			      Sphere( glm::vec3(      2.5,      3.0,       -8.5), glm::vec3(0.95,  0.5, 0.25), 1.5 ) ,	/* Glass sphere */
-				  Sphere( glm::vec3(      0.0,     -4.5,      -10.0), glm::vec3( 1.0,  1.0,  1.0), 0.25 ) 	/* Light source */					 
+    // same order as SceneMaterialId
+    std::vector<Material> materials = { Material(MATERIAL_DIFFUSE), Material(MATERIAL_MIRROR),
+                                        Material(MATERIAL_GLASS, 1.5f), Material(MATERIAL_LIGHT, 1.0f, glm::vec3(1.0f)) };
+
+    // Cornell box objects described as spheres (walls are quads, cf. addCornellBoxWalls())
+    std::vector<Sphere> spheres = { Sphere( glm::vec3(     -2.5,      3.0,      -12.5), glm::vec3(0.95,  0.5, 0.25), 2.0, MATERIAL_ID_MIRROR ) ,	/* Mirror sphere */
+			      Sphere( glm::vec3(      2.5,      3.0,       -8.5), glm::vec3(0.95,  0.5, 0.25), 1.5, MATERIAL_ID_GLASS ) ,	/* Glass sphere */
+				  Sphere( glm::vec3(      0.0,     -4.5,      -10.0), glm::vec3( 1.0,  1.0,  1.0), 0.25, MATERIAL_ID_LIGHT ) 	/* Light source */					 
     };
 
-    assert(m_spheres.size() == NB_SPHERES);
-
     // Setup background color
     glClearColor(0.0f, 0.0f, 0.0f, 0.0);
 
@@ -110,21 +205,103 @@ void initialize()
 
     //m_drawQuad->loadAlbedoTex( modelDir + "UVchecker.png" );
 
-    // init screen texture
-    buildScreenTex(&m_screenTex, TEX_WIDTH, TEX_HEIGHT);
+    // init screen textures at render resolution
+    m_screenTex = m_accumTex = m_gNormalDepthTex = m_gAlbedoTex = m_pixelStatsTex = m_denoiseTex[0] = m_denoiseTex[1] = 0;
+    resizeRenderTargets();
 
     checkWorkGroups();
 
-    m_programQuad = loadShaderProgram(shaderDir + "quadTex.vert", shaderDir + "quadTex.frag");
-    m_programRay = loadCompShaderProgram(shaderDir + "rayTrace.comp");
+    // programs are registered by address for hot reload
+    std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+    m_shaderManager = std::make_unique<ShaderManager>(m_shaderCacheDir);
+    m_shaderManager->setHotReload(m_isShaderHotReload);
+    m_shaderManager->addShaderProgram(m_programQuad, shaderDir + "quadTex.vert", shaderDir + "quadTex.frag");
+    // compile one ray tracing program per work group size
+    m_programsRay.assign(m_tileSizes.size(), 0);
+    for(size_t i = 0; i < m_tileSizes.size(); i++)
+    {
+        m_shaderManager->addComputeProgram(m_programsRay[i], shaderDir + "rayTrace.comp", "#define LOCAL_SIZE " + std::to_string(m_tileSizes[i]) + "\n");
+    }
+    m_shaderManager->addComputeProgram(m_programDenoise, shaderDir + "denoise.comp");
+    // same order as WavefrontKernel
+    const std::vector<std::string> kernelDefines = { "#define KERNEL_GENERATE\n", "#define KERNEL_INTERSECT\n",
+        "#define KERNEL_SHADE\n#define MATERIAL MATERIAL_DIFFUSE\n", "#define KERNEL_SHADE\n#define MATERIAL MATERIAL_MIRROR\n",
+        "#define KERNEL_SHADE\n#define MATERIAL MATERIAL_GLASS\n", "#define KERNEL_SHADOW\n", "#define KERNEL_ACCUMULATE\n", "#define KERNEL_PREPARE\n" };
+    for(int k = 0; k < NB_KERNELS; k++)
+    {
+        m_shaderManager->addComputeProgram(m_programsWavefront[k], shaderDir + "wavefront.comp", kernelDefines[k]);
+    }
+    std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+    std::cout << "Shader programs: " << m_shaderManager->getNbCacheHits() << " from cache, " << m_shaderManager->getNbCompiled()
+              << " compiled (" << buildTime.count() << " ms)" << std::endl;
+    // buffers are allocated at the first wavefront frame
+    glGenBuffers(1, &m_ssboPaths);
+    glGenBuffers(1, &m_ssboQueueCounters);
+    glGenBuffers(1, &m_ssboQueues);
+
+    m_scene = std::make_unique<SceneBuffer>();
+    m_scene->setMaterials(materials);
+    m_scene->createSpheresSSBO(spheres);
+    addCornellBoxWalls();
+    if(!m_meshFilename.empty())
+    {
+        loadMesh(m_meshFilename);
+        m_scene->upload();
+    }
+    createFrameParamsUBO(m_uboFrame);
+    resetAccumulation();
+
+    // same order as GpuStage
+    m_gpuTimer = std::make_unique<GpuTimer>( std::vector<std::string>{ "Ray tracing", "Denoiser", "Display", "GUI" } );
+}
+
+
+
+void addCornellBoxWalls()
+{
+    // box [-5, 5] x [-5, 5] x [-15, 0.1] (scene Y axis points down), the front wall is just behind the camera;
+    // analytic quads instead of huge spheres: exact flat walls, no precision loss far from the sphere centers
+    const glm::vec3 red(0.75f, 0.25f, 0.25f), blue(0.25f, 0.25f, 0.75f), white(0.75f, 0.75f, 0.75f);
+    m_scene->addQuad(glm::vec3(-5.0f, -5.0f, -15.0f), glm::vec3(-5.0f,  5.0f, -15.0f), glm::vec3(-5.0f, -5.0f,  0.1f), red);     /* Left wall */
+    m_scene->addQuad(glm::vec3( 5.0f, -5.0f, -15.0f), glm::vec3( 5.0f,  5.0f, -15.0f), glm::vec3( 5.0f, -5.0f,  0.1f), blue);    /* Right wall */
+    m_scene->addQuad(glm::vec3(-5.0f, -5.0f, -15.0f), glm::vec3( 5.0f, -5.0f, -15.0f), glm::vec3(-5.0f,  5.0f, -15.0f), white);  /* Back wall */
+    m_scene->addQuad(glm::vec3(-5.0f, -5.0f,  0.1f), glm::vec3( 5.0f, -5.0f,  0.1f), glm::vec3(-5.0f,  5.0f,  0.1f), white);     /* Front wall */
+    m_scene->addQuad(glm::vec3(-5.0f,  5.0f, -15.0f), glm::vec3( 5.0f,  5.0f, -15.0f), glm::vec3(-5.0f,  5.0f,  0.1f), white);   /* Floor */
+    m_scene->addQuad(glm::vec3(-5.0f, -5.0f, -15.0f), glm::vec3( 5.0f, -5.0f, -15.0f), glm::vec3(-5.0f, -5.0f,  0.1f), white);   /* Ceiling */
+}
+
+
+void loadMesh(const std::string& _filename)
+{
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    if(!loadOBJ(_filename, vertices, indices) || vertices.empty())
+        return;
+
+    glm::vec3 bboxMin = vertices[0], bboxMax = vertices[0];
+    for(const glm::vec3& v : vertices)
+    {
+        bboxMin = glm::min(bboxMin, v);
+        bboxMax = glm::max(bboxMax, v);
+    }
+    glm::vec3 size = bboxMax - bboxMin;
+    float maxSize = std::max(size.x, std::max(size.y, size.z));
+    if(maxSize <= 0.0f)
+        return;
+
+    // fit mesh in a 4 x 4 x 4 cube standing on the floor of the box (scene Y axis points down, OBJ Y axis points up)
+    float scale = 4.0f / maxSize;
+    glm::vec3 center = 0.5f * (bboxMin + bboxMax);
+    for(glm::vec3& v : vertices)
+    {
+        v = (v - center) * scale;
+        v = glm::vec3(v.x, 5.0f - 0.5f * size.y * scale - v.y, v.z - 10.5f);
+    }
 
-    buildRandKernel(m_ssaoKernel);
-    buildKernelRot(&m_noiseTex);
-    buildPerlinTex(m_perlinR, 0);
-    buildPerlinTex(m_perlinG, 100);
-    buildPerlinTex(m_perlinB, 200);
+    m_scene->addMesh(vertices, indices, glm::vec3(0.75f, 0.75f, 0.75f));
 
-    createSpheresUBO(m_spheres, m_ubo);
+    std::cout << "Loaded " << _filename << ": " << vertices.size() << " vertices, "
+              << indices.size() / 3 << " triangles" << std::endl;
 }
 
 
@@ -149,6 +326,113 @@ void setupImgui(GLFWwindow *window)
 
 void update()
 {
+    // shader files modified: the new programs render from scratch
+    if(m_shaderManager->update())
+        resetAccumulation();
+
+    updateCamera();
+
+    // send spheres modified since last frame to the GPU
+    if(m_scene->upload())
+        resetAccumulation();
+
+    if(m_isAdaptiveResolution)
+        updateRenderScale();
+    // window resized or render scale changed
+    resizeRenderTargets();
+}
+
+
+void updateCamera()
+{
+    double time = glfwGetTime();
+    float elapsed = (float)(time - m_lastUpdateTime);
+    m_lastUpdateTime = time;
+
+    // fly mode: W/S forward and backward, A/D left and right, Q/E down and up
+    if(m_camera.getMode() == Camera::MODE_FLY && !ImGui::GetIO().WantCaptureKeyboard)
+    {
+        auto axis = [](int _positiveKey, int _negativeKey)
+        {
+            return (glfwGetKey(m_window, _positiveKey) == GLFW_PRESS ? 1.0f : 0.0f) - (glfwGetKey(m_window, _negativeKey) == GLFW_PRESS ? 1.0f : 0.0f);
+        };
+        glm::vec3 direction(axis(GLFW_KEY_D, GLFW_KEY_A), axis(GLFW_KEY_Q, GLFW_KEY_E), axis(GLFW_KEY_W, GLFW_KEY_S));
+        float speed = m_flySpeed * (glfwGetKey(m_window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS ? 4.0f : 1.0f);
+        // long frames (e.g. shader compilation) would make the camera jump
+        m_camera.move(direction, speed * std::min(elapsed, 0.1f));
+    }
+
+    // any camera move restarts the accumulation
+    if(m_camera.isChanged())
+    {
+        m_lastCameraMove = time;
+        resetAccumulation();
+    }
+
+    // preview samples (fewer bounces) are not blended with the full quality ones
+    bool isPreview = m_isCameraPreview && time - m_lastCameraMove < PREVIEW_DELAY;
+    if(isPreview != m_isPreviewFrame)
+    {
+        m_isPreviewFrame = isPreview;
+        resetAccumulation();
+    }
+}
+
+
+void resizeRenderTargets()
+{
+    unsigned int width = (unsigned int)std::max(1L, std::lround(m_winWidth * m_renderScale));
+    unsigned int height = (unsigned int)std::max(1L, std::lround(m_winHeight * m_renderScale));
+    if(m_screenTex != 0 && width == m_texWidth && height == m_texHeight)
+        return;
+
+    // texture storage cannot be resized: re-create the textures (glDeleteTextures() ignores 0)
+    glDeleteTextures(1, &m_screenTex);
+    glDeleteTextures(1, &m_accumTex);
+    glDeleteTextures(1, &m_gNormalDepthTex);
+    glDeleteTextures(1, &m_gAlbedoTex);
+    glDeleteTextures(1, &m_pixelStatsTex);
+    glDeleteTextures(2, m_denoiseTex);
+    m_texWidth = width;
+    m_texHeight = height;
+    buildScreenTex(&m_screenTex, m_texWidth, m_texHeight);
+    buildScreenTex(&m_accumTex, m_texWidth, m_texHeight, GL_RGBA32F);
+    buildScreenTex(&m_gNormalDepthTex, m_texWidth, m_texHeight, GL_RGBA32F);
+    buildScreenTex(&m_gAlbedoTex, m_texWidth, m_texHeight, GL_RGBA16F);
+    buildScreenTex(&m_pixelStatsTex, m_texWidth, m_texHeight, GL_RGBA32F);
+    buildScreenTex(&m_denoiseTex[0], m_texWidth, m_texHeight, GL_RGBA32F);
+    buildScreenTex(&m_denoiseTex[1], m_texWidth, m_texHeight, GL_RGBA32F);
+
+    // accumulated samples are lost
+    resetAccumulation();
+}
+
+
+void updateRenderScale()
+{
+    // wait for the times of frames rendered at the current scale (results are read with a two frames latency)
+    int nbMeasuredFrames = m_gpuTimer->getNbMeasuredFrames();
+    if(nbMeasuredFrames < m_scaleChangeFrame + 8)
+        return;
+
+    float rayTime = m_gpuTimer->getLastTime(STAGE_RAYS);
+    if(rayTime <= 0.0f)
+        return;
+    float otherTime = 0.0f;
+    for(int stage = 0; stage < m_gpuTimer->getNbStages(); stage++)
+        if(stage != STAGE_RAYS)
+            otherTime += m_gpuTimer->getLastTime(stage);
+
+    // only the ray tracing time is proportional to the number of pixels, i.e. to the square of the scale
+    float rayBudget = std::max(m_targetFrameTime - otherTime, 0.1f * m_targetFrameTime);
+    float scale = glm::clamp(m_renderScale * std::sqrt(rayBudget / rayTime), MIN_RENDER_SCALE, 1.0f);
+
+    // ignore small variations, each change restarts the accumulation
+    if(std::abs(scale - m_renderScale) > 0.05f * m_renderScale)
+    {
+        m_renderScale = scale;
+        m_scaleChangeFrame = nbMeasuredFrames;
+    }
 }
 
 
@@ -158,14 +442,75 @@ void update()
     +-------------------------------------------------------------------------------------------------------------*/
 
 
+void resetAccumulation()
+{
+    // next frame overwrites the accumulation buffer instead of blending into it
+    m_frameIndex = 0;
+}
+
+
+bool isSampleBudgetReached()
+{
+    return m_isProgressive && m_maxSamples > 0 && m_frameIndex * (unsigned int)getFrameSamples() >= (unsigned int)m_maxSamples;
+}
+
+
+int getFrameSamples()
+{
+    return m_isPreviewFrame ? 1 : m_nbSamples;
+}
+
+
+int getFrameBounces()
+{
+    return m_isPreviewFrame ? std::min(m_previewBounces, m_nbBounces) : m_nbBounces;
+}
+
+
 void renderRays()
 {
+    // sample budget reached: the accumulated image is kept as is
+    if(isSampleBudgetReached())
+        return;
+
+    if(m_isWavefront)
+    {
+        dispatchWavefront();
+        return;
+    }
+    // use compute shader compiled for the current work group size (and variant)
+    dispatchRays(getRayProgram(), (GLuint)m_tileSizes[m_tileSizeId]);
+}
+
 
-    // use compute shader
-    glUseProgram(m_programRay);
 
+GLuint getRayProgram()
+{
+    std::string defines;
+    if(m_isSpecialized)
+        defines += "#define NB_SAMPLES " + std::to_string(getFrameSamples()) + "\n#define NB_BOUNCES " + std::to_string(getFrameBounces()) + "\n";
+    if(m_shadingModel != SHADING_PATH_TRACING)
+        defines += "#define SHADING_MODEL " + std::to_string(m_shadingModel) + "\n";
+    if(m_rngType != RNG_PCG)
+        defines += "#define RNG " + std::to_string(m_rngType) + "\n";
+    if(defines.empty())
+        return m_programsRay[m_tileSizeId];
+
+    // variants are compiled at first use (or loaded from the binary cache), and hot reloaded like the others
+    defines = "#define LOCAL_SIZE " + std::to_string(m_tileSizes[m_tileSizeId]) + "\n" + defines;
+    auto variant = m_programsRayVariants.find(defines);
+    if(variant == m_programsRayVariants.end())
+    {
+        variant = m_programsRayVariants.emplace(defines, 0).first;
+        m_shaderManager->addComputeProgram(variant->second, shaderDir + "rayTrace.comp", defines);
+    }
+    // generic program if the variant does not compile
+    return variant->second != 0 ? variant->second : m_programsRay[m_tileSizeId];
+}
 
 
+void setupRayTracing()
+{
     // glBindImageTexture() bind an image and send it as unifnorm layout to shader
     // It replaces glActiveTexture() + glBindTexture() + glUniform1i() used for texture uniforms
     //
@@ -173,46 +518,201 @@ void renderRays()
     // https://www.khronos.org/opengl/wiki/Image_Load_Store#Format_qualifiers
     // GL_WRITE_ONLY as we only writeinto the image
     glBindImageTexture(0, m_screenTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    // GL_RGBA32F (FLOAT) -> declared as rgba32f in compute shader 
+    // GL_READ_WRITE as new samples are blended with the previous average
+    glBindImageTexture(1, m_accumTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    // G-buffer of the denoiser, accumulated as the color (only written if isGBufferOn)
+    glBindImageTexture(3, m_gNormalDepthTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(4, m_gAlbedoTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+    // statistics of the accumulated frames, restarted with the accumulation
+    glBindImageTexture(5, m_pixelStatsTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+    // send all the parameters of the frame in a single buffer update
+    // (image units and buffers use explicit bindings in the shader, no uniform lookup needed)
+    FrameParams params;
+    params.screenWidth = m_texWidth;
+    params.screenHeight = m_texHeight;
+    params.nbSamples = getFrameSamples();
+    params.nbBounces = getFrameBounces();
+    params.lightIntensity = m_lightIntensity;
+    params.frameIndex = m_isProgressive ? m_frameIndex : 0;
+    params.nbSpheres = m_scene->getNbSpheres();
+    params.nbTriangles = m_scene->getNbTriangles();
+    params.isGBufferOn = m_isDenoiseOn ? 1 : 0;
+    params.nbLights = m_scene->getNbLights();
+    params.adaptiveThreshold = m_isAdaptiveSampling ? m_adaptiveThreshold : 0.0f;
+    params.adaptiveMinFrames = m_adaptiveMinFrames;
+    params.cameraPosition = m_camera.getPosition();
+    params.cameraFocal = m_camera.getFocal();
+    params.cameraRight = m_camera.getRight();
+    params.cameraHalfHeight = m_camera.getHalfHeight();
+    params.cameraDown = m_camera.getDown();
+    params.cameraForward = m_camera.getForward();
+    updateFrameParamsUBO(params, m_uboFrame);
+}
 
-    // bind textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_noiseTex);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, m_perlinR);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, m_perlinG);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, m_perlinB);
-
-    glUniform1i(glGetUniformLocation(m_programRay, "u_screenWidth"), m_winWidth);
-    glUniform1i(glGetUniformLocation(m_programRay, "u_screenHeight"), m_winHeight);
-    glUniform1i(glGetUniformLocation(m_programRay, "u_nbSamples"), m_nbSamples);
-    glUniform1i(glGetUniformLocation(m_programRay, "u_nbBounces"), m_nbBounces);
-    glUniform1f(glGetUniformLocation(m_programRay, "u_lightIntensity"), m_lightIntensity);
-
-    for (unsigned int i = 0; i < 64; ++i)
-    {
-        std::string str = "u_samples[" + std::to_string(i) + "]";
-        glm::vec3 myVec = m_ssaoKernel[i];
-        glUniform3fv(glGetUniformLocation(m_programRay, str.c_str()), 1, &myVec[0]);
-    }   
-
-    glUniform1i(glGetUniformLocation(m_programRay, "u_noiseTex"), 0);
-    glUniform1i(glGetUniformLocation(m_programRay, "u_perlinR"), 1);
-    glUniform1i(glGetUniformLocation(m_programRay, "u_perlinG"), 2);
-    glUniform1i(glGetUniformLocation(m_programRay, "u_perlinB"), 3);
- 
 
-    // execute compute shader on TEX_WIDTH x TEX_WIDTH x 1 local work groups (i.e., one local work group for each pixel in the image)
-    glDispatchCompute((GLuint)TEX_WIDTH, (GLuint)TEX_WIDTH, 1);
+void dispatchRays(GLuint _programRay, GLuint _tileSize)
+{
+    GLuint tileSize = _tileSize;
+    glUseProgram(_programRay);
+    setupRayTracing();
+
+
+    // execute compute shader on tiles of tileSize x tileSize pixels (i.e., one local work group for each tile in the image)
+    // group count is rounded up, edge tiles are clipped in the shader
+    GLuint nbGroupsX = (m_texWidth + tileSize - 1) / tileSize;
+    GLuint nbGroupsY = (m_texHeight + tileSize - 1) / tileSize;
+    glDispatchCompute(nbGroupsX, nbGroupsY, 1);
 
   
     // make sure writing to image has finished before read
     glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
+    if(m_isProgressive)
+        m_frameIndex++;
+
+}
+
+void dispatchWavefront(std::vector<GLuint>* _bounceQueries)
+{
+    setupRayTracing();
+
+    // paths and queues of all the pixels (re-allocated when the render resolution grows)
+    unsigned int nbPixels = m_texWidth * m_texHeight;
+    if(nbPixels > m_wavefrontCapacity)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboPaths);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)nbPixels * WAVEFRONT_PATH_SIZE, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboQueues);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)nbPixels * NB_QUEUES * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboQueueCounters);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * NB_QUEUES * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        m_wavefrontCapacity = nbPixels;
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_ssboPaths);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, m_ssboQueueCounters);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_ssboQueues);
+    // the same buffer holds the arguments of glDispatchComputeIndirect(), after the queue sizes
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_ssboQueueCounters);
+    auto dispatchQueue = [](int _kernel, int _queue)
+    {
+        glUseProgram(m_programsWavefront[_kernel]);
+        glDispatchComputeIndirect((GLintptr)((NB_QUEUES + 3 * _queue) * sizeof(GLuint)));
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    };
+    auto prepare = [](int _stage)
+    {
+        glUseProgram(m_programsWavefront[KERNEL_PREPARE]);
+        glUniform1i(3, _stage);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    };
+
+    // uniforms are per program: each kernel gets the ones it reads
+    GLuint nbGroupsX = (m_texWidth + 7) / 8;
+    GLuint nbGroupsY = (m_texHeight + 7) / 8;
+    const int nbSamples = getFrameSamples();
+    const int nbBounces = getFrameBounces();
+    for(int cptSample = 0; cptSample < nbSamples; cptSample++)
+    {
+        // adaptive sampling: only the pixels that have not converged push their camera ray
+        if(m_isAdaptiveSampling)
+            prepare(PREPARE_GENERATE);
+        glUseProgram(m_programsWavefront[KERNEL_GENERATE]);
+        glUniform1i(1, cptSample);
+        glDispatchCompute(nbGroupsX, nbGroupsY, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // rays of a bounce are read from one queue while the next ones are written to the other
+        int rayQueue = QUEUE_RAYS_0;
+        for(int cptBounce = 0; cptBounce < nbBounces; cptBounce++)
+        {
+            glUseProgram(m_programsWavefront[KERNEL_INTERSECT]);
+            glUniform1i(0, rayQueue);
+            glUniform1i(2, cptBounce);
+            for(int k = KERNEL_SHADE_DIFFUSE; k <= KERNEL_SHADE_GLASS; k++)
+            {
+                glUseProgram(m_programsWavefront[k]);
+                glUniform1i(0, rayQueue);
+                glUniform1i(1, cptSample);
+                glUniform1i(2, cptBounce);
+            }
+            glUseProgram(m_programsWavefront[KERNEL_PREPARE]);
+            glUniform1i(0, rayQueue);
+
+            // benchmark: GPU time of each bounce, one GL_TIME_ELAPSED query per sample and bounce
+            if(_bounceQueries)
+            {
+                _bounceQueries->push_back(0);
+                glGenQueries(1, &_bounceQueries->back());
+                glBeginQuery(GL_TIME_ELAPSED, _bounceQueries->back());
+            }
+            prepare(PREPARE_INTERSECT);
+            dispatchQueue(KERNEL_INTERSECT, rayQueue);
+            // one kernel per material: no divergence between the shading branches
+            prepare(PREPARE_SHADE);
+            dispatchQueue(KERNEL_SHADE_DIFFUSE, QUEUE_DIFFUSE);
+            dispatchQueue(KERNEL_SHADE_MIRROR, QUEUE_MIRROR);
+            dispatchQueue(KERNEL_SHADE_GLASS, QUEUE_GLASS);
+            prepare(PREPARE_SHADOW);
+            dispatchQueue(KERNEL_SHADOW, QUEUE_SHADOW);
+            if(_bounceQueries)
+                glEndQuery(GL_TIME_ELAPSED);
+
+            rayQueue = (rayQueue == QUEUE_RAYS_0) ? QUEUE_RAYS_1 : QUEUE_RAYS_0;
+        }
+
+        glUseProgram(m_programsWavefront[KERNEL_ACCUMULATE]);
+        glUniform1i(1, cptSample);
+        glDispatchCompute(nbGroupsX, nbGroupsY, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+    // make sure writing to image has finished before read
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    if(m_isProgressive)
+        m_frameIndex++;
+}
+
+void denoise()
+{
+    glUseProgram(m_programDenoise);
+
+    // the last iteration writes the display image
+    glBindImageTexture(0, m_screenTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glBindImageTexture(3, m_gNormalDepthTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(4, m_gAlbedoTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+
+    // variance of the accumulated image decreases with the number of samples, so does the color tolerance:
+    // the filter fades out as the progressive accumulation converges
+    unsigned int nbSamples = std::max(1u, m_frameIndex) * (unsigned int)getFrameSamples();
+    glUniform1f(3, m_denoiseColorPhi / (float)nbSamples);
+    glUniform1f(4, m_denoiseNormalPhi);
+    glUniform1f(5, m_denoiseDepthPhi);
+
+    // first iteration reads the accumulated color, next ones the output of the previous one
+    GLuint inputTex = m_accumTex;
+    for(int i = 0; i < m_nbDenoiseIterations; i++)
+    {
+        GLuint outputTex = m_denoiseTex[i % 2];
+        glBindImageTexture(1, inputTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+        glBindImageTexture(2, outputTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+        glUniform1i(0, 1 << i);
+        glUniform1i(1, i == 0 ? 1 : 0);
+        glUniform1i(2, i == m_nbDenoiseIterations - 1 ? 1 : 0);
+
+        glDispatchCompute((m_texWidth + 7) / 8, (m_texHeight + 7) / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
+        inputTex = outputTex;
+    }
 }
 
+
 void displayScreen()
 {
 
@@ -230,6 +730,228 @@ void displayScreen()
 }
 
 
+    /*------------------------------------------------------------------------------------------------------------+
+    |                                                   BENCHMARK                                                 |
+    +-------------------------------------------------------------------------------------------------------------*/
+
+
+bool runBenchmark()
+{
+    const int nbFrames = 16;    // timed frames for each configuration
+
+    // all the pixels are traced at every frame
+    m_isAdaptiveSampling = false;
+    m_maxSamples = 0;
+
+    // random spheres are added to the Cornell box (diffuse material)
+    const std::vector<Sphere> baseSpheres = m_scene->getSpheres();
+
+    std::vector<std::string> sceneNames = { "cornell_spheres", "random_spheres", "random_triangles" };
+    if(!m_meshFilename.empty())
+        sceneNames.insert(sceneNames.begin() + 1, "cornell_mesh");
+
+    // same random scenes for every run
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    auto randomPosition = [&]() { return glm::vec3(8.0f * uniform(rng) - 4.0f, 8.0f * uniform(rng) - 4.0f, -6.0f - 8.0f * uniform(rng)); };
+
+    // ray counters of the counting variant of the shader (binding = 6)
+    GLuint programCount = m_shaderManager->buildProgram({ { GL_COMPUTE_SHADER, shaderDir + "rayTrace.comp", "#define LOCAL_SIZE 8\n#define COUNT_RAYS\n" } });
+    if(programCount == 0)
+        return false;
+    GLuint ssboCounters;
+    glGenBuffers(1, &ssboCounters);
+
+    std::vector<benchmark::Record> records;
+
+    for(const std::string& sceneName : sceneNames)
+    {
+        std::vector<Sphere> spheres = baseSpheres;
+        if(sceneName == "random_spheres")
+        {
+            for(int i = 0; i < m_benchmarkPrimitives; i++)
+                spheres.push_back( Sphere(randomPosition(), glm::vec3(uniform(rng), uniform(rng), uniform(rng)), 0.05f + 0.25f * uniform(rng)) );
+        }
+        m_scene->clearTriangles();
+        m_scene->createSpheresSSBO(spheres);
+        addCornellBoxWalls();
+
+        if(sceneName == "cornell_mesh")
+        {
+            loadMesh(m_meshFilename);
+        }
+        else if(sceneName == "random_triangles")
+        {
+            std::vector<glm::vec3> vertices;
+            std::vector<uint32_t> indices;
+            for(int i = 0; i < m_benchmarkPrimitives; i++)
+            {
+                glm::vec3 v0 = randomPosition();
+                vertices.push_back(v0);
+                vertices.push_back(v0 + glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - 0.5f);
+                vertices.push_back(v0 + glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - 0.5f);
+                indices.insert(indices.end(), { (uint32_t)(3 * i), (uint32_t)(3 * i + 1), (uint32_t)(3 * i + 2) });
+            }
+            m_scene->addMesh(vertices, indices, glm::vec3(0.75f, 0.75f, 0.75f));
+        }
+        m_scene->upload();
+
+        // rays of one frame (the work group size does not change them), counted by the counting variant
+        std::vector<GLuint> counters(1 + m_nbBounces, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCounters);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, counters.size() * sizeof(GLuint), counters.data(), GL_DYNAMIC_READ);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssboCounters);
+        resetAccumulation();
+        dispatchRays(programCount, 8);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, counters.size() * sizeof(GLuint), counters.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        // work group sizes of the megakernel, then the wavefront pipeline
+        for(size_t t = 0; t <= m_tileSizes.size(); t++)
+        {
+            m_isWavefront = (t == m_tileSizes.size());
+            if(!m_isWavefront)
+                m_tileSizeId = (int)t;
+
+            // warm-up frame, then GPU time of the ray tracing of each frame
+            resetAccumulation();
+            renderRays();
+            glFinish();
+
+            std::vector<GLuint> queries(nbFrames);
+            glGenQueries(nbFrames, queries.data());
+            for(int f = 0; f < nbFrames; f++)
+            {
+                glBeginQuery(GL_TIME_ELAPSED, queries[f]);
+                renderRays();
+                glEndQuery(GL_TIME_ELAPSED);
+            }
+
+            // results are read once all the frames are submitted
+            GLuint64 totalTime = 0;
+            for(int f = 0; f < nbFrames; f++)
+            {
+                GLuint64 time = 0;
+                glGetQueryObjectui64v(queries[f], GL_QUERY_RESULT, &time);
+                totalTime += time;
+            }
+            glDeleteQueries(nbFrames, queries.data());
+
+            // wavefront: the same frames again with a query per bounce (queries cannot be nested in the frame ones),
+            // in the order of dispatchWavefront(): samples by samples, bounces by bounces
+            std::vector<GLuint64> bounceTimes(m_nbBounces, 0);
+            if(m_isWavefront)
+            {
+                std::vector<GLuint> bounceQueries;
+                for(int f = 0; f < nbFrames; f++)
+                    dispatchWavefront(&bounceQueries);
+                for(size_t q = 0; q < bounceQueries.size(); q++)
+                {
+                    GLuint64 time = 0;
+                    glGetQueryObjectui64v(bounceQueries[q], GL_QUERY_RESULT, &time);
+                    bounceTimes[q % m_nbBounces] += time;
+                }
+                glDeleteQueries((GLsizei)bounceQueries.size(), bounceQueries.data());
+            }
+
+            benchmark::Record record;
+            record.renderer = "gpu";
+            record.scene = sceneName;
+            record.mode = m_isWavefront ? "wavefront" : m_tileSizeNames[t];
+            record.nbPrimitives = m_scene->getNbSpheres() + m_scene->getNbTriangles();
+            record.width = m_texWidth;
+            record.height = m_texHeight;
+            record.samples = m_nbSamples;
+            record.depth = m_nbBounces;
+            record.frames = nbFrames;
+            record.seconds = totalTime * 1e-9;
+            record.totalRays = (uint64_t)counters[0] * nbFrames;
+            for(int b = 0; b < m_nbBounces; b++)
+            {
+                record.bounceRays.push_back( (uint64_t)counters[1 + b] * nbFrames );
+                record.totalRays += record.bounceRays.back();
+                if(m_isWavefront)
+                    record.bounceMs.push_back( bounceTimes[b] * 1e-6 );
+            }
+            record.primaryRays = record.bounceRays[0];
+
+            benchmark::Print(record);
+            records.push_back(record);
+        }
+    }
+
+    glDeleteBuffers(1, &ssboCounters);
+    glDeleteProgram(programCount);
+
+    return benchmark::Write(m_benchmarkFilename, records);
+}
+
+
+
+    /*------------------------------------------------------------------------------------------------------------+
+    |                                                   HEADLESS                                                  |
+    +-------------------------------------------------------------------------------------------------------------*/
+
+
+bool runHeadless()
+{
+    TextureReadback readback;
+    bool isSaved = true;
+    auto saveReadback = [&]()
+    {
+        std::vector<unsigned char> pixels;
+        isSaved = readback.finish(pixels) && saveImage(m_outputFilename, pixels, readback.getWidth(), readback.getHeight()) && isSaved;
+    };
+
+    // progressive rendering, snapshots are copied while the next frames are rendered
+    m_isProgressive = true;
+    resetAccumulation();
+    auto start = std::chrono::steady_clock::now();
+    for(int frame = 1; frame <= m_nbHeadlessFrames; frame++)
+    {
+        update();
+        renderRays();
+        // with a time budget, wait for the frame so that the elapsed time includes its rendering
+        if(m_timeBudget > 0.0f)
+            glFinish();
+
+        if(readback.isPending() && readback.isReady())
+            saveReadback();
+
+        // budgets can end the rendering before m_nbHeadlessFrames
+        bool isLast = frame == m_nbHeadlessFrames || isSampleBudgetReached()
+                      || (m_timeBudget > 0.0f && std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() >= m_timeBudget);
+        bool isSnapshot = m_snapshotInterval > 0 && frame % m_snapshotInterval == 0;
+        if(isSnapshot || isLast)
+        {
+            // only one copy in flight: previous snapshot has to be written first
+            if(readback.isPending())
+                saveReadback();
+
+            // filter the image to save only (rendering goes on from the accumulation buffer)
+            if(m_isDenoiseOn)
+                denoise();
+
+            // glGetTexImage() reads the texture written by the compute shader
+            glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+            readback.start(m_screenTex, m_texWidth, m_texHeight);
+            std::cout << "Frame " << frame << "/" << m_nbHeadlessFrames << " (" << frame * m_nbSamples << " samples per pixel)" << std::endl;
+        }
+        if(isLast)
+            break;
+    }
+
+    if(readback.isPending())
+        saveReadback();
+
+    if(isSaved)
+        std::cout << "Saved " << m_outputFilename << " (" << m_texWidth << " x " << m_texHeight << ")" << std::endl;
+    return isSaved;
+}
+
+
+
     /*------------------------------------------------------------------------------------------------------------+
     |                                                CALLBACK METHODS                                             |
     +-------------------------------------------------------------------------------------------------------------*/
@@ -241,10 +963,7 @@ void resizeCallback(GLFWwindow* window, int width, int height)
     m_winHeight = height;
     glViewport(0, 0, width, height);
 
-    // keep drawing while resize
-    update();
-
-    renderRays();
+    // render targets are re-allocated by the next update(), meanwhile the previous image is stretched to the window
     displayScreen();
 
     // Swap between front and back buffer
@@ -254,10 +973,13 @@ void resizeCallback(GLFWwindow* window, int width, int height)
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-    // return to init positon when "R" pressed
+    if(ImGui::GetIO().WantCaptureKeyboard)
+        return;
+
+    // return to init positon when "R" pressed (accumulation restarts at next update())
     if (key == GLFW_KEY_R && action == GLFW_PRESS) 
     {
-       
+        m_camera.reset();
     }
 }
 
@@ -267,15 +989,40 @@ void charCallback(GLFWwindow* window, unsigned int codepoint)
 
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
-{}
+{
+    // drags starting on the GUI do not move the camera
+    if(action == GLFW_PRESS && m_mouseButton < 0 && !ImGui::GetIO().WantCaptureMouse)
+    {
+        m_mouseButton = button;
+        glfwGetCursorPos(window, &m_cursorX, &m_cursorY);
+    }
+    else if(action == GLFW_RELEASE && button == m_mouseButton)
+    {
+        m_mouseButton = -1;
+    }
+}
 
 
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
-{}
+{
+    if(!ImGui::GetIO().WantCaptureMouse)
+        m_camera.zoom((float)yoffset);
+}
 
 
 void cursorPosCallback(GLFWwindow* window, double x, double y)
-{}
+{
+    float dx = (float)(x - m_cursorX);
+    float dy = (float)(y - m_cursorY);
+    m_cursorX = x;
+    m_cursorY = y;
+
+    // left button: rotate, right or middle button: pan
+    if(m_mouseButton == GLFW_MOUSE_BUTTON_LEFT)
+        m_camera.rotate(dx, dy);
+    else if(m_mouseButton == GLFW_MOUSE_BUTTON_RIGHT || m_mouseButton == GLFW_MOUSE_BUTTON_MIDDLE)
+        m_camera.pan(dx, dy);
+}
 
 
 
@@ -294,11 +1041,125 @@ void runGUI()
         float frameRate = ImGui::GetIO().Framerate;
         ImGui::Text("FrameRate: %.3f ms/frame (%.1f FPS)", 1000.0f / frameRate, frameRate);
 
-        ImGui::SliderInt("Samples per pixel", &m_nbSamples, 1, 5);
-
-        ImGui::SliderInt("Number of bounces", &m_nbBounces, 1, 5);
-
-        ImGui::SliderFloat("Light intensity", &m_lightIntensity, 0.0f, 2000.0f, "%.0f");
+        // any change of the rendering parameters restarts the accumulation
+        if(ImGui::SliderInt("Samples per pixel", &m_nbSamples, 1, 5))
+            resetAccumulation();
+
+        if(ImGui::SliderInt("Number of bounces", &m_nbBounces, 1, 5))
+            resetAccumulation();
+
+        if(ImGui::SliderFloat("Light intensity", &m_lightIntensity, 0.0f, 2000.0f, "%.0f"))
+            resetAccumulation();
+
+        // material changes are uploaded (and restart the accumulation) at next update()
+        Material mirror = m_scene->getMaterial(MATERIAL_ID_MIRROR);
+        if(ImGui::SliderFloat("Mirror roughness", &mirror.roughness, 0.0f, 1.0f, "%.2f"))
+            m_scene->updateMaterial(MATERIAL_ID_MIRROR, mirror);
+        Material glass = m_scene->getMaterial(MATERIAL_ID_GLASS);
+        if(ImGui::SliderFloat("Glass index of refraction", &glass.ior, 1.0f, 2.5f, "%.2f"))
+            m_scene->updateMaterial(MATERIAL_ID_GLASS, glass);
+
+        if(ImGui::Checkbox("Progressive accumulation", &m_isProgressive))
+            resetAccumulation();
+
+        if(m_isProgressive)
+        {
+            ImGui::Text("Accumulated frames: %u (%u samples per pixel)", m_frameIndex, m_frameIndex * m_nbSamples);
+            if(ImGui::InputInt("Max samples per pixel (0: no limit)", &m_maxSamples))
+                m_maxSamples = std::max(m_maxSamples, 0);
+
+            // the statistics of the pixels are kept when the thresholds change: pixels resume or stop at next frame
+            ImGui::Checkbox("Adaptive sampling", &m_isAdaptiveSampling);
+            if(m_isAdaptiveSampling)
+            {
+                ImGui::SliderFloat("Adaptive threshold", &m_adaptiveThreshold, 0.005f, 0.5f, "%.3f");
+                ImGui::SliderInt("Adaptive min frames", &m_adaptiveMinFrames, 2, 64);
+            }
+        }
+
+        if(ImGui::Checkbox("Shader hot reload", &m_isShaderHotReload))
+            m_shaderManager->setHotReload(m_isShaderHotReload);
+        if(m_shaderManager->isReloading())
+            ImGui::Text("Compiling shaders...");
+
+        ImGui::Combo("Work group size", &m_tileSizeId, m_tileSizeNames, (int)m_tileSizes.size());
+        // same image (same random numbers), only the scheduling of the work changes
+        ImGui::Checkbox("Wavefront pipeline", &m_isWavefront);
+        if(!m_isWavefront)
+        {
+            // variants of the megakernel, compiled when selected
+            ImGui::Checkbox("Specialized samples and bounces", &m_isSpecialized);
+            if(ImGui::Combo("Shading model", &m_shadingModel, m_shadingModelNames, 3))
+                resetAccumulation();
+            if(ImGui::Combo("Random numbers", &m_rngType, m_rngTypeNames, 2))
+                resetAccumulation();
+        }
+
+        // G-buffer is accumulated with the color: restart when it is turned on
+        if(ImGui::Checkbox("Denoiser", &m_isDenoiseOn))
+            resetAccumulation();
+        if(m_isDenoiseOn)
+        {
+            ImGui::SliderInt("Denoiser iterations", &m_nbDenoiseIterations, 1, 5);
+            ImGui::SliderFloat("Color tolerance", &m_denoiseColorPhi, 0.1f, 20.0f, "%.2f");
+            ImGui::SliderFloat("Normal tolerance", &m_denoiseNormalPhi, 0.01f, 1.0f, "%.2f");
+            ImGui::SliderFloat("Depth tolerance", &m_denoiseDepthPhi, 0.1f, 10.0f, "%.2f");
+        }
+
+        // render targets follow the new scale at next update()
+        ImGui::SliderFloat("Render scale", &m_renderScale, MIN_RENDER_SCALE, 1.0f, "%.2f");
+        ImGui::Checkbox("Adaptive resolution", &m_isAdaptiveResolution);
+        if(m_isAdaptiveResolution)
+            ImGui::SliderFloat("Target frame time (ms)", &m_targetFrameTime, 4.0f, 50.0f, "%.1f");
+        ImGui::Text("Render resolution: %u x %u", m_texWidth, m_texHeight);
+
+        if(ImGui::CollapsingHeader("Camera"))
+        {
+            int cameraMode = m_camera.getMode();
+            if(ImGui::Combo("Camera mode", &cameraMode, m_cameraModeNames, 2))
+                m_camera.setMode((Camera::Mode)cameraMode);
+            ImGui::Text("Left drag: rotate, right drag: pan, wheel: zoom, R: reset");
+            if(m_camera.getMode() == Camera::MODE_FLY)
+            {
+                ImGui::Text("W/A/S/D: move, Q/E: down/up, shift: faster");
+                ImGui::SliderFloat("Fly speed", &m_flySpeed, 0.5f, 20.0f, "%.1f");
+            }
+            // low latency while moving (can be combined with the adaptive resolution)
+            ImGui::Checkbox("Preview while moving", &m_isCameraPreview);
+            if(m_isCameraPreview)
+                ImGui::SliderInt("Preview bounces", &m_previewBounces, 1, 5);
+        }
+
+        if(ImGui::CollapsingHeader("GPU timings", ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            // times of the previous frames (queries are read back with a latency of two frames)
+            const std::vector<float>& frameHistory = m_gpuTimer->getFrameHistory();
+            float maxTime = *std::max_element(frameHistory.begin(), frameHistory.end());
+            float frameTime = 0.0f;
+            for(int stage = 0; stage < m_gpuTimer->getNbStages(); stage++)
+                frameTime += m_gpuTimer->getAverageTime(stage);
+            char frameLabel[64];
+            snprintf(frameLabel, sizeof(frameLabel), "GPU frame %.3f ms", frameTime);
+            ImGui::PlotLines("##frame", frameHistory.data(), GpuTimer::HISTORY_SIZE, m_gpuTimer->getHistoryOffset(),
+                             frameLabel, 0.0f, maxTime, ImVec2(0, 60));
+
+            for(int stage = 0; stage < m_gpuTimer->getNbStages(); stage++)
+            {
+                ImGui::Text("%-12s %7.3f ms (avg. %7.3f ms)", m_gpuTimer->getStageName(stage).c_str(),
+                            m_gpuTimer->getLastTime(stage), m_gpuTimer->getAverageTime(stage));
+                std::string plotId = "##" + m_gpuTimer->getStageName(stage);
+                ImGui::PlotLines(plotId.c_str(), m_gpuTimer->getHistory(stage).data(), GpuTimer::HISTORY_SIZE,
+                                 m_gpuTimer->getHistoryOffset(), nullptr, 0.0f, maxTime, ImVec2(0, 30));
+            }
+
+            // ray tracing throughput, independent of the display and of vsync
+            float rayTime = m_gpuTimer->getAverageTime(STAGE_RAYS);
+            if(rayTime > 0.0f)
+            {
+                double samplesPerSecond = (double)m_texWidth * m_texHeight * m_nbSamples / (rayTime * 1e-3);
+                ImGui::Text("%.1f Msamples/s (%d bounces)", samplesPerSecond * 1e-6, m_nbBounces);
+            }
+        }
         
 
     } // end "Settings"
@@ -310,8 +1171,138 @@ void runGUI()
     ImGui::Render();
 }
 
+bool parseArguments(int argc, char** argv)
+{
+    // command line: [mesh.obj] [--benchmark results.json|results.csv [--size WxH]]
+    //               [--output image.png|image.ppm [--frames N] [--snapshot N] [--size WxH] [--denoise] [--time-budget S]]
+    //               [--spp N] [--bounces N] [--wavefront] [--adaptive T] [--max-spp N] [--hot-reload] [--no-shader-cache]
+    //               [--specialize] [--shading path|phong|pbr] [--rng pcg|xorshift] [--camera YAW,PITCH,DISTANCE]
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "--benchmark" && hasValue)
+            m_benchmarkFilename = argv[++i];
+        else if(arg == "--output" && hasValue)
+            m_outputFilename = argv[++i];
+        else if(arg == "--frames" && hasValue)
+            m_nbHeadlessFrames = std::atoi(argv[++i]);
+        else if(arg == "--snapshot" && hasValue)
+            m_snapshotInterval = std::atoi(argv[++i]);
+        else if(arg == "--spp" && hasValue)
+            m_nbSamples = std::atoi(argv[++i]);
+        else if(arg == "--bounces" && hasValue)
+            m_nbBounces = std::atoi(argv[++i]);
+        else if(arg == "--denoise")
+            m_isDenoiseOn = true;
+        else if(arg == "--wavefront")
+            m_isWavefront = true;
+        else if(arg == "--camera" && hasValue)
+        {
+            // orbit around the center of the box, angles in degrees
+            float yaw = 0.0f, pitch = 0.0f, distance = 0.0f;
+            if(sscanf(argv[++i], "%f,%f,%f", &yaw, &pitch, &distance) != 3 || distance <= 0.0f)
+            {
+                std::cerr << "[ERROR] parseArguments(): invalid camera " << argv[i] << " (expected YAW,PITCH,DISTANCE)" << std::endl;
+                return false;
+            }
+            m_camera.setOrbit(glm::radians(yaw), glm::radians(pitch), distance);
+        }
+        else if(arg == "--specialize")
+            m_isSpecialized = true;
+        else if(arg == "--shading" && hasValue)
+        {
+            std::string model = argv[++i];
+            if(model == "path")
+                m_shadingModel = SHADING_PATH_TRACING;
+            else if(model == "phong")
+                m_shadingModel = SHADING_PHONG;
+            else if(model == "pbr")
+                m_shadingModel = SHADING_PBR;
+            else
+            {
+                std::cerr << "[ERROR] parseArguments(): invalid shading model " << model << " (expected path, phong or pbr)" << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--rng" && hasValue)
+        {
+            std::string rng = argv[++i];
+            if(rng == "pcg")
+                m_rngType = RNG_PCG;
+            else if(rng == "xorshift")
+                m_rngType = RNG_XORSHIFT;
+            else
+            {
+                std::cerr << "[ERROR] parseArguments(): invalid random number generator " << rng << " (expected pcg or xorshift)" << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--hot-reload")
+            m_isShaderHotReload = true;
+        else if(arg == "--no-shader-cache")
+            m_shaderCacheDir.clear();
+        else if(arg == "--adaptive" && hasValue)
+        {
+            m_isAdaptiveSampling = true;
+            m_adaptiveThreshold = (float)std::atof(argv[++i]);
+        }
+        else if(arg == "--max-spp" && hasValue)
+            m_maxSamples = std::atoi(argv[++i]);
+        else if(arg == "--time-budget" && hasValue)
+            m_timeBudget = (float)std::atof(argv[++i]);
+        else if(arg == "--size" && hasValue)
+        {
+            if(sscanf(argv[++i], "%ux%u", &m_texWidth, &m_texHeight) != 2 || m_texWidth == 0 || m_texHeight == 0)
+            {
+                std::cerr << "[ERROR] parseArguments(): invalid size " << argv[i] << " (expected WxH)" << std::endl;
+                return false;
+            }
+        }
+        else if(arg.rfind("--", 0) == 0)
+        {
+            std::cerr << "[ERROR] parseArguments(): unknown option or missing value " << arg << std::endl;
+            return false;
+        }
+        else
+            m_meshFilename = arg;
+    }
+
+    if(m_nbHeadlessFrames < 1 || m_snapshotInterval < 0 || m_nbSamples < 1 || m_nbBounces < 1)
+    {
+        std::cerr << "[ERROR] parseArguments(): --frames, --spp and --bounces must be positive, --snapshot cannot be negative" << std::endl;
+        return false;
+    }
+    if(m_adaptiveThreshold <= 0.0f || m_maxSamples < 0 || m_timeBudget < 0.0f)
+    {
+        std::cerr << "[ERROR] parseArguments(): --adaptive must be positive, --max-spp and --time-budget cannot be negative" << std::endl;
+        return false;
+    }
+
+    // headless and benchmark: hidden window of the size of the image, so that the camera aspect ratio matches
+    // (headless: 512 x 512 without --size, GLFW cannot create empty windows; benchmark: default window size)
+    if(!m_outputFilename.empty() && (m_texWidth == 0 || m_texHeight == 0))
+    {
+        m_texWidth = 512;
+        m_texHeight = 512;
+    }
+    if((!m_outputFilename.empty() || !m_benchmarkFilename.empty()) && m_texWidth > 0 && m_texHeight > 0)
+    {
+        m_winWidth = (int)m_texWidth;
+        m_winHeight = (int)m_texHeight;
+    }
+    return true;
+}
+
+
 int main(int argc, char** argv)
 {
+    if(!parseArguments(argc, argv))
+        return 1;
+    bool isInteractive = m_benchmarkFilename.empty() && m_outputFilename.empty();
+    // benchmark and headless modes render the initial view at full quality
+    m_isCameraPreview = m_isCameraPreview && isInteractive;
+    m_camera.isChanged();
 
     // Initialize GLFW and create a window
     glfwInit();
@@ -319,8 +1310,19 @@ int main(int argc, char** argv)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);//2
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // <-- activate this line on MacOS
+    // benchmark and headless modes do not display anything
+    glfwWindowHint(GLFW_VISIBLE, isInteractive ? GLFW_TRUE : GLFW_FALSE);
     m_window = glfwCreateWindow(m_winWidth, m_winHeight, "Ray_compute demo", nullptr, nullptr);
+    if(!m_window)
+    {
+        std::cerr << "[ERROR] main(): cannot create a " << m_winWidth << " x " << m_winHeight << " window with an OpenGL 4.3 context" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
     glfwMakeContextCurrent(m_window);
+    // framebuffer can be larger than the window on high DPI screens (headless mode renders at the requested size)
+    if(isInteractive)
+        glfwGetFramebufferSize(m_window, &m_winWidth, &m_winHeight);
     glfwSetFramebufferSizeCallback(m_window, resizeCallback);
     glfwSetKeyCallback(m_window, keyCallback);
     glfwSetCharCallback(m_window, charCallback);
@@ -352,11 +1354,19 @@ int main(int argc, char** argv)
     // call init function
     initialize();
 
+    int exitCode = 0;
+    if(!m_benchmarkFilename.empty())
+        exitCode = runBenchmark() ? 0 : 1;
+    else if(!m_outputFilename.empty())
+        exitCode = runHeadless() ? 0 : 1;
+
     // main rendering loop
-    while (!glfwWindowShouldClose(m_window)) 
+    while (isInteractive && !glfwWindowShouldClose(m_window)) 
     {
         // process events
         glfwPollEvents();
+        // read back the GPU times of a previous frame
+        m_gpuTimer->beginFrame();
         // start frame for ImGUI
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -367,12 +1377,24 @@ int main(int argc, char** argv)
         // idle updates
         update();
         // compute shader
+        m_gpuTimer->begin(STAGE_RAYS);
         renderRays();
+        m_gpuTimer->end();
+        if(m_isDenoiseOn)
+        {
+            m_gpuTimer->begin(STAGE_DENOISE);
+            denoise();
+            m_gpuTimer->end();
+        }
         // render
+        m_gpuTimer->begin(STAGE_DISPLAY);
         displayScreen();
+        m_gpuTimer->end();
 
         // render GUI
+        m_gpuTimer->begin(STAGE_GUI);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        m_gpuTimer->end();
         
         // Swap between front and back buffer
         glfwSwapBuffers(m_window);
@@ -381,6 +1403,27 @@ int main(int argc, char** argv)
 
     // delete shadow map FBO and texture
     glDeleteTextures(1, &m_screenTex);
+    glDeleteTextures(1, &m_accumTex);
+    glDeleteTextures(1, &m_gNormalDepthTex);
+    glDeleteTextures(1, &m_gAlbedoTex);
+    glDeleteTextures(1, &m_pixelStatsTex);
+    glDeleteTextures(2, m_denoiseTex);
+    m_scene.reset();
+    m_gpuTimer.reset();
+    glDeleteBuffers(1, &m_uboFrame);
+
+    for(GLuint programRay : m_programsRay)
+        glDeleteProgram(programRay);
+    for(auto& [defines, programRay] : m_programsRayVariants)
+        glDeleteProgram(programRay);
+    glDeleteProgram(m_programDenoise);
+    for(GLuint programWavefront : m_programsWavefront)
+        glDeleteProgram(programWavefront);
+    glDeleteProgram(m_programQuad);
+    m_shaderManager.reset();
+    glDeleteBuffers(1, &m_ssboPaths);
+    glDeleteBuffers(1, &m_ssboQueueCounters);
+    glDeleteBuffers(1, &m_ssboQueues);
 
     // Cleanup imGui
     ImGui_ImplOpenGL3_Shutdown();
@@ -393,5 +1436,5 @@ int main(int argc, char** argv)
 
     std::cout << std::endl << "Bye!" << std::endl;
 
-    return 0;
+    return exitCode;
 }
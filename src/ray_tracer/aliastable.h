@@ -0,0 +1,107 @@
+/******************************************************************
+*
+* aliastable.h
+*
+* Alias table (Walker 1977, built with Vose's method): samples
+* a discrete distribution in O(1) with a single random number,
+* used to pick a light source proportionally to its power.
+* Only depends on the standard library, so the same table can
+* be used by the offline and the GPU renderers.
+*
+*******************************************************************/
+
+#ifndef ALIASTABLE_H
+#define ALIASTABLE_H
+
+#include <cstdint>
+#include <vector>
+
+namespace alias
+{
+
+/*
+ * Entry i is chosen with probability pmf[i]: the random number selects
+ * a bin in [0, n[, and the bin returns i if the fractional part
+ * is below threshold[i], its alias otherwise
+ */
+struct AliasTable
+{
+    std::vector<double> pmf;
+    std::vector<double> threshold;
+    std::vector<uint32_t> alias;
+
+    uint32_t size() const { return (uint32_t)pmf.size(); }
+
+    bool isEmpty() const { return pmf.empty(); }
+
+    /*
+     * Build the table from non-negative weights (not necessarily normalized),
+     * returns false (and leaves the table empty) if all the weights are zero
+     */
+    bool Build(const std::vector<double>& _weights)
+    {
+        pmf.clear();
+        threshold.clear();
+        alias.clear();
+
+        double sum = 0.0;
+        for (double w : _weights)
+            sum += w > 0.0 ? w : 0.0;
+        if (!(sum > 0.0))
+            return false;
+
+        const uint32_t n = (uint32_t)_weights.size();
+        pmf.resize(n);
+        threshold.resize(n);
+        alias.resize(n);
+
+        // probabilities scaled by n: bins under 1 are filled with the excess of bins over 1
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            pmf[i] = (_weights[i] > 0.0 ? _weights[i] : 0.0) / sum;
+            scaled[i] = pmf[i] * n;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty())
+        {
+            uint32_t s = small.back(); small.pop_back();
+            uint32_t l = large.back(); large.pop_back();
+            threshold[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            (scaled[l] < 1.0 ? small : large).push_back(l);
+        }
+        // leftovers are (up to rounding errors) full bins
+        for (uint32_t i : large)
+        {
+            threshold[i] = 1.0;
+            alias[i] = i;
+        }
+        for (uint32_t i : small)
+        {
+            threshold[i] = 1.0;
+            alias[i] = i;
+        }
+        return true;
+    }
+
+    /*
+     * Pick an entry with a random number _u in [0, 1[
+     */
+    uint32_t Sample(double _u) const
+    {
+        const uint32_t n = size();
+        double x = _u * n;
+        uint32_t bin = (uint32_t)x;
+        if (bin >= n)
+            bin = n - 1;
+        return (x - bin) < threshold[bin] ? bin : alias[bin];
+    }
+};
+
+} // namespace alias
+
+#endif // ALIASTABLE_H
@@ -0,0 +1,151 @@
+/******************************************************************
+*
+* benchmark.h
+*
+* Results of the benchmark modes of both renderers (offline path
+* tracer and compute shader), written as JSON or CSV so that runs
+* of different versions can be compared by scripts.
+*
+*******************************************************************/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+namespace benchmark
+{
+
+/*
+ * One timed run
+ */
+struct Record
+{
+    std::string renderer;           // "cpu" or "gpu"
+    std::string scene;
+    std::string mode;               // cpu: "scalar" or "wavefront", gpu: work group size
+    uint64_t nbPrimitives = 0;
+    int width = 0, height = 0;
+    int samples = 0;                // cpu: per subpixel, gpu: per pixel and per frame
+    int depth = 0;                  // max number of bounces
+    int threads = 0;                // cpu threads (0 for gpu)
+    int frames = 1;
+    double seconds = 0.0;           // whole run (gpu: sum of the dispatch times)
+    uint64_t primaryRays = 0;
+    uint64_t totalRays = 0;         // primary, secondary and shadow rays
+    std::vector<uint64_t> bounceRays;   // rays of each bounce (0: primary), if available
+    std::vector<double> bounceMs;       // time of each bounce, if available (cpu: summed over threads, gpu: wavefront only)
+
+    double mraysPerSecond() const { return seconds > 0.0 ? totalRays / seconds * 1e-6 : 0.0; }
+    double primaryMraysPerSecond() const { return seconds > 0.0 ? primaryRays / seconds * 1e-6 : 0.0; }
+};
+
+
+namespace detail
+{
+
+inline std::string Quote(const std::string& _s)
+{
+    std::string q = "\"";
+    for (char c : _s)
+    {
+        if (c == '"' || c == '\\')
+            q += '\\';
+        q += c;
+    }
+    return q + "\"";
+}
+
+template<typename T>
+std::string Join(const std::vector<T>& _values, const char* _separator)
+{
+    std::ostringstream out;
+    for (size_t i = 0; i < _values.size(); i++)
+        out << (i ? _separator : "") << _values[i];
+    return out.str();
+}
+
+} //namespace detail
+
+
+inline std::string ToJSON(const std::vector<Record>& _records)
+{
+    std::ostringstream out;
+    out << "[\n";
+    for (size_t i = 0; i < _records.size(); i++)
+    {
+        const Record& r = _records[i];
+        out << "  { \"renderer\": " << detail::Quote(r.renderer)
+            << ", \"scene\": " << detail::Quote(r.scene)
+            << ", \"mode\": " << detail::Quote(r.mode)
+            << ", \"primitives\": " << r.nbPrimitives
+            << ", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"samples\": " << r.samples << ", \"depth\": " << r.depth
+            << ", \"threads\": " << r.threads << ", \"frames\": " << r.frames
+            << ", \"seconds\": " << r.seconds
+            << ", \"primaryRays\": " << r.primaryRays << ", \"totalRays\": " << r.totalRays
+            << ", \"primaryMraysPerSecond\": " << r.primaryMraysPerSecond()
+            << ", \"mraysPerSecond\": " << r.mraysPerSecond()
+            << ", \"bounceRays\": [" << detail::Join(r.bounceRays, ", ") << "]"
+            << ", \"bounceMs\": [" << detail::Join(r.bounceMs, ", ") << "] }"
+            << (i + 1 < _records.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+    return out.str();
+}
+
+
+/* one line per record, per bounce values separated by ';' */
+inline std::string ToCSV(const std::vector<Record>& _records)
+{
+    std::ostringstream out;
+    out << "renderer,scene,mode,primitives,width,height,samples,depth,threads,frames,seconds,"
+        << "primaryRays,totalRays,primaryMraysPerSecond,mraysPerSecond,bounceRays,bounceMs\n";
+    for (const Record& r : _records)
+    {
+        out << r.renderer << "," << r.scene << "," << r.mode << "," << r.nbPrimitives << ","
+            << r.width << "," << r.height << "," << r.samples << "," << r.depth << ","
+            << r.threads << "," << r.frames << "," << r.seconds << ","
+            << r.primaryRays << "," << r.totalRays << ","
+            << r.primaryMraysPerSecond() << "," << r.mraysPerSecond() << ","
+            << detail::Join(r.bounceRays, ";") << "," << detail::Join(r.bounceMs, ";") << "\n";
+    }
+    return out.str();
+}
+
+
+/*
+ * Write the records, format given by the file extension (.csv, JSON otherwise)
+ */
+inline bool Write(const std::string& _filename, const std::vector<Record>& _records)
+{
+    std::ofstream file(_filename);
+    if (!file)
+    {
+        std::cerr << "[ERROR] benchmark::Write(): cannot open " << _filename << std::endl;
+        return false;
+    }
+
+    std::string ext = _filename.substr(_filename.find_last_of('.') + 1);
+    file << (ext == "csv" ? ToCSV(_records) : ToJSON(_records));
+    return (bool)file;
+}
+
+
+/* one line summary of a record, for the console */
+inline void Print(const Record& _r)
+{
+    std::cout << "[BENCHMARK] " << _r.renderer << " " << _r.scene << " (" << _r.nbPrimitives << " primitives) "
+              << _r.mode << ", " << _r.threads << " threads: " << _r.seconds << " s, "
+              << _r.primaryMraysPerSecond() << " primary Mrays/s, " << _r.mraysPerSecond() << " Mrays/s" << std::endl;
+}
+
+} //namespace benchmark
+
+#endif // BENCHMARK_H
@@ -0,0 +1,349 @@
+/******************************************************************
+*
+* bvh.h
+*
+* Bounding Volume Hierarchy built with the Surface Area Heuristic.
+* Only depends on the standard library, so the same builder and
+* node layout can be used by the offline and the GPU renderers.
+*
+*******************************************************************/
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+namespace bvh
+{
+
+/*
+ * Maximum depth of the hierarchy (root at depth 0), for fixed size traversal stacks:
+ * a traversal holds at most MAX_DEPTH + 1 nodes (cf. BVH_STACK_SIZE in rtCommon.glsl).
+ * SAH splits can be very unbalanced (e.g. spheres at geometrically growing distances),
+ * so Build() switches to median splits when the remaining depth gets too small.
+ */
+const uint32_t MAX_DEPTH = 31;
+
+/*
+ * Axis aligned bounding box (single precision)
+ */
+struct AABB
+{
+    float min[3] = {  INFINITY,  INFINITY,  INFINITY };
+    float max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+    void grow(const AABB& b)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            min[a] = std::min(min[a], b.min[a]);
+            max[a] = std::max(max[a], b.max[a]);
+        }
+    }
+
+    void grow(const float p[3])
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            min[a] = std::min(min[a], p[a]);
+            max[a] = std::max(max[a], p[a]);
+        }
+    }
+
+    float centroid(int a) const { return 0.5f * (min[a] + max[a]); }
+
+    bool isEmpty() const { return min[0] > max[0]; }
+
+    // half surface area (the factor 2 cancels out in the SAH)
+    float halfArea() const
+    {
+        if (isEmpty())
+            return 0.0f;
+        float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    /*
+     * Build a box from double precision bounds, rounded outwards
+     * so that the float box always contains the exact one
+     */
+    static AABB FromDoubles(double minX, double minY, double minZ, double maxX, double maxY, double maxZ)
+    {
+        AABB b;
+        const double mins[3] = { minX, minY, minZ };
+        const double maxs[3] = { maxX, maxY, maxZ };
+        for (int a = 0; a < 3; a++)
+        {
+            b.min[a] = std::nextafter((float)mins[a], -INFINITY);
+            b.max[a] = std::nextafter((float)maxs[a],  INFINITY);
+        }
+        return b;
+    }
+};
+
+
+/*
+ * Flattened BVH node (32 bytes, two nodes per 64-byte cache line)
+ * - interior node (count == 0): children are nodes leftFirst and leftFirst + 1
+ * - leaf (count > 0): primitives leftFirst to leftFirst + count - 1
+ * Must be consistent with struct BVHNode defined in compute shader
+ */
+struct alignas(32) Node
+{
+    float bboxMin[3];
+    uint32_t leftFirst;
+    float bboxMax[3];
+    uint32_t count;
+
+    bool isLeaf() const { return count > 0; }
+};
+static_assert(sizeof(Node) == 32, "BVH node must be 32 bytes");
+
+
+/*
+ * Hierarchy: node 0 is the root, primIndices maps leaf slots to the input primitives
+ */
+struct BVH
+{
+    std::vector<Node> nodes;
+    std::vector<uint32_t> primIndices;
+
+    bool isEmpty() const { return primIndices.empty(); }
+};
+
+
+namespace detail
+{
+    const int NB_BINS = 16;
+
+    // depth of a tree of median splits down to single primitives
+    inline uint32_t ceilLog2(uint32_t _count)
+    {
+        uint32_t log = 0;
+        while (log < 32 && (1ull << log) < _count)
+            log++;
+        return log;
+    }
+
+    inline void setBounds(Node& node, const AABB& b)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            node.bboxMin[a] = b.min[a];
+            node.bboxMax[a] = b.max[a];
+        }
+    }
+
+    /*
+     * Binned SAH: evaluate NB_BINS - 1 split planes per axis, over the centroid bounds
+     * returns the cost of the best split and its axis/position, or INFINITY if none is valid
+     */
+    inline float findBestSplit(const std::vector<AABB>& _bounds, const std::vector<uint32_t>& _indices,
+                               uint32_t _first, uint32_t _count, int& _axis, float& _splitPos)
+    {
+        AABB centroidBounds;
+        for (uint32_t i = _first; i < _first + _count; i++)
+        {
+            const AABB& b = _bounds[_indices[i]];
+            float c[3] = { b.centroid(0), b.centroid(1), b.centroid(2) };
+            centroidBounds.grow(c);
+        }
+
+        float bestCost = INFINITY;
+        for (int a = 0; a < 3; a++)
+        {
+            float extent = centroidBounds.max[a] - centroidBounds.min[a];
+            if (extent <= 0.0f)
+                continue;
+
+            AABB binBounds[NB_BINS];
+            uint32_t binCount[NB_BINS] = { 0 };
+            float scale = NB_BINS / extent;
+            for (uint32_t i = _first; i < _first + _count; i++)
+            {
+                const AABB& b = _bounds[_indices[i]];
+                int bin = std::min(NB_BINS - 1, (int)((b.centroid(a) - centroidBounds.min[a]) * scale));
+                binCount[bin]++;
+                binBounds[bin].grow(b);
+            }
+
+            // sweep from the left and from the right to get the areas and counts on each side of every plane
+            float leftArea[NB_BINS - 1], rightArea[NB_BINS - 1];
+            uint32_t leftCount[NB_BINS - 1], rightCount[NB_BINS - 1];
+            AABB leftBox, rightBox;
+            uint32_t leftSum = 0, rightSum = 0;
+            for (int i = 0; i < NB_BINS - 1; i++)
+            {
+                leftSum += binCount[i];
+                leftCount[i] = leftSum;
+                leftBox.grow(binBounds[i]);
+                leftArea[i] = leftBox.halfArea();
+
+                rightSum += binCount[NB_BINS - 1 - i];
+                rightCount[NB_BINS - 2 - i] = rightSum;
+                rightBox.grow(binBounds[NB_BINS - 1 - i]);
+                rightArea[NB_BINS - 2 - i] = rightBox.halfArea();
+            }
+
+            for (int i = 0; i < NB_BINS - 1; i++)
+            {
+                if (leftCount[i] == 0 || rightCount[i] == 0)
+                    continue;
+                float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    _axis = a;
+                    _splitPos = centroidBounds.min[a] + (i + 1) / scale;
+                }
+            }
+        }
+        return bestCost;
+    }
+}
+
+
+/*
+ * Build the hierarchy over a set of primitive bounds
+ * _maxLeafSize : leaves are split until they contain at most this number of primitives,
+ *                unless the SAH finds that keeping a larger leaf is cheaper
+ * _packSize : number of primitives intersected at once (e.g. SIMD packs), nodes
+ *             with at most _packSize primitives are always kept as leaves
+ * The depth is at most MAX_DEPTH (for up to 2^MAX_DEPTH primitives)
+ */
+inline void Build(const std::vector<AABB>& _bounds, BVH& _bvh, uint32_t _maxLeafSize = 4, uint32_t _packSize = 1)
+{
+    _bvh.nodes.clear();
+    _bvh.primIndices.resize(_bounds.size());
+    for (uint32_t i = 0; i < _bounds.size(); i++)
+        _bvh.primIndices[i] = i;
+
+    // worst case: one leaf per primitive
+    _bvh.nodes.reserve(std::max<size_t>(1, 2 * _bounds.size()));
+    _bvh.nodes.push_back(Node());
+    _bvh.nodes[0].leftFirst = 0;
+    _bvh.nodes[0].count = (uint32_t)_bounds.size();
+
+    // nodes to subdivide, with their depth
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 0 } };
+    while (!stack.empty())
+    {
+        uint32_t nodeId = stack.back().first;
+        uint32_t depth = stack.back().second;
+        stack.pop_back();
+
+        uint32_t first = _bvh.nodes[nodeId].leftFirst;
+        uint32_t count = _bvh.nodes[nodeId].count;
+
+        AABB nodeBounds;
+        for (uint32_t i = first; i < first + count; i++)
+            nodeBounds.grow(_bounds[_bvh.primIndices[i]]);
+        detail::setBounds(_bvh.nodes[nodeId], nodeBounds);
+
+        if (count <= std::max(_packSize, 1u))
+            continue;
+
+        int axis = 0;
+        uint32_t leftCount = 0;
+        auto begin = _bvh.primIndices.begin() + first;
+
+        // a SAH split may leave count - 1 primitives in a child: it is only allowed
+        // if median splits below that child still end at MAX_DEPTH or above
+        if (depth + 1 + detail::ceilLog2(count) <= MAX_DEPTH)
+        {
+            float splitPos = 0.0f;
+            float splitCost = detail::findBestSplit(_bounds, _bvh.primIndices, first, count, axis, splitPos);
+
+            // cost of the leaf, relative to traversal cost: intersecting a primitive is assumed
+            // to be as expensive as visiting a node
+            float leafCost = count * nodeBounds.halfArea();
+            if (splitCost == INFINITY || (count <= _maxLeafSize && splitCost >= leafCost))
+                continue;
+
+            // partition primitives against the split plane
+            auto middle = std::partition(begin, begin + count, [&](uint32_t id)
+                                         { return _bounds[id].centroid(axis) < splitPos; });
+            leftCount = (uint32_t)(middle - begin);
+        }
+        else
+        {
+            // no depth left for the SAH: median split along the longest axis
+            if (count <= _maxLeafSize)
+                continue;
+            for (int a = 1; a < 3; a++)
+                if (nodeBounds.max[a] - nodeBounds.min[a] > nodeBounds.max[axis] - nodeBounds.min[axis])
+                    axis = a;
+        }
+
+        // rounding may put all centroids on one side (or the depth is bounded): median split
+        if (leftCount == 0 || leftCount == count)
+        {
+            leftCount = count / 2;
+            std::nth_element(begin, begin + leftCount, begin + count, [&](uint32_t a, uint32_t b)
+                             { return _bounds[a].centroid(axis) < _bounds[b].centroid(axis); });
+        }
+
+        // create children, stored next to each other
+        uint32_t leftId = (uint32_t)_bvh.nodes.size();
+        _bvh.nodes.push_back(Node());
+        _bvh.nodes.push_back(Node());
+        _bvh.nodes[leftId].leftFirst = first;
+        _bvh.nodes[leftId].count = leftCount;
+        _bvh.nodes[leftId + 1].leftFirst = first + leftCount;
+        _bvh.nodes[leftId + 1].count = count - leftCount;
+
+        _bvh.nodes[nodeId].leftFirst = leftId;
+        _bvh.nodes[nodeId].count = 0;
+
+        stack.push_back({ leftId + 1, depth + 1 });
+        stack.push_back({ leftId, depth + 1 });
+    }
+}
+
+
+/*
+ * Reorder a primitive array in leaf order, so each leaf references a contiguous range;
+ * primIndices then becomes the identity
+ */
+template<typename T>
+void ReorderPrimitives(std::vector<T>& _primitives, BVH& _bvh)
+{
+    std::vector<T> ordered;
+    ordered.reserve(_primitives.size());
+    for (uint32_t id : _bvh.primIndices)
+        ordered.push_back(_primitives[id]);
+    _primitives = std::move(ordered);
+
+    for (uint32_t i = 0; i < _bvh.primIndices.size(); i++)
+        _bvh.primIndices[i] = i;
+}
+
+
+/*
+ * Slab test between a ray and the box of a node
+ * returns the entry distance, or INFINITY if the box is missed or further than _tMax
+ */
+template<typename Real>
+inline Real IntersectNode(const Node& _node, const Real _org[3], const Real _invDir[3], Real _tMax)
+{
+    Real tNear = 0.0, tFar = _tMax;
+    for (int a = 0; a < 3; a++)
+    {
+        Real t0 = ((Real)_node.bboxMin[a] - _org[a]) * _invDir[a];
+        Real t1 = ((Real)_node.bboxMax[a] - _org[a]) * _invDir[a];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        // written so that NaNs (0 * inf) leave the interval unchanged
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+    }
+    return tNear <= tFar ? tNear : (Real)INFINITY;
+}
+
+} //namespace bvh
+
+#endif // BVH_H
@@ -0,0 +1,763 @@
+/******************************************************************
+*
+* distributed.h
+*
+* Distributed rendering over TCP: a coordinator hands out the
+* tiles of the image to worker processes (on any machine, started
+* with the same scene and parameters), which render them with all
+* their threads and send back their float pixels.
+* The samples use the deterministic RNG of the path tracer, so the
+* image does not depend on which worker rendered a tile: the tiles
+* of a lost worker (disconnected, or not answering before the end
+* of its lease) are handed out again, and duplicate results are
+* ignored. Workers reconnect and send their pending results when
+* the connection is lost.
+* Messages: header (type, payload size), then the payload; native
+* byte order (little endian on all the supported platforms).
+*
+*******************************************************************/
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+#include "utils.h"
+#include "tiles.h"
+
+namespace distributed
+{
+
+using pathTracing::Color;
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+const SocketHandle INVALID_HANDLE = INVALID_SOCKET;
+inline void CloseSocket(SocketHandle _socket) { closesocket(_socket); }
+inline int Poll(pollfd* _fds, size_t _nb, int _timeoutMs) { return WSAPoll(_fds, (ULONG)_nb, _timeoutMs); }
+#else
+typedef int SocketHandle;
+const SocketHandle INVALID_HANDLE = -1;
+inline void CloseSocket(SocketHandle _socket) { close(_socket); }
+inline int Poll(pollfd* _fds, size_t _nb, int _timeoutMs) { return poll(_fds, (nfds_t)_nb, _timeoutMs); }
+#endif
+
+
+/*
+ * Socket library initialization, once per process
+ * (writing to a closed connection returns an error instead of raising SIGPIPE)
+ */
+inline bool InitNetwork()
+{
+#ifdef _WIN32
+    static const bool isInit = [] { WSADATA data; return WSAStartup(MAKEWORD(2, 2), &data) == 0; }();
+    if (!isInit)
+        std::cerr << "[ERROR] distributed::InitNetwork(): cannot initialize Winsock" << std::endl;
+    return isInit;
+#else
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+
+/*
+ * Protocol
+ * worker -> coordinator: HELLO, then REQUEST (preceded by the RESULT of the previous tile, if any)
+ * coordinator -> worker: WELCOME or REJECT (other scene or parameters), then one TILE, WAIT
+ * (no tile available yet, ask again later) or DONE per REQUEST; DONE is also sent to all
+ * the workers once the image is complete
+ */
+enum MessageType : uint32_t { MSG_HELLO = 1, MSG_WELCOME, MSG_REJECT, MSG_REQUEST, MSG_TILE, MSG_WAIT, MSG_RESULT, MSG_DONE };
+
+const uint32_t PROTOCOL_MAGIC = 0x44505452;     // "RTPD"
+const uint32_t PROTOCOL_VERSION = 1;
+const uint32_t MAX_MESSAGE_SIZE = 1u << 28;     // larger messages close the connection
+
+struct MessageHeader
+{
+    uint32_t type;          // MessageType
+    uint32_t size;          // payload size in bytes
+};
+
+struct HelloMessage
+{
+    uint32_t magic;         // PROTOCOL_MAGIC
+    uint32_t version;       // PROTOCOL_VERSION
+    uint64_t jobKey;        // hash of the scene and of the parameters of the image
+    uint32_t nbThreads;     // rendering threads of the worker (for the log)
+    uint32_t pad;
+};
+
+struct TileMessage
+{
+    uint32_t tileId;        // index of the tile in the list of the coordinator
+    int32_t x0, y0, x1, y1;
+};
+
+struct ResultHeader
+{
+    uint32_t tileId;
+    uint32_t pad;
+    uint64_t nbRays;        // statistics of the tile (cf. RayStats)
+    uint64_t nbPixelSamples;
+    // followed by 3 floats (RGB) per pixel of the tile, row by row
+};
+
+static_assert(sizeof(MessageHeader) == 8 && sizeof(HelloMessage) == 24 && sizeof(TileMessage) == 20 && sizeof(ResultHeader) == 24,
+              "messages must be packed");
+
+
+/*
+ * Tile rendered by a worker, sent with its next request
+ */
+struct TileResult
+{
+    int64_t tileId = -1;            // -1 if no tile is pending
+    uint64_t nbRays = 0;
+    uint64_t nbPixelSamples = 0;
+    std::vector<float> rgb;
+
+    void Set(const std::vector<Color>& _tileBuffer, size_t _nbPixels, uint64_t _nbRays, uint64_t _nbPixelSamples)
+    {
+        rgb.resize(_nbPixels * 3);
+        for (size_t i = 0; i < _nbPixels; i++)
+        {
+            rgb[i * 3] = (float)_tileBuffer[i].x;
+            rgb[i * 3 + 1] = (float)_tileBuffer[i].y;
+            rgb[i * 3 + 2] = (float)_tileBuffer[i].z;
+        }
+        nbRays = _nbRays;
+        nbPixelSamples = _nbPixelSamples;
+    }
+
+    Color GetColor(size_t _pixel) const
+    {
+        return Color(rgb[_pixel * 3], rgb[_pixel * 3 + 1], rgb[_pixel * 3 + 2]);
+    }
+};
+
+
+namespace detail
+{
+
+inline bool SendAll(SocketHandle _socket, const void* _data, size_t _size)
+{
+    const char* data = (const char*)_data;
+    while (_size > 0)
+    {
+        int n = (int)send(_socket, data, (int)std::min(_size, (size_t)1 << 20), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        _size -= (size_t)n;
+    }
+    return true;
+}
+
+inline bool RecvAll(SocketHandle _socket, void* _data, size_t _size)
+{
+    char* data = (char*)_data;
+    while (_size > 0)
+    {
+        int n = (int)recv(_socket, data, (int)std::min(_size, (size_t)1 << 20), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        _size -= (size_t)n;
+    }
+    return true;
+}
+
+/*
+ * Message in one buffered send: header, then the two (optional) parts of the payload
+ */
+inline bool SendMessage(SocketHandle _socket, uint32_t _type, const void* _payload = nullptr, size_t _size = 0,
+                        const void* _payload2 = nullptr, size_t _size2 = 0)
+{
+    MessageHeader header = { _type, (uint32_t)(_size + _size2) };
+    std::vector<char> buffer(sizeof(MessageHeader) + _size + _size2);
+    memcpy(buffer.data(), &header, sizeof(MessageHeader));
+    if (_size > 0)
+        memcpy(buffer.data() + sizeof(MessageHeader), _payload, _size);
+    if (_size2 > 0)
+        memcpy(buffer.data() + sizeof(MessageHeader) + _size, _payload2, _size2);
+    return SendAll(_socket, buffer.data(), buffer.size());
+}
+
+/*
+ * Blocking read of a whole message
+ */
+inline bool RecvMessage(SocketHandle _socket, uint32_t& _type, std::vector<char>& _payload)
+{
+    MessageHeader header;
+    if (!RecvAll(_socket, &header, sizeof(MessageHeader)) || header.size > MAX_MESSAGE_SIZE)
+        return false;
+    _type = header.type;
+    _payload.resize(header.size);
+    return RecvAll(_socket, _payload.data(), _payload.size());
+}
+
+inline void SetNoDelay(SocketHandle _socket)
+{
+    int flag = 1;
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+}
+
+/*
+ * Connect to "host:port", INVALID_HANDLE on failure
+ */
+inline SocketHandle Connect(const std::string& _address)
+{
+    size_t colon = _address.find_last_of(':');
+    if (colon == std::string::npos)
+        return INVALID_HANDLE;
+    std::string host = _address.substr(0, colon);
+    std::string port = _address.substr(colon + 1);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+        return INVALID_HANDLE;
+
+    SocketHandle handle = INVALID_HANDLE;
+    for (addrinfo* a = addresses; a && handle == INVALID_HANDLE; a = a->ai_next)
+    {
+        handle = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (handle != INVALID_HANDLE && connect(handle, a->ai_addr, (int)a->ai_addrlen) != 0)
+        {
+            CloseSocket(handle);
+            handle = INVALID_HANDLE;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (handle != INVALID_HANDLE)
+        SetNoDelay(handle);
+    return handle;
+}
+
+inline std::string PeerName(const sockaddr_in& _address)
+{
+    char host[64] = "?";
+    inet_ntop(AF_INET, &_address.sin_addr, host, sizeof(host));
+    return std::string(host) + ":" + std::to_string(ntohs(_address.sin_port));
+}
+
+} //namespace detail
+
+
+/*
+ * Hands out the tiles to the workers and collects their results (single thread, poll() loop)
+ */
+class Coordinator
+{
+public:
+    /*
+     * tiles: tiles of the image, handed out in this order
+     * jobKey: hash of the scene and parameters, workers with another key are rejected
+     * leaseSeconds: tiles not returned after this time are handed out again
+     */
+    Coordinator(const std::vector<tiles::Tile>& _tiles, uint64_t _jobKey, double _leaseSeconds)
+        : imageTiles(_tiles), status(_tiles.size(), TILE_PENDING), owners(_tiles.size(), 0), leaseStarts(_tiles.size()),
+          jobKey(_jobKey), leaseSeconds(_leaseSeconds), listener(INVALID_HANDLE), nextConnectionId(1), nbDone(0)
+    {
+        for (uint32_t i = 0; i < (uint32_t)_tiles.size(); i++)
+            pending.push_back(i);
+    }
+
+    ~Coordinator()
+    {
+        for (Connection& c : connections)
+            CloseSocket(c.socket);
+        if (listener != INVALID_HANDLE)
+            CloseSocket(listener);
+    }
+
+    Coordinator(const Coordinator&) = delete;
+    Coordinator& operator=(const Coordinator&) = delete;
+
+    /*
+     * Accept the workers on a TCP port (all the interfaces)
+     */
+    bool Listen(int _port)
+    {
+        if (!InitNetwork())
+            return false;
+
+        listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int flag = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&flag, sizeof(flag));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons((uint16_t)_port);
+        if (listener == INVALID_HANDLE || bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+        {
+            std::cerr << "[ERROR] distributed::Coordinator::Listen(): cannot listen on port " << _port << std::endl;
+            return false;
+        }
+        std::cout << "Waiting for workers on port " << _port << " (" << imageTiles.size() << " tiles)" << std::endl;
+        return true;
+    }
+
+    /*
+     * Serve the tiles until all of them are rendered
+     * onTile: called with the first result received for each tile
+     * rays, pixelSamples: sums of the statistics of the results
+     */
+    void Run(const std::function<void(const tiles::Tile&, const TileResult&)>& _onTile, uint64_t& _rays, uint64_t& _pixelSamples)
+    {
+        _rays = 0;
+        _pixelSamples = 0;
+        int lastDecile = 0;
+        std::vector<pollfd> fds;
+
+        while (nbDone < imageTiles.size())
+        {
+            fds.assign(1, pollfd{ listener, POLLIN, 0 });
+            for (const Connection& c : connections)
+                fds.push_back(pollfd{ c.socket, POLLIN, 0 });
+            Poll(fds.data(), fds.size(), 1000);
+
+            if (fds[0].revents & POLLIN)
+                Accept();
+
+            for (size_t i = 0; i < connections.size(); i++)
+            {
+                // connections accepted during this iteration are polled at the next one
+                if (i + 1 >= fds.size() || !(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+                if (!Receive(connections[i], _onTile, _rays, _pixelSamples))
+                    Drop(connections[i]);
+            }
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                             [](const Connection& c) { return c.socket == INVALID_HANDLE; }),
+                              connections.end());
+
+            ExpireLeases();
+
+            int decile = (int)(nbDone * 10 / imageTiles.size());
+            if (decile > lastDecile)
+            {
+                lastDecile = decile;
+                std::cout << nbDone << " / " << imageTiles.size() << " tiles (" << decile * 10 << "%), "
+                          << connections.size() << " workers" << std::endl;
+            }
+        }
+
+        // the workers exit, or wait for the next image
+        for (Connection& c : connections)
+        {
+            detail::SendMessage(c.socket, MSG_DONE);
+            CloseSocket(c.socket);
+        }
+        connections.clear();
+    }
+
+private:
+    enum TileStatus { TILE_PENDING, TILE_LEASED, TILE_DONE };
+
+    struct Connection
+    {
+        SocketHandle socket;
+        uint64_t id;                // owner of the leased tiles
+        std::string name;           // address of the worker
+        bool isAccepted;            // valid HELLO received
+        std::vector<char> input;    // received bytes, not yet a whole message
+    };
+
+    std::vector<tiles::Tile> imageTiles;
+    std::vector<TileStatus> status;
+    std::vector<uint64_t> owners;                                   // connection of the leased tiles
+    std::vector<std::chrono::steady_clock::time_point> leaseStarts;
+    std::deque<uint32_t> pending;                                   // tiles to hand out (may contain tiles done in the meantime)
+
+    uint64_t jobKey;
+    double leaseSeconds;
+    SocketHandle listener;
+    std::vector<Connection> connections;
+    uint64_t nextConnectionId;
+    size_t nbDone;
+
+    void Accept()
+    {
+        sockaddr_in address = {};
+        socklen_t addressSize = sizeof(address);
+        SocketHandle handle = accept(listener, (sockaddr*)&address, &addressSize);
+        if (handle == INVALID_HANDLE)
+            return;
+        detail::SetNoDelay(handle);
+        connections.push_back(Connection{ handle, nextConnectionId++, detail::PeerName(address), false, {} });
+    }
+
+    /*
+     * Read the available bytes of a connection and process its whole messages
+     * returns false if the connection is closed or breaks the protocol
+     */
+    bool Receive(Connection& _c, const std::function<void(const tiles::Tile&, const TileResult&)>& _onTile,
+                 uint64_t& _rays, uint64_t& _pixelSamples)
+    {
+        char buffer[1 << 16];
+        int n = (int)recv(_c.socket, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return false;
+        _c.input.insert(_c.input.end(), buffer, buffer + n);
+
+        size_t offset = 0;
+        while (_c.input.size() - offset >= sizeof(MessageHeader))
+        {
+            MessageHeader header;
+            memcpy(&header, _c.input.data() + offset, sizeof(MessageHeader));
+            if (header.size > MAX_MESSAGE_SIZE)
+                return false;
+            if (_c.input.size() - offset < sizeof(MessageHeader) + header.size)
+                break;
+            const char* payload = _c.input.data() + offset + sizeof(MessageHeader);
+            offset += sizeof(MessageHeader) + header.size;
+
+            if (!Process(_c, header, payload, _onTile, _rays, _pixelSamples))
+                return false;
+        }
+        _c.input.erase(_c.input.begin(), _c.input.begin() + offset);
+        return true;
+    }
+
+    bool Process(Connection& _c, const MessageHeader& _header, const char* _payload,
+                 const std::function<void(const tiles::Tile&, const TileResult&)>& _onTile, uint64_t& _rays, uint64_t& _pixelSamples)
+    {
+        if (_header.type == MSG_HELLO && !_c.isAccepted)
+        {
+            HelloMessage hello = {};
+            if (_header.size == sizeof(HelloMessage))
+                memcpy(&hello, _payload, sizeof(HelloMessage));
+            if (hello.magic != PROTOCOL_MAGIC || hello.version != PROTOCOL_VERSION || hello.jobKey != jobKey)
+            {
+                std::cerr << "[WARNING] distributed::Coordinator: rejected worker " << _c.name
+                          << " (other protocol, scene or parameters)" << std::endl;
+                detail::SendMessage(_c.socket, MSG_REJECT);
+                return false;
+            }
+            _c.isAccepted = true;
+            std::cout << "Worker " << _c.name << " connected (" << hello.nbThreads << " threads)" << std::endl;
+            return detail::SendMessage(_c.socket, MSG_WELCOME);
+        }
+        if (!_c.isAccepted)
+            return false;
+
+        if (_header.type == MSG_RESULT)
+        {
+            ResultHeader result;
+            if (_header.size < sizeof(ResultHeader))
+                return false;
+            memcpy(&result, _payload, sizeof(ResultHeader));
+            if (result.tileId >= imageTiles.size())
+                return false;
+            const tiles::Tile& tile = imageTiles[result.tileId];
+            const size_t nbFloats = (size_t)tile.width() * tile.height() * 3;
+            if (_header.size != sizeof(ResultHeader) + nbFloats * sizeof(float))
+                return false;
+
+            // first result of the tile (all the results of a tile are identical)
+            if (status[result.tileId] != TILE_DONE)
+            {
+                TileResult tileResult;
+                tileResult.tileId = result.tileId;
+                tileResult.nbRays = result.nbRays;
+                tileResult.nbPixelSamples = result.nbPixelSamples;
+                tileResult.rgb.resize(nbFloats);
+                memcpy(tileResult.rgb.data(), _payload + sizeof(ResultHeader), nbFloats * sizeof(float));
+                _onTile(tile, tileResult);
+
+                status[result.tileId] = TILE_DONE;
+                nbDone++;
+                _rays += result.nbRays;
+                _pixelSamples += result.nbPixelSamples;
+            }
+            return true;
+        }
+
+        if (_header.type == MSG_REQUEST)
+        {
+            while (!pending.empty() && status[pending.front()] != TILE_PENDING)
+                pending.pop_front();
+            if (pending.empty())
+                return detail::SendMessage(_c.socket, nbDone == imageTiles.size() ? MSG_DONE : MSG_WAIT);
+
+            uint32_t tileId = pending.front();
+            pending.pop_front();
+            status[tileId] = TILE_LEASED;
+            owners[tileId] = _c.id;
+            leaseStarts[tileId] = std::chrono::steady_clock::now();
+
+            const tiles::Tile& tile = imageTiles[tileId];
+            TileMessage message = { tileId, tile.x0, tile.y0, tile.x1, tile.y1 };
+            return detail::SendMessage(_c.socket, MSG_TILE, &message, sizeof(message));
+        }
+        return false;
+    }
+
+    /*
+     * Close a connection, its leased tiles are handed out first to the next requests
+     */
+    void Drop(Connection& _c)
+    {
+        if (_c.isAccepted)
+            std::cerr << "[WARNING] distributed::Coordinator: lost worker " << _c.name << std::endl;
+        for (uint32_t i = 0; i < (uint32_t)imageTiles.size(); i++)
+        {
+            if (status[i] == TILE_LEASED && owners[i] == _c.id)
+            {
+                status[i] = TILE_PENDING;
+                pending.push_front(i);
+            }
+        }
+        CloseSocket(_c.socket);
+        _c.socket = INVALID_HANDLE;
+    }
+
+    /*
+     * Hand out again the tiles leased for too long (stalled or very slow workers),
+     * the first result received is kept
+     */
+    void ExpireLeases()
+    {
+        auto now = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < (uint32_t)imageTiles.size(); i++)
+        {
+            if (status[i] == TILE_LEASED && std::chrono::duration<double>(now - leaseStarts[i]).count() > leaseSeconds)
+            {
+                std::cerr << "[WARNING] distributed::Coordinator: lease of tile " << i << " expired, handing it out again" << std::endl;
+                status[i] = TILE_PENDING;
+                pending.push_front(i);
+            }
+        }
+    }
+};
+
+
+/*
+ * Connection of a worker to the coordinator, shared by the rendering threads
+ */
+class Worker
+{
+public:
+    /*
+     * address: "host:port" of the coordinator
+     * jobKey: hash of the scene and parameters (cf. Coordinator)
+     * retrySeconds: time to wait for the coordinator (at start, or to reconnect) before giving up
+     */
+    Worker(const std::string& _address, uint64_t _jobKey, int _nbThreads, double _retrySeconds)
+        : address(_address), jobKey(_jobKey), nbThreads(_nbThreads), retrySeconds(_retrySeconds),
+          connection(INVALID_HANDLE), isFinished(false), isComplete(false), nbTiles(0)
+    {}
+
+    ~Worker()
+    {
+        if (connection != INVALID_HANDLE)
+            CloseSocket(connection);
+    }
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    // the coordinator sent DONE (false if rejected or unreachable)
+    bool IsComplete() const { return isComplete; }
+    uint64_t GetNbTiles() const { return nbTiles; }
+
+    /*
+     * Send the result of the previous tile of the calling thread (if result.tileId >= 0),
+     * then get a new tile (thread safe)
+     * returns false once the image is complete, or if the coordinator is lost
+     */
+    bool Next(TileResult& _result, tiles::Tile& _tile)
+    {
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (isFinished)
+                    return false;
+                if (connection == INVALID_HANDLE && !Connect())
+                {
+                    isFinished = true;
+                    return false;
+                }
+
+                if (IsDone())
+                    return false;
+
+                uint32_t type = 0;
+                std::vector<char> payload;
+                if (SendResult(_result) && detail::SendMessage(connection, MSG_REQUEST) && detail::RecvMessage(connection, type, payload))
+                {
+                    // result received by the coordinator
+                    if (_result.tileId >= 0)
+                        nbTiles++;
+                    _result.tileId = -1;
+
+                    if (type == MSG_TILE && payload.size() == sizeof(TileMessage))
+                    {
+                        TileMessage message;
+                        memcpy(&message, payload.data(), sizeof(TileMessage));
+                        _tile = tiles::Tile{ message.x0, message.y0, message.x1, message.y1 };
+                        _result.tileId = message.tileId;
+                        return true;
+                    }
+                    if (type == MSG_DONE)
+                    {
+                        isFinished = true;
+                        isComplete = true;
+                        return false;
+                    }
+                    if (type != MSG_WAIT)
+                        Disconnect();
+                }
+                else
+                {
+                    // the pending result is sent again after reconnection
+                    std::cerr << "[WARNING] distributed::Worker::Next(): connection to " << address << " lost" << std::endl;
+                    Disconnect();
+                    continue;
+                }
+            }
+            // other tiles are leased to other workers, some may be handed out again
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+
+private:
+    std::string address;
+    uint64_t jobKey;
+    int nbThreads;
+    double retrySeconds;
+
+    std::mutex mutex;
+    SocketHandle connection;
+    bool isFinished;
+    bool isComplete;
+    uint64_t nbTiles;
+
+    /*
+     * Connect and say hello, retrying every second for retrySeconds
+     */
+    bool Connect()
+    {
+        if (!InitNetwork())
+            return false;
+
+        auto start = std::chrono::steady_clock::now();
+        while (true)
+        {
+            connection = detail::Connect(address);
+            if (connection != INVALID_HANDLE)
+            {
+                HelloMessage hello = { PROTOCOL_MAGIC, PROTOCOL_VERSION, jobKey, (uint32_t)nbThreads, 0 };
+                uint32_t type = 0;
+                std::vector<char> payload;
+                if (detail::SendMessage(connection, MSG_HELLO, &hello, sizeof(hello)) && detail::RecvMessage(connection, type, payload))
+                {
+                    if (type == MSG_WELCOME)
+                    {
+                        std::cout << "Connected to " << address << std::endl;
+                        return true;
+                    }
+                    if (type == MSG_REJECT)
+                    {
+                        std::cerr << "[ERROR] distributed::Worker::Connect(): rejected by " << address
+                                  << ", scene and parameters must be the same as on the coordinator" << std::endl;
+                        Disconnect();
+                        return false;
+                    }
+                    if (type == MSG_DONE)
+                    {
+                        isComplete = true;
+                        Disconnect();
+                        return false;
+                    }
+                }
+                Disconnect();
+            }
+
+            if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > retrySeconds)
+            {
+                std::cerr << "[ERROR] distributed::Worker::Connect(): cannot reach " << address << std::endl;
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+
+    void Disconnect()
+    {
+        if (connection != INVALID_HANDLE)
+            CloseSocket(connection);
+        connection = INVALID_HANDLE;
+    }
+
+    /*
+     * Check for the DONE sent by the coordinator when the image is complete
+     * (between two requests, nothing else can be received)
+     */
+    bool IsDone()
+    {
+        pollfd fd = { connection, POLLIN, 0 };
+        if (Poll(&fd, 1, 0) <= 0)
+            return false;
+
+        uint32_t type = 0;
+        std::vector<char> payload;
+        if (detail::RecvMessage(connection, type, payload) && type == MSG_DONE)
+        {
+            isFinished = true;
+            isComplete = true;
+            return true;
+        }
+        // closed connection: the next request fails and reconnects
+        return false;
+    }
+
+    bool SendResult(const TileResult& _result)
+    {
+        if (_result.tileId < 0)
+            return true;
+        ResultHeader header = { (uint32_t)_result.tileId, 0, _result.nbRays, _result.nbPixelSamples };
+        return detail::SendMessage(connection, MSG_RESULT, &header, sizeof(header),
+                                   _result.rgb.data(), _result.rgb.size() * sizeof(float));
+    }
+};
+
+} //namespace distributed
+
+#endif // DISTRIBUTED_H
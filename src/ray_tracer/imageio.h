@@ -0,0 +1,396 @@
+/******************************************************************
+*
+* imageio.h
+*
+* Binary image output of the path tracer: 8 bit P6 PPM, 16 bit
+* PNG (when lodepng is available) and float PFM for HDR.
+* Gamma correction goes through a precomputed table and each
+* file is written in one buffered write; TileWriter streams the
+* finished tiles of a render to a PPM or PFM file.
+*
+*******************************************************************/
+
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <iostream>
+
+#ifdef RAY_TRACER_USE_LODEPNG
+#include <lodepng.h>
+#endif
+
+#include "utils.h"
+#include "tiles.h"
+
+namespace imageio
+{
+
+using pathTracing::Color;
+using pathTracing::ImageBuffer;
+
+/*
+ * Gamma correction (1/2.2) of linear values in [0,1]:
+ * table indexed by the float representation of the value (exponent and
+ * top mantissa bits, i.e. log-spaced samples), linearly interpolated,
+ * accurate enough for 16 bit output down to the darkest values
+ */
+class GammaLUT
+{
+public:
+    GammaLUT()
+    {
+        table.resize((NB_EXPONENTS << MANTISSA_BITS) + 1);
+        for (uint32_t i = 0; i < table.size(); i++)
+            table[i] = (float)pow((double)FromBits(MinBits() + (i << SHIFT)), 1 / 2.2);
+    }
+
+    /* gamma corrected value in [0,1] (input clamped to [0,1]) */
+    float Encode(float _x) const
+    {
+        if (!(_x > MinValue()))    // also catches NaN
+            return 0.0f;
+        if (_x >= 1.0f)
+            return 1.0f;
+
+        uint32_t offset = ToBits(_x) - MinBits();
+        uint32_t i = offset >> SHIFT;
+        float frac = (float)(offset & ((1u << SHIFT) - 1)) * (1.0f / (float)(1u << SHIFT));
+        return table[i] + (table[i + 1] - table[i]) * frac;
+    }
+
+    /* gamma corrected value quantized to [0, _maxValue] (e.g. 255 or 65535) */
+    uint32_t ToInteger(double _x, uint32_t _maxValue) const
+    {
+        return (uint32_t)(Encode((float)_x) * (float)_maxValue + 0.5f);
+    }
+
+private:
+    // values below 2^-NB_EXPONENTS are encoded to 0 (less than half a 16 bit step)
+    static const uint32_t NB_EXPONENTS = 40;
+    static const uint32_t MANTISSA_BITS = 8;
+    static const uint32_t SHIFT = 23 - MANTISSA_BITS;
+
+    std::vector<float> table;
+
+    static uint32_t ToBits(float _x) { uint32_t b; std::memcpy(&b, &_x, sizeof(b)); return b; }
+    static float FromBits(uint32_t _b) { float x; std::memcpy(&x, &_b, sizeof(x)); return x; }
+    static uint32_t MinBits() { return (127u - NB_EXPONENTS) << 23; }
+    static float MinValue() { return FromBits(MinBits()); }
+};
+
+/* shared table, built on first use */
+inline const GammaLUT& Gamma()
+{
+    static const GammaLUT lut;
+    return lut;
+}
+
+
+/*
+ * Pixels of image row r (top row first), in the order of Image::pixels
+ */
+template<typename Pixel>
+const Pixel* Row(const ImageBuffer<Pixel>& _img, int _r)
+{
+    return _img.pixels.data() + (size_t)_r * _img.width;
+}
+
+inline std::string PPMHeader(int _width, int _height)
+{
+    return "P6\n" + std::to_string(_width) + " " + std::to_string(_height) + "\n255\n";
+}
+
+/* little endian PFM (negative scale), rows are stored bottom to top */
+inline std::string PFMHeader(int _width, int _height)
+{
+    return "PF\n" + std::to_string(_width) + " " + std::to_string(_height) + "\n-1.0\n";
+}
+
+/* _src: colors or image pixels (converted to Color) */
+template<typename T>
+void ToRGB8(const T* _src, int _n, unsigned char* _dst)
+{
+    const GammaLUT& gamma = Gamma();
+    for (int i = 0; i < _n; i++)
+    {
+        const Color c = _src[i];
+        _dst[3 * i + 0] = (unsigned char)gamma.ToInteger(c.x, 255);
+        _dst[3 * i + 1] = (unsigned char)gamma.ToInteger(c.y, 255);
+        _dst[3 * i + 2] = (unsigned char)gamma.ToInteger(c.z, 255);
+    }
+}
+
+/* linear values, no clamping (HDR, cf. pathTracing::hdrOutput) */
+template<typename T>
+void ToRGBF(const T* _src, int _n, float* _dst)
+{
+    for (int i = 0; i < _n; i++)
+    {
+        const Color c = _src[i];
+        _dst[3 * i + 0] = (float)c.x;
+        _dst[3 * i + 1] = (float)c.y;
+        _dst[3 * i + 2] = (float)c.z;
+    }
+}
+
+
+/*
+ * Write header and data in a single write
+ */
+inline bool WriteFile(const std::string& _filename, const std::string& _header, const std::vector<unsigned char>& _data)
+{
+    FILE* f = fopen(_filename.c_str(), "wb");
+    if (!f)
+    {
+        std::cerr << "[ERROR] imageio::WriteFile(): cannot open " << _filename << std::endl;
+        return false;
+    }
+    bool ok = fwrite(_header.data(), 1, _header.size(), f) == _header.size()
+           && fwrite(_data.data(), 1, _data.size(), f) == _data.size();
+    fclose(f);
+
+    if (!ok)
+        std::cerr << "[ERROR] imageio::WriteFile(): cannot write " << _filename << std::endl;
+    return ok;
+}
+
+
+/*
+ * Save image in binary PPM format (8 bit, gamma corrected)
+ */
+template<typename Pixel>
+bool SavePPM(const ImageBuffer<Pixel>& _img, const std::string& _filename)
+{
+    std::vector<unsigned char> data((size_t)_img.width * _img.height * 3);
+    for (int r = 0; r < _img.height; r++)
+        ToRGB8(Row(_img, r), _img.width, &data[(size_t)r * _img.width * 3]);
+
+    return WriteFile(_filename, PPMHeader(_img.width, _img.height), data);
+}
+
+
+/*
+ * Save image in PFM format (32 bit float per channel, linear)
+ */
+template<typename Pixel>
+bool SavePFM(const ImageBuffer<Pixel>& _img, const std::string& _filename)
+{
+    std::vector<unsigned char> data((size_t)_img.width * _img.height * 3 * sizeof(float));
+    for (int r = 0; r < _img.height; r++)
+        ToRGBF(Row(_img, _img.height - 1 - r), _img.width, (float*)&data[(size_t)r * _img.width * 3 * sizeof(float)]);
+
+    return WriteFile(_filename, PFMHeader(_img.width, _img.height), data);
+}
+
+
+/*
+ * Save image in PNG format (16 bit per channel, gamma corrected)
+ */
+template<typename Pixel>
+bool SavePNG(const ImageBuffer<Pixel>& _img, const std::string& _filename)
+{
+#ifdef RAY_TRACER_USE_LODEPNG
+    // 16 bit PNG samples are big endian
+    const GammaLUT& gamma = Gamma();
+    std::vector<unsigned char> data((size_t)_img.width * _img.height * 6);
+    for (size_t i = 0; i < (size_t)_img.width * _img.height; i++)
+    {
+        const Color c = _img.pixels[i];
+        const double rgb[3] = { c.x, c.y, c.z };
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t v = gamma.ToInteger(rgb[c], 65535);
+            data[6 * i + 2 * c] = (unsigned char)(v >> 8);
+            data[6 * i + 2 * c + 1] = (unsigned char)(v & 0xFF);
+        }
+    }
+
+    unsigned error = lodepng::encode(_filename, data, _img.width, _img.height, LCT_RGB, 16);
+    if (error)
+    {
+        std::cerr << "[ERROR] imageio::SavePNG(): " << lodepng_error_text(error) << std::endl;
+        return false;
+    }
+    return true;
+#else
+    (void)_img;
+    std::cerr << "[ERROR] imageio::SavePNG(): built without lodepng, cannot write " << _filename << std::endl;
+    return false;
+#endif
+}
+
+
+/*
+ * Output format given by the file extension: .pfm keeps the linear values (HDR),
+ * .ppm and .png are clamped and gamma encoded
+ */
+inline std::string Extension(const std::string& _filename)
+{
+    return _filename.substr(_filename.find_last_of('.') + 1);
+}
+
+inline bool IsFloatFormat(const std::string& _filename)
+{
+    return Extension(_filename) == "pfm";
+}
+
+
+/*
+ * Save image, format given by the file extension (.ppm, .pfm or .png)
+ */
+template<typename Pixel>
+bool Save(const ImageBuffer<Pixel>& _img, const std::string& _filename)
+{
+    std::string ext = Extension(_filename);
+    if (ext == "pfm")
+        return SavePFM(_img, _filename);
+    if (ext == "png")
+        return SavePNG(_img, _filename);
+    if (ext != "ppm")
+        std::cerr << "[WARNING] imageio::Save(): unknown extension " << ext << ", saving as PPM" << std::endl;
+    return SavePPM(_img, _filename);
+}
+
+
+/*
+ * Streaming output: the file (PPM or PFM, fixed size pixel layout) is allocated
+ * when opened, then each tile is written at its place as soon as it is rendered,
+ * so the complete image never has to be kept or converted at once.
+ * WriteTile() can be called from several threads.
+ */
+class TileWriter
+{
+public:
+    TileWriter(const std::string& _filename, int _width, int _height)
+        : width(_width), height(_height), failed(false), filename(_filename), file(nullptr)
+    {
+        std::string ext = Extension(_filename);
+        isFloat = (ext == "pfm");
+        if (!isFloat && ext != "ppm")
+            std::cerr << "[WARNING] imageio::TileWriter(): streaming supports PPM and PFM only, writing PPM in " << _filename << std::endl;
+
+        std::string header = isFloat ? PFMHeader(width, height) : PPMHeader(width, height);
+        headerSize = header.size();
+
+        file = fopen(_filename.c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "[ERROR] imageio::TileWriter(): cannot open " << _filename << std::endl;
+            return;
+        }
+
+        // header, then extend the file to its final size (unwritten pixels read as black)
+        uint64_t dataSize = (uint64_t)width * height * PixelSize();
+        if (fwrite(header.data(), 1, header.size(), file) != header.size()
+            || (dataSize > 0 && (!Seek(headerSize + dataSize - 1) || fputc(0, file) == EOF)))
+            Fail();
+    }
+
+    ~TileWriter()
+    {
+        Close();
+    }
+
+    TileWriter(const TileWriter&) = delete;
+    TileWriter& operator=(const TileWriter&) = delete;
+
+    /* false once a write failed (or if the file could not be opened) */
+    bool good()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return file && !failed;
+    }
+
+    /*
+     * Flush and close the file, false if any write failed (or if it was not open)
+     */
+    bool Close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!file)
+            return false;
+        if (fclose(file) != 0)
+            Fail();
+        file = nullptr;
+        return !failed;
+    }
+
+    /*
+     * Write the pixels of _tile, _colors are stored row by row from _tile.y0 (as Render() tile buffers)
+     * Returns false if the tile could not be written (then good() is false too)
+     */
+    bool WriteTile(const tiles::Tile& _tile, const std::vector<Color>& _colors)
+    {
+        if (!file)
+            return false;
+
+        // convert outside of the lock
+        std::vector<unsigned char> data((size_t)_tile.width() * _tile.height() * PixelSize());
+        for (int y = _tile.y0; y < _tile.y1; y++)
+        {
+            const Color* src = &_colors[(size_t)(y - _tile.y0) * _tile.width()];
+            unsigned char* dst = &data[(size_t)(y - _tile.y0) * _tile.width() * PixelSize()];
+            if (isFloat)
+                ToRGBF(src, _tile.width(), (float*)dst);
+            else
+                ToRGB8(src, _tile.width(), dst);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!file || failed)
+            return false;
+        const size_t rowSize = (size_t)_tile.width() * PixelSize();
+        for (int y = _tile.y0; y < _tile.y1; y++)
+        {
+            // PPM rows are stored top to bottom (as Image::pixels), PFM rows bottom to top
+            uint64_t row = isFloat ? (uint64_t)y : (uint64_t)(height - 1 - y);
+            if (!Seek(headerSize + (row * width + _tile.x0) * PixelSize())
+                || fwrite(&data[(size_t)(y - _tile.y0) * rowSize], 1, rowSize, file) != rowSize)
+            {
+                Fail();
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    int width, height;
+    bool isFloat;
+    bool failed;
+    size_t headerSize;
+    std::string filename;
+    FILE* file;
+    std::mutex mutex;
+
+    size_t PixelSize() const { return isFloat ? 3 * sizeof(float) : 3; }
+
+    /* 64 bits offsets (long is 32 bits on Windows, images over 2 GB are common in PFM) */
+    bool Seek(uint64_t _offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(file, (__int64)_offset, SEEK_SET) == 0;
+#else
+        return fseeko(file, (off_t)_offset, SEEK_SET) == 0;
+#endif
+    }
+
+    /* first error only, the following writes are skipped */
+    void Fail()
+    {
+        if (!failed)
+            std::cerr << "[ERROR] imageio::TileWriter(): cannot write " << filename << std::endl;
+        failed = true;
+    }
+};
+
+} //namespace imageio
+
+#endif // IMAGEIO_H
@@ -0,0 +1,221 @@
+/******************************************************************
+*
+* packs.h
+*
+* Structure of Arrays packs of primitives, so that one ray is
+* tested against PACK_WIDTH spheres or triangles at once.
+* Lane loops are written for the compiler auto-vectorizer
+* (#pragma omp simd, no branch inside), the instruction set
+* (SSE, AVX2, AVX-512, NEON) follows the target architecture
+* (cf. RAY_TRACER_ARCH in CMakeLists.txt).
+*
+*******************************************************************/
+
+#ifndef PACKS_H
+#define PACKS_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+#include "bvh.h"
+
+namespace packs
+{
+
+// 8 lanes: one AVX-512 register in double precision, or one AVX2 register in single precision
+const uint32_t PACK_WIDTH = 8;
+
+
+/*
+ * Spheres, unused lanes have a negative squared radius (never hit)
+ */
+template<typename Real>
+struct alignas(64) SpherePack
+{
+    Real cx[PACK_WIDTH], cy[PACK_WIDTH], cz[PACK_WIDTH];
+    Real r2[PACK_WIDTH];
+
+    SpherePack()
+    {
+        for (uint32_t i = 0; i < PACK_WIDTH; i++)
+        {
+            cx[i] = cy[i] = cz[i] = 0;
+            r2[i] = -1;
+        }
+    }
+
+    void set(uint32_t _lane, double _cx, double _cy, double _cz, double _radius)
+    {
+        cx[_lane] = (Real)_cx;
+        cy[_lane] = (Real)_cy;
+        cz[_lane] = (Real)_cz;
+        r2[_lane] = (Real)(_radius * _radius);
+    }
+};
+
+
+/*
+ * Triangles (first vertex and edges), unused lanes have null edges (never hit)
+ */
+template<typename Real>
+struct alignas(64) TrianglePack
+{
+    Real p0x[PACK_WIDTH], p0y[PACK_WIDTH], p0z[PACK_WIDTH];
+    Real ax[PACK_WIDTH], ay[PACK_WIDTH], az[PACK_WIDTH];
+    Real bx[PACK_WIDTH], by[PACK_WIDTH], bz[PACK_WIDTH];
+
+    TrianglePack()
+    {
+        for (uint32_t i = 0; i < PACK_WIDTH; i++)
+            p0x[i] = p0y[i] = p0z[i] = ax[i] = ay[i] = az[i] = bx[i] = by[i] = bz[i] = 0;
+    }
+
+    void set(uint32_t _lane, const double _p0[3], const double _a[3], const double _b[3])
+    {
+        p0x[_lane] = (Real)_p0[0]; p0y[_lane] = (Real)_p0[1]; p0z[_lane] = (Real)_p0[2];
+        ax[_lane] = (Real)_a[0];   ay[_lane] = (Real)_a[1];   az[_lane] = (Real)_a[2];
+        bx[_lane] = (Real)_b[0];   by[_lane] = (Real)_b[1];   bz[_lane] = (Real)_b[2];
+    }
+};
+
+
+/*
+ * Packs of all the leaves of a BVH (primitives reordered by leaf, cf. bvh::ReorderPrimitives):
+ * a leaf of count primitives uses NbPacks(count) consecutive packs starting at firstPack[leaf node id],
+ * lane i of the k-th pack holds primitive leftFirst + k * PACK_WIDTH + i
+ */
+template<typename Pack>
+struct LeafPacks
+{
+    std::vector<Pack> packs;
+    std::vector<uint32_t> firstPack;    // indexed by node id (unused for interior nodes)
+};
+
+inline uint32_t NbPacks(uint32_t _count) { return (_count + PACK_WIDTH - 1) / PACK_WIDTH; }
+
+
+/*
+ * Fill the packs of a BVH, _setLane(pack, lane, primitiveId) copies one primitive in a lane
+ */
+template<typename Pack, typename SetLane>
+void BuildLeafPacks(const bvh::BVH& _bvh, LeafPacks<Pack>& _leafPacks, SetLane _setLane)
+{
+    _leafPacks.packs.clear();
+    _leafPacks.firstPack.assign(_bvh.nodes.size(), 0);
+
+    for (uint32_t n = 0; n < _bvh.nodes.size(); n++)
+    {
+        const bvh::Node& node = _bvh.nodes[n];
+        if (!node.isLeaf())
+            continue;
+
+        _leafPacks.firstPack[n] = (uint32_t)_leafPacks.packs.size();
+        for (uint32_t i = 0; i < node.count; i++)
+        {
+            if (i % PACK_WIDTH == 0)
+                _leafPacks.packs.push_back(Pack());
+            _setLane(_leafPacks.packs.back(), i % PACK_WIDTH, node.leftFirst + i);
+        }
+    }
+}
+
+
+/*
+ * Keep the closest lane distance below _t (horizontal reduction, lanes without hit are INFINITY)
+ * returns the lane index, or -1 if no lane is closer than _t
+ */
+template<typename Real>
+inline int ClosestLane(const Real _tLanes[PACK_WIDTH], Real& _t)
+{
+    int lane = -1;
+    for (uint32_t i = 0; i < PACK_WIDTH; i++)
+    {
+        if (_tLanes[i] < _t)
+        {
+            _t = _tLanes[i];
+            lane = (int)i;
+        }
+    }
+    return lane;
+}
+
+
+/*
+ * Ray against PACK_WIDTH spheres, same formulation as Sphere::Intersect()
+ * returns the lane of the closest hit in ]_eps, _t[ and updates _t, or -1 if none
+ */
+template<typename Real>
+inline int Intersect(const SpherePack<Real>& _pack, const Real _org[3], const Real _dir[3], Real _eps, Real& _t)
+{
+    alignas(64) Real tLanes[PACK_WIDTH];
+
+    #pragma omp simd aligned(tLanes : 64)
+    for (uint32_t i = 0; i < PACK_WIDTH; i++)
+    {
+        const Real ox = _pack.cx[i] - _org[0];
+        const Real oy = _pack.cy[i] - _org[1];
+        const Real oz = _pack.cz[i] - _org[2];
+        const Real b = ox * _dir[0] + oy * _dir[1] + oz * _dir[2];
+
+        // discriminant from the distance between the center and the ray (Hearn and Baker)
+        const Real lx = ox - b * _dir[0];
+        const Real ly = oy - b * _dir[1];
+        const Real lz = oz - b * _dir[2];
+        const Real discriminant = _pack.r2[i] - (lx * lx + ly * ly + lz * lz);
+        const Real root = std::sqrt(discriminant > 0 ? discriminant : (Real)0);
+
+        // roots q and c / q, smaller one first, then the other one if the origin is inside the sphere
+        const Real q = b + (b >= 0 ? root : -root);
+        const Real c = (ox * ox + oy * oy + oz * oz) - _pack.r2[i];
+        const Real t0 = c / (q != 0 ? q : (Real)1);
+        const Real tNear = t0 < q ? t0 : q;
+        const Real tFar = t0 < q ? q : t0;
+        const Real t = tNear > _eps ? tNear : (tFar > _eps ? tFar : (Real)INFINITY);
+        tLanes[i] = (discriminant < 0) | (q == 0) ? (Real)INFINITY : t;
+    }
+    return ClosestLane(tLanes, _t);
+}
+
+
+/*
+ * Ray against PACK_WIDTH triangles, same formulation as Triangle::Intersect() (Moller-Trumbore)
+ * returns the lane of the closest hit in ]_eps, _t[ and updates _t, or -1 if none
+ */
+template<typename Real>
+inline int Intersect(const TrianglePack<Real>& _pack, const Real _org[3], const Real _dir[3], Real _eps, Real& _t)
+{
+    alignas(64) Real tLanes[PACK_WIDTH];
+
+    #pragma omp simd aligned(tLanes : 64)
+    for (uint32_t i = 0; i < PACK_WIDTH; i++)
+    {
+        // pvec = dir x edge_b
+        const Real px = _dir[1] * _pack.bz[i] - _dir[2] * _pack.by[i];
+        const Real py = _dir[2] * _pack.bx[i] - _dir[0] * _pack.bz[i];
+        const Real pz = _dir[0] * _pack.by[i] - _dir[1] * _pack.bx[i];
+        const Real det = _pack.ax[i] * px + _pack.ay[i] * py + _pack.az[i] * pz;
+        const bool isValid = std::fabs(det) >= (Real)1e-12;
+        const Real invDet = (Real)1 / (isValid ? det : (Real)1);
+
+        // tvec = org - p0, qvec = tvec x edge_a
+        const Real tx = _org[0] - _pack.p0x[i];
+        const Real ty = _org[1] - _pack.p0y[i];
+        const Real tz = _org[2] - _pack.p0z[i];
+        const Real qx = ty * _pack.az[i] - tz * _pack.ay[i];
+        const Real qy = tz * _pack.ax[i] - tx * _pack.az[i];
+        const Real qz = tx * _pack.ay[i] - ty * _pack.ax[i];
+
+        const Real u = (tx * px + ty * py + tz * pz) * invDet;
+        const Real v = (_dir[0] * qx + _dir[1] * qy + _dir[2] * qz) * invDet;
+        const Real t = (_pack.bx[i] * qx + _pack.by[i] * qy + _pack.bz[i] * qz) * invDet;
+
+        const bool isHit = isValid & (u >= 0) & (v >= 0) & (u + v <= 1) & (t > _eps);
+        tLanes[i] = isHit ? t : (Real)INFINITY;
+    }
+    return ClosestLane(tLanes, _t);
+}
+
+} //namespace packs
+
+#endif // PACKS_H
@@ -4,8 +4,9 @@
 *
 * This program demonstrates global illumination rendering based on the path tracing method.
 * The intergral in the rendering equation is approximated via Monte-Carlo integration.
-* Explicit direct lighting is included to improve quality.
-* The rendered image is saved in PPM format.
+* Explicit direct lighting is included to improve quality: one light source picked
+* by power per diffuse bounce, combined with BSDF sampling by multiple importance sampling.
+* The rendered image is saved in PPM, PFM or PNG format.
 *
 * Based on smallpt by Kevin Beason, released under the MIT License.
 * https://www.kevinbeason.com/smallpt/
@@ -13,80 +14,371 @@
 *******************************************************************************************/
 
 #include "utils.h"
+#include "packs.h"
+#include "tiles.h"
+#include "imageio.h"
+#include "scene.h"
+#include "benchmark.h"
+#include "aliastable.h"
+#include "distributed.h"
+
+#include <string>
+#include <chrono>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace pathTracing
 {
+    // Rendering parameters: default values, can be set from the command line (cf. ParseArguments())
+
+    // Image dimensions
+    int imageWidth = 1024;
+    int imageHeight = 768;
+
     // Thin lens parameters
-    const double aperture = 2.0;       // radius of lens (no depth of field if set to zero) 
-    const double focal_depth = 65.0;   // distance between center of lens anf focal plane
+    double aperture = 2.0;       // radius of lens (no depth of field if set to zero) 
+    double focal_depth = 65.0;   // distance between center of lens anf focal plane
 
-    // Scene geometry to render (spheres or triangles)
-    const bool useTriangles = true;
+    // Scene geometry to render (spheres or triangles), built-in scene if no scene file
+    bool useTriangles = true;
+    std::string sceneFilename;
 
     // Path Tracing parameters
-    const unsigned int maxDepth = 5;
-    const unsigned int nbSamples = 50;
+    unsigned int maxDepth = 64;   // max path length (Russian Roulette usually terminates paths much earlier)
+    unsigned int nbSamples = 50;
+
+    // Adaptive sampling: a pixel stops receiving samples (before nbSamples) once the 95% confidence interval
+    // of its mean luminance is below adaptiveThreshold times the mean (0 to always trace nbSamples),
+    // and after at least minSamples; once timeBudget seconds are elapsed (0 for no budget),
+    // the remaining pixels stop as soon as they have minSamples
+    double adaptiveThreshold = 0.0;
+    unsigned int minSamples = 8;
+    double timeBudget = 0.0;
+    std::chrono::steady_clock::time_point renderDeadline;   // start of Render() + timeBudget
+
+    // Direct lighting: light sampling weighted with BSDF sampling by the power heuristic (true),
+    // or light sampling only (false, diffusely reflected rays do not gather the light sources they hit)
+    bool useMIS = true;
+
+    // Random light sources added to the scene (e.g. to compare light sampling strategies)
+    unsigned int nbRandomLights = 0;
+
+    // Trace the paths one by one (false), or by wavefronts of one sample per subpixel of a tile (true)
+    bool useWavefront = false;
+
+    // Image is rendered by tiles of tileSize x tileSize pixels, by nbThreads threads (0 for all the cores)
+    int tileSize = 32;
+    int nbThreads = 0;
+
+    // Output file (.ppm, .pfm or .png); with streamOutput, tiles are written
+    // as soon as they are rendered instead of saving the complete image (PPM or PFM only)
+    std::string outputFilename = "result.ppm";
+    bool streamOutput = false;
+
+    // Float output (.pfm, cf. imageio::IsFloatFormat()) keeps the radiance above 1 (HDR);
+    // for 8-bit output, each subpixel is clamped before the 2x2 average, so that the
+    // anti-aliased edges of saturated areas (e.g. the light) are not lost
+    bool hdrOutput = false;
+
+    // Distributed rendering (cf. distributed.h): coordinator handing out the tiles on port servePort (0 for off),
+    // or worker of the coordinator at workerAddress ("host:port"), started with the same scene and parameters;
+    // tiles not returned after leaseSeconds are handed out again, workers wait retrySeconds for the coordinator
+    int servePort = 0;
+    std::string workerAddress;
+    double leaseSeconds = 600.0;
+    double retrySeconds = 60.0;
+
+    // Benchmark mode (results file, .json or .csv) and size of its random scenes
+    std::string benchmarkFilename;
+    unsigned int benchmarkPrimitives = 10000;
+
+    // Intersection precision: primary rays can use single precision packs (twice as many lanes
+    // per vector register), at the cost of accuracy on very large or distant primitives
+    const bool floatPrimaryRays = false;
+    // precision of all the other rays (float or double)
+    typedef double SecondaryReal;
 
 
     
-    bool IntersectLightSource(const Ray& ray)
+    // OpenMP is optional: render on a single thread without it
+    int GetNbThreads()
     {
-        double d = LightSource.Intersect(ray);
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
 
-        if (d > 0.0)
-            return true;
+    int GetThreadId()
+    {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+
+    // Ray counts (and time of each bounce in wavefront mode) of a render:
+    // each thread counts in its own copy, summed in renderStats at the end of Render()
+    struct RayStats
+    {
+        static constexpr unsigned int MAX_BOUNCES = 64;    // longer paths are counted in the last bounce
+
+        uint64_t bounceRays[MAX_BOUNCES] = {};          // bounce 0: primary rays
+        double bounceSeconds[MAX_BOUNCES] = {};
+        uint64_t shadowRays = 0;
+        uint64_t pixelSamples = 0;                      // samples of all the pixels (nbSamples per pixel without adaptive sampling)
+
+        void CountRay(unsigned int _depth) { bounceRays[std::min(_depth, MAX_BOUNCES) - 1]++; }
+
+        uint64_t TotalRays() const
+        {
+            uint64_t total = shadowRays;
+            for (unsigned int i = 0; i < MAX_BOUNCES; i++)
+                total += bounceRays[i];
+            return total;
+        }
+
+        void Add(const RayStats& _stats)
+        {
+            for (unsigned int i = 0; i < MAX_BOUNCES; i++)
+            {
+                bounceRays[i] += _stats.bounceRays[i];
+                bounceSeconds[i] += _stats.bounceSeconds[i];
+            }
+            shadowRays += _stats.shadowRays;
+            pixelSamples += _stats.pixelSamples;
+        }
+    };
 
-        return false;
+    thread_local RayStats threadStats;
+    RayStats renderStats;
+
+
+    // Acceleration structures over spheres, triangles and light sources
+    bvh::BVH sphereBVH;
+    bvh::BVH triangleBVH;
+    bvh::BVH lightBVH;
+
+    // Light sources sampled proportionally to their power (in the order of the BVH)
+    alias::AliasTable lightTable;
+
+    /*
+     * Build the BVH of a set of primitives, which are reordered by leaf
+     * so that leaves reference contiguous ranges of the scene vectors;
+     * leaves are filled up to one SIMD pack
+     */
+    template<typename T>
+    void BuildBVH(std::vector<T>& _primitives, bvh::BVH& _bvh)
+    {
+        std::vector<bvh::AABB> bounds;
+        bounds.reserve(_primitives.size());
+        for (const T& prim : _primitives)
+            bounds.push_back(prim.Bounds());
+
+        bvh::Build(bounds, _bvh, packs::PACK_WIDTH, packs::PACK_WIDTH);
+        bvh::ReorderPrimitives(_primitives, _bvh);
+    }
+
+    // BVH leaves copied in SIMD packs, for each intersection precision
+    template<typename Real>
+    struct PackedScene
+    {
+        packs::LeafPacks<packs::SpherePack<Real>> spheres;
+        packs::LeafPacks<packs::TrianglePack<Real>> triangles;
+        packs::LeafPacks<packs::SpherePack<Real>> lights;
+    };
+
+    template<typename Real>
+    PackedScene<Real> packedScene;
+
+    template<typename Real>
+    void BuildPackedScene()
+    {
+        packs::BuildLeafPacks(sphereBVH, packedScene<Real>.spheres, [](packs::SpherePack<Real>& _pack, uint32_t _lane, uint32_t _id)
+        {
+            const Sphere& sphere = spheres[_id];
+            _pack.set(_lane, sphere.center.x, sphere.center.y, sphere.center.z, sphere.radius);
+        });
+
+        packs::BuildLeafPacks(triangleBVH, packedScene<Real>.triangles, [](packs::TrianglePack<Real>& _pack, uint32_t _lane, uint32_t _id)
+        {
+            const Triangle& triangle = triangles[_id];
+            const double p0[3] = { triangle.p0.x, triangle.p0.y, triangle.p0.z };
+            const double a[3] = { triangle.edge_a.x, triangle.edge_a.y, triangle.edge_a.z };
+            const double b[3] = { triangle.edge_b.x, triangle.edge_b.y, triangle.edge_b.z };
+            _pack.set(_lane, p0, a, b);
+        });
+
+        packs::BuildLeafPacks(lightBVH, packedScene<Real>.lights, [](packs::SpherePack<Real>& _pack, uint32_t _lane, uint32_t _id)
+        {
+            const Sphere& light = lights[_id];
+            _pack.set(_lane, light.center.x, light.center.y, light.center.z, light.radius);
+        });
     }
 
     /*
-     * Check for closest intersection of a ray with the scene;
-     * returns true if intersection is found, as well as ray parameter
-     * of intersection and id of intersected object
+     * Power of a spherical light source, up to a constant factor (4 PI^2):
+     * mean emitted radiance times squared radius
      */
-    bool IntersectSpheres(const Ray& ray, double& t, int& id)
+    double LightPower(const Sphere& _light)
     {
-        t = 1e20;
+        return (_light.emission.x + _light.emission.y + _light.emission.z) / 3.0 * _light.radius2;
+    }
 
-        for (int i = 0; i < spheres.size(); i++)
+    void BuildAccelerationStructures()
+    {
+        BuildBVH(spheres, sphereBVH);
+        BuildBVH(triangles, triangleBVH);
+        BuildBVH(lights, lightBVH);
+
+        std::vector<double> powers;
+        for (const Sphere& light : lights)
+            powers.push_back(LightPower(light));
+        if (!lightTable.Build(powers) && !lights.empty())
+            std::cerr << "[WARNING] BuildAccelerationStructures(): light sources do not emit light" << std::endl;
+
+        BuildPackedScene<SecondaryReal>();
+        if (floatPrimaryRays)
+            BuildPackedScene<float>();
+    }
+
+
+    /*
+     * Closest hit traversal of a BVH, using a small stack of nodes to visit;
+     * children are visited front to back so that distant nodes get culled by t;
+     * each leaf is tested one pack (i.e. PACK_WIDTH primitives) at a time, in Real precision;
+     * only hits closer than _tMax are searched (e.g. occluders of a shadow ray)
+     */
+    template<typename Real, typename Pack>
+    bool TraverseBVH(const bvh::BVH& _bvh, const packs::LeafPacks<Pack>& _leafPacks, const Ray& ray, double& t, int& id,
+                     double _tMax = 1e20)
+    {
+        t = _tMax;
+        if (_bvh.isEmpty())
+            return false;
+
+        const Real org[3] = { (Real)ray.org.x, (Real)ray.org.y, (Real)ray.org.z };
+        const Real dir[3] = { (Real)ray.dir.x, (Real)ray.dir.y, (Real)ray.dir.z };
+        const Real invDir[3] = { (Real)(1.0 / ray.dir.x), (Real)(1.0 / ray.dir.y), (Real)(1.0 / ray.dir.z) };
+        Real tBest = (Real)t;
+
+        if (bvh::IntersectNode(_bvh.nodes[0], org, invDir, tBest) == INFINITY)
+            return false;
+
+        // far children along the current path (depth bounded by bvh::Build())
+        uint32_t stack[bvh::MAX_DEPTH + 1];
+        int stackSize = 0;
+        uint32_t nodeId = 0;
+
+        while (true)
         {
-            double d = spheres.at(i).Intersect(ray);
+            const bvh::Node& node = _bvh.nodes[nodeId];
+
+            if (node.isLeaf())
+            {
+                const uint32_t firstPack = _leafPacks.firstPack[nodeId];
+                for (uint32_t k = 0; k < packs::NbPacks(node.count); k++)
+                {
+                    int lane = packs::Intersect(_leafPacks.packs[firstPack + k], org, dir, (Real)eps, tBest);
+                    if (lane >= 0)
+                        id = (int)(node.leftFirst + k * packs::PACK_WIDTH + lane);
+                }
+            }
+            else
+            {
+                uint32_t nearId = node.leftFirst;
+                uint32_t farId = node.leftFirst + 1;
+                Real tNear = bvh::IntersectNode(_bvh.nodes[nearId], org, invDir, tBest);
+                Real tFar = bvh::IntersectNode(_bvh.nodes[farId], org, invDir, tBest);
+                if (tFar < tNear)
+                {
+                    std::swap(nearId, farId);
+                    std::swap(tNear, tFar);
+                }
 
-            if (d > 0.0 && d < t)
+                if (tNear != INFINITY)
+                {
+                    if (tFar != INFINITY)
+                        stack[stackSize++] = farId;
+                    nodeId = nearId;
+                    continue;
+                }
+            }
+
+            // pop next node, skipping the ones further than the closest hit found so far
+            bool found = false;
+            while (stackSize > 0 && !found)
             {
-                t = d;
-                id = i;
+                nodeId = stack[--stackSize];
+                found = bvh::IntersectNode(_bvh.nodes[nodeId], org, invDir, tBest) != INFINITY;
             }
+            if (!found)
+                break;
         }
-        return t < 1e20;
+        t = (double)tBest;
+        return t < _tMax;
+    }
+
+
+    /*
+     * Check for closest intersection of a ray with the scene;
+     * returns true if intersection is found, as well as ray parameter
+     * of intersection and id of intersected object;
+     * primary rays (from the camera) can use single precision
+     */
+    bool IntersectSpheres(const Ray& ray, double& t, int& id, bool isPrimary = false, double tMax = 1e20)
+    {
+        if (floatPrimaryRays && isPrimary)
+            return TraverseBVH<float>(sphereBVH, packedScene<float>.spheres, ray, t, id, tMax);
+        return TraverseBVH<SecondaryReal>(sphereBVH, packedScene<SecondaryReal>.spheres, ray, t, id, tMax);
+    }
+
+    bool IntersectTriangles(const Ray& ray, double& t, int& id, bool isPrimary = false, double tMax = 1e20)
+    {
+        if (floatPrimaryRays && isPrimary)
+            return TraverseBVH<float>(triangleBVH, packedScene<float>.triangles, ray, t, id, tMax);
+        return TraverseBVH<SecondaryReal>(triangleBVH, packedScene<SecondaryReal>.triangles, ray, t, id, tMax);
     }
 
-    bool IntersectTriangles(const Ray& ray, double& t, int& id)
+    bool IntersectLights(const Ray& ray, double& t, int& id)
     {
-        t = 1e20;
+        return TraverseBVH<SecondaryReal>(lightBVH, packedScene<SecondaryReal>.lights, ray, t, id);
+    }
 
-        for (int i = 0; i < triangles.size(); i++)
+    /*
+    * Closest intersection with the quads (walls of the sphere scene), closer than tMax:
+    * only a few of them, tested one by one
+    */
+    bool IntersectQuads(const Ray& ray, double& t, int& id, double tMax = 1e20)
+    {
+        t = tMax;
+        for (size_t i = 0; i < quads.size(); i++)
         {
-            double d = triangles.at(i).Intersect(ray);
-            if (d > 0.0 && d < t)
+            double tQuad = quads[i].Intersect(ray);
+            if (tQuad > 0.0 && tQuad < t)
             {
-                t = d;
-                id = i;
+                t = tQuad;
+                id = (int)i;
             }
         }
-        return t < 1e20;
+        return t < tMax;
     }
 
 
     /*
      * Simulates depth-of-field using a thin lens model
      */
-    void ThinLens(Ray& _ray)
+    void ThinLens(Ray& _ray, Rng& _rng)
     {
         //depth of field
         //random polar coords
-        double angle = normRand() * 2.0 * M_PI;
-        double radius = normRand();
+        double angle = _rng.Next() * 2.0 * M_PI;
+        double radius = _rng.Next();
         //build offset vector to generate a new random origin position in the lens
         Vector aperture_offset((cos(angle) * radius) * aperture, (sin(angle) * radius) * aperture, 0.0);
         // new start position
@@ -99,80 +391,179 @@ namespace pathTracing
 
 
 
+    // Primitive ids of the sphere scene: spheres, then quads
+    inline int QuadPrimitiveId(int _quadId) { return (int)spheres.size() + _quadId; }
+    inline bool IsQuad(int _id) { return !useTriangles && _id >= (int)spheres.size(); }
+
     /*
-    * Recursive path tracing for computing radiance via Monte-Carlo
-    * integration; only considers perfectly diffuse, specular or
-    * transparent materials;
-    * After N bounces Russian Roulette is used to possibly terminate rays;
-    * Emitted light from light source only included on first direct hit
-    * (possibly via specular reflection, refraction), controlled by
-    * parameter E = 0/1;
-    * on diffuse surfaces light sources are explicitely sampled;
-    * for transparent objects, Schlicks approximation is employed;
-    * for first 3 bounces obtain reflected and refracted component,
-    * afterwards one of the two is chosen randomly
+    * Closest intersection with the scene geometry (spheres and quads, or triangles), closer than tMax
     */
-    Color Radiance(const Ray& _ray, int _depth, int _E)
+    bool IntersectScene(const Ray& ray, double& t, int& id, bool isPrimary, double tMax = 1e20)
     {
-        _depth++;
+        if (useTriangles)
+            return IntersectTriangles(ray, t, id, isPrimary, tMax);
 
-        double t;
-        int id = 0;
+        // walls first: spheres behind them are culled from the BVH traversal
+        double tQuad;
+        int quadId = 0;
+        bool isQuadHit = IntersectQuads(ray, tQuad, quadId, tMax);
+        if (IntersectSpheres(ray, t, id, isPrimary, tQuad))
+            return true;
+        t = tQuad;
+        id = QuadPrimitiveId(quadId);
+        return isQuadHit;
+    }
 
-        // If no intersection with scene, return background color
+    const Primitive& GetPrimitive(int id)
+    {
         if (useTriangles)
-            if (!IntersectTriangles(_ray, t, id))   
-                return BackgroundColor;
+            return triangles[id];
+        if (IsQuad(id))
+            return quads[id - spheres.size()];
+        return spheres[id];
+    }
 
-        if (!useTriangles)
-            if (!IntersectSpheres(_ray, t, id))
-                return BackgroundColor;
+    /*
+    * Unit normal of primitive id at a hitpoint (outwards for spheres)
+    */
+    Vector GetNormal(int id, const Vector& _hitpoint)
+    {
+        if (useTriangles)
+            return triangles[id].normal;
+        if (IsQuad(id))
+            return quads[id - spheres.size()].normal;
+        return (_hitpoint - spheres[id].center) * spheres[id].invRadius;
+    }
 
-        Primitive obj;
-        Vector normal(1.0, 0.0, 0.0);
 
-        Vector hitpoint = _ray.org + _ray.dir * t;    // Intersection position
-        Color col;
+    // Hit ids of IntersectPath(): scene primitive (>= 0), no hit, or light source
+    const int NO_HIT = -1;
+    inline int LightHitId(int _lightId) { return -2 - _lightId; }
+    inline int LightOfHit(int _hitId) { return -2 - _hitId; }
 
-        // Get normal and color at intersection
-        if (useTriangles)
-        {
-            normal = dynamic_cast<Triangle&>(triangles.at(id)).normal.Normalized();
-            col = dynamic_cast<Triangle&>(triangles.at(id)).color;
-            obj = static_cast<Primitive>(triangles.at(id));
-        }
-        else
+    /*
+    * Closest intersection of a path ray with the scene geometry or the light sources
+    * returns the hit id (cf. LightHitId()) and sets the ray parameter t of the hit
+    */
+    int IntersectPath(const Ray& ray, double& t, bool isPrimary)
+    {
+        int id = 0;
+        bool isHit = IntersectScene(ray, t, id, isPrimary);
+
+        double tLight;
+        int lightId = 0;
+        if (IntersectLights(ray, tLight, lightId) && (!isHit || tLight < t))
         {
-            normal = (hitpoint - dynamic_cast<Sphere&>(spheres.at(id)).center).Normalized();
-            col = dynamic_cast<Sphere&>(spheres.at(id)).color;
-            obj = static_cast<Primitive>(spheres.at(id));
+            t = tLight;
+            return LightHitId(lightId);
         }
+        return isHit ? id : NO_HIT;
+    }
 
-        Vector nl = normal;
 
+    /*
+    * Shadow ray towards a light source at distance _tLight: the light is visible if no scene
+    * primitive is closer (light sources do not occlude each other)
+    */
+    bool IsVisible(const Ray& ray, double _tLight)
+    {
+        threadStats.shadowRays++;
+
+        double t;
+        int id = 0;
+        return !IntersectScene(ray, t, id, false, _tLight);
+    }
+
+
+    /*
+    * Power heuristic (beta = 2) of multiple importance sampling, weight of
+    * the strategy of pdf _pdfA against the one of pdf _pdfB
+    */
+    inline double PowerHeuristic(double _pdfA, double _pdfB)
+    {
+        double a2 = _pdfA * _pdfA;
+        return a2 / (a2 + _pdfB * _pdfB);
+    }
+
+
+    /*
+    * Solid angle pdf of sampling the light source _id from point _p (inside the cone
+    * subtended by the light): selection probability times uniform density over the cone;
+    * sets the cosine of the half-angle of the cone; returns 0 from inside the light
+    */
+    double LightPdf(int _id, const Vector& _p, double& _cos_a_max)
+    {
+        const Sphere& light = lights[_id];
+        double dist2 = (_p - light.center).Dot(_p - light.center);
+        if (dist2 <= light.radius2)
+            return 0.0;
+
+        _cos_a_max = sqrt(1.0 - light.radius2 / dist2);
+        //solid angle (on a unit sphere)
+        double omega = 2 * M_PI * (1 - _cos_a_max);
+        return lightTable.pmf[_id] / omega;
+    }
+
+
+    /*
+    * Radiance emitted by light source _lightId towards the path ray _ray;
+    * light sources reached by a diffuse bounce (_bsdfPdf > 0) are also sampled explicitly
+    * from the origin of the ray, both estimates are weighted by the power heuristic
+    * (or the explicit one only is kept without MIS)
+    */
+    Color LightEmission(const Ray& _ray, int _lightId, double _bsdfPdf)
+    {
+        const Sphere& light = lights[_lightId];
+        if (_bsdfPdf <= 0.0)
+            return light.emission;
+        if (!useMIS)
+            return Color();
+
+        double cos_a_max;
+        double lightPdf = LightPdf(_lightId, _ray.org, cos_a_max);
+        if (lightPdf <= 0.0)
+            return light.emission;
+        return light.emission * PowerHeuristic(_bsdfPdf, lightPdf);
+    }
+
+
+    /*
+    * Shades one vertex of a path for Monte-Carlo integration of the
+    * radiance; only considers perfectly diffuse, specular or
+    * transparent materials;
+    * on diffuse surfaces one light source, picked proportionally to its
+    * power, is explicitely sampled; light sources hit by the next ray
+    * are weighted against it by MIS using the pdf _bsdfPdf of the
+    * diffuse direction (0 after specular bounces: emission fully included);
+    * for transparent objects, Schlicks approximation is employed and
+    * one of reflection/refraction is chosen randomly (paths never split);
+    * Russian Roulette on the path throughput possibly terminates the
+    * path at every bounce
+    * _ray: incoming ray hitting primitive _id at distance _t, replaced by the next ray of the path
+    * _throughput: product of the BRDF weights along the path
+    * _radiance: radiance gathered by the path so far
+    * returns false if the path is terminated
+    */
+    bool ShadeHit(Ray& _ray, double _t, int _id, double& _bsdfPdf, Color& _throughput, Color& _radiance, Rng& _rng)
+    {
+        Vector hitpoint = _ray.org + _ray.dir * _t;    // Intersection position
+
+        // Get material, normal and color at intersection (no copy of the hit primitive)
+        const Primitive& obj = GetPrimitive(_id);
+        Vector normal = GetNormal(_id, hitpoint);
+        const Color& col = obj.color;
+
+        Vector nl = normal;
 
         // Obtain flipped normal, if object hit from inside
         if (normal.Dot(_ray.dir) > 0)
             nl = nl * -1.0;
 
-        // Maximum RGB reflectivity for Russian Roulette
-        double p = col.Max();
-
-        // After max bounces or if max reflectivity is zero...
-        if (_depth > maxDepth || !p)
-        {
-            // Russian Roulette
-            if (normRand() < p)            
-                col = col * (1.0 / p);      // Scale estimator to remain unbiased 
-            else
-                return obj.emission * _E;   // No further bounces, only return potential emission
-        }
-
         if (obj.refl == DIFF)
         {
             // Compute random reflection vector on hemisphere
-            double r1 = 2.0 * M_PI * normRand();
-            double r2 = normRand();
+            double r1 = 2.0 * M_PI * _rng.Next();
+            double r2 = _rng.Next();
             double r2s = sqrt(r2);
 
             // Set up local orthogonal coordinate system u,v,w on surface
@@ -194,131 +585,537 @@ namespace pathTracing
             // Explicit computation of direct lighting
             Vector e;
 
-            //const Sphere &sphere = spheres.at(i);
-            const Sphere& sphere = LightSource;
+            // Pick a light source proportionally to its power
+            const double eps0 = _rng.Next();
+            const double eps1 = _rng.Next();
+            const double eps2 = _rng.Next();
+            const int lightId = lightTable.isEmpty() ? -1 : (int)lightTable.Sample(eps0);
+            double cos_a_max = 1.0;
+            const double lightPdf = lightId < 0 ? 0.0 : LightPdf(lightId, hitpoint, cos_a_max);
 
-            if (sphere.emission.x <= 0 && sphere.emission.y <= 0 && sphere.emission.z <= 0)
+            if (lightPdf > 0.0)
             {
-                std::cerr << "not light source ! " << std::endl;
+                const Sphere& sphere = lights[lightId];
+
+                // Randomly sample spherical light source from surface intersection
+
+                // Set up local orthogonal coordinate system su,sv,sw towards light source
+                Vector sw = (sphere.center - hitpoint).Normalized();
+                Vector su;
+
+                if (fabs(sw.x) > 0.1)
+                    su = Vector(0.0, 1.0, 0.0);
+                else
+                    su = Vector(1.0, 0.0, 0.0);
+
+                su = (su.Cross(sw)).Normalized();
+                Vector sv = sw.Cross(su);
+
+                // Create random sample direction l towards spherical light source
+                double cos_a = 1.0 - eps1 + eps1 * cos_a_max;
+                double sin_a = sqrt(1.0 - cos_a * cos_a);
+                double phi = 2.0 * M_PI * eps2;
+                Vector l = su * cos(phi) * sin_a +
+                    sv * sin(phi) * sin_a +
+                    sw * cos_a;
+                l = l.Normalized();
+
+                // Shoot shadow ray if the light is above the surface, check that no primitive hides the light
+                Ray shadowRay(hitpoint, l);
+                double cos_l = l.Dot(nl);
+                double tLight = cos_l > 0.0 ? sphere.Intersect(shadowRay) : 0.0;
+                if (tLight > 0.0 && IsVisible(shadowRay, tLight))
+                {
+                    // Add diffusely reflected light from light source; note constant BRDF 1/PI,
+                    // MIS weight against sampling l with the cosine distribution of the next ray
+                    double weight = useMIS ? PowerHeuristic(lightPdf, cos_l * M_1_PI) : 1.0;
+                    e = col.MultComponents(sphere.emission) * (cos_l * M_1_PI * weight / lightPdf);
+                }
             }
 
-            // Randomly sample spherical light source from surface intersection
+            // Light emission and direct lighting, indirect lighting through the next ray
+            _radiance = _radiance + _throughput.MultComponents(obj.emission + e);
+            _throughput = _throughput.MultComponents(col);
+            _ray = Ray(hitpoint, d);
+            // cosine distribution of d (never 0, which would mean a specular bounce)
+            _bsdfPdf = std::max(sqrt(1.0 - r2), 1e-8) * M_1_PI;
+        }
+        else if (obj.refl == SPEC)
+        {
+            // Light emission, then mirror reflection (perfect reflection vector)
+            _radiance = _radiance + _throughput.MultComponents(obj.emission);
+            _throughput = _throughput.MultComponents(col);
+            _ray = Ray(hitpoint, _ray.dir - normal * 2 * normal.Dot(_ray.dir));
+            _bsdfPdf = 0.0;
+        }
+        else
+        {
+            // Otherwise object transparent, i.e. assumed dielectric glass material
+            _radiance = _radiance + _throughput.MultComponents(obj.emission);
+            _bsdfPdf = 0.0;
+
+            Ray reflRay(hitpoint, _ray.dir - normal * 2 * normal.Dot(_ray.dir));  // Prefect reflection
+            bool into = normal.Dot(nl) > 0;       // Bool for checking if ray from outside going in
+            double nc = 1.0;                      // Index of refraction of air (approximately)
+            double nt = 1.5;                      // Index of refraction of glass (approximately)
+            double nnt = 0.0;
+
+            // Set ratio depending on hit from inside or outside
+            if (into)
+                nnt = nc / nt;
+            else
+                nnt = nt / nc;
 
-            // Set up local orthogonal coordinate system su,sv,sw towards light source
-            Vector sw = sphere.center - hitpoint;
-            Vector su;
+            double ddn = _ray.dir.Dot(nl);
+            double cos2t = 1.0 - nnt * nnt * (1.0 - ddn * ddn);
 
-            if (fabs(sw.x) > 0.1)
-                su = Vector(0.0, 1.0, 0.0);
+            // Check for total internal reflection, if so only reflect
+            if (cos2t <= 0.0)
+            {
+                // move reflection ray origin to the sphere surface
+                _throughput = _throughput.MultComponents(col);
+                _ray = Ray(hitpoint + normal * spheres[_id].radius,
+                           _ray.dir - normal * 2 * normal.Dot(_ray.dir));
+            }
             else
-                su = Vector(1.0, 0.0, 0.0);
-
-            su = (su.Cross(/*w*/sw)).Normalized();
-            Vector sv = sw.Cross(su);
-            /*Vector sv = (sw.Cross(w)).Normalized();
-            Vector su = (sv.Cross(sw)).Normalized();*/
-
-            // Create random sample direction l towards spherical light source
-            double cos_a_max = sqrt(1.0 - sphere.radius * sphere.radius /
-                (hitpoint - sphere.center).Dot(hitpoint - sphere.center));
-            double eps1 = normRand();
-            double eps2 = normRand();
-            double cos_a = 1.0 - eps1 + eps1 * cos_a_max;
-            double sin_a = sqrt(1.0 - cos_a * cos_a);
-            double phi = 2.0 * M_PI * eps2;
-            Vector l = su * cos(phi) * sin_a +
-                sv * sin(phi) * sin_a +
-                sw * cos_a;
-            l = l.Normalized();
-
-            // Shoot shadow ray, check if intersection is with light source
-            if ( IntersectLightSource(Ray(hitpoint, l)) )
             {
-                //solid angle (on a unit sphere)
-                double omega = 2 * M_PI * (1 - cos_a_max);
+                // Otherwise reflection or refraction occurs
+                Vector tdir;
+
+                // Determine transmitted ray direction for refraction
+                if (into)
+                    tdir = (_ray.dir * nnt - normal * (ddn * nnt + sqrt(cos2t))).Normalized();
+                else
+                    tdir = (_ray.dir * nnt + normal * (ddn * nnt + sqrt(cos2t))).Normalized();
+
+                // Determine R0 for Schlicks approximation
+                double a = nt - nc;
+                double b = nt + nc;
+                double R0 = a * a / (b * b);
+
+                // Cosine of correct angle depending on outside/inside
+                double c;
+                if (into)
+                    c = 1 + ddn;
+                else
+                    c = 1 - tdir.Dot(normal);
+
+                // Compute Schlicks approximation of Fresnel equation
+                double Re = R0 + (1 - R0) * c * c * c * c * c;   // Reflectance
+                double Tr = 1 - Re;                              // Transmittance
+
+                // Probability for selecting reflectance or transmittance
+                double P = .25 + .5 * Re;
+                double RP = Re / P;         // Scaling factors for unbiased estimator
+                double TP = Tr / (1 - P);
+
+                if (_rng.Next() < P)
+                {
+                    _throughput = _throughput.MultComponents(col) * RP;
+                    _ray = reflRay;
+                }
+                else
+                {
+                    _throughput = _throughput.MultComponents(col) * TP;
+                    _ray = Ray(hitpoint, tdir);
+                }
+            }
+        }
 
-                // Add diffusely reflected light from light source; note constant BRDF 1/PI
-                e = e + col.MultComponents(sphere.emission * l.Dot(nl) * omega) * M_1_PI;
+        // Russian Roulette: the path continues with a probability given by its throughput
+        double p = std::min(1.0, _throughput.Max());
+        if (p <= 0.0 || _rng.Next() >= p)
+            return false;
+
+        // Scale estimator to remain unbiased
+        _throughput = _throughput * (1.0 / p);
+
+        return true;
+    }
+
+
+    /*
+    * Iterative path tracing for computing radiance via Monte-Carlo
+    * integration: follows a single path carrying its throughput, until
+    * it leaves the scene, hits a light source (which does not reflect light),
+    * Russian Roulette terminates it or it reaches maxDepth bounces
+    */
+    Color Radiance(const Ray& _ray, Rng& _rng)
+    {
+        Color radiance;
+        Color throughput(1.0, 1.0, 1.0);
+        Ray ray = _ray;
+        double bsdfPdf = 0.0;
+
+        for (unsigned int depth = 1; depth <= maxDepth; depth++)
+        {
+            double t;
+
+            threadStats.CountRay(depth);
+            int id = IntersectPath(ray, t, depth == 1);
+
+            // If no intersection with scene, add background color
+            if (id == NO_HIT)
+            {
+                radiance = radiance + throughput.MultComponents(BackgroundColor);
+                break;
             }
-            
 
-            // Return potential light emission, direct lighting, and indirect lighting 
-            // (via recursive call for Monte-Carlo integration
-            return obj.emission * _E + e + col.MultComponents(Radiance(Ray(hitpoint, d), _depth, 0));
+            if (id < NO_HIT)
+            {
+                radiance = radiance + throughput.MultComponents(LightEmission(ray, LightOfHit(id), bsdfPdf));
+                break;
+            }
 
+            if (!ShadeHit(ray, t, id, bsdfPdf, throughput, radiance, _rng))
+                break;
         }
-        else if (obj.refl == SPEC)
+        return radiance;
+    }
+
+
+    /*
+    * Random sequence of sample s of a subpixel: the stream is selected by the subpixel,
+    * the seed by the sample, so that samples can be traced in any order
+    * (deterministic for any number of threads, and in wavefront mode)
+    */
+    Rng SampleRng(const ImageSize& _img, int x, int y, int sx, int sy, int s)
+    {
+        return Rng(((uint64_t)y * _img.width + x) * 4 + sy * 2 + sx,
+                   0x853c49e6748fea9bULL + (uint64_t)s * 0x9e3779b97f4a7c15ULL);
+    }
+
+
+    /*
+    * Camera ray through a random position (tent filter) of subpixel (sx, sy) of pixel (x, y)
+    * camera: camera origin and viewing direction, cx, cy: image edge vectors
+    */
+    Ray CameraRay(const ImageSize& _img, const Ray& _camera, const Vector& _cx, const Vector& _cy,
+                  int x, int y, int sx, int sy, Rng& _rng)
+    {
+        const double r1 = 2.0 * _rng.Next();
+        const double r2 = 2.0 * _rng.Next();
+
+        // Transform uniform into non-uniform filter samples
+        double dx;
+        if (r1 < 1.0)
+            dx = sqrt(r1) - 1.0;
+        else
+            dx = 1.0 - sqrt(2.0 - r1);
+
+        double dy;
+        if (r2 < 1.0)
+            dy = sqrt(r2) - 1.0;
+        else
+            dy = 1.0 - sqrt(2.0 - r2);
+
+        // Ray direction into scene from camera through sample
+        Vector dir = _cx * ((x + (sx + 0.5 + dx) / 2.0) / _img.width - 0.5) +
+                     _cy * ((y + (sy + 0.5 + dy) / 2.0) / _img.height - 0.5) +
+                     _camera.dir;
+
+        // Extend camera ray to start inside box
+        Vector start = _camera.org + dir * 130.0;
+
+        // build ray
+        dir = dir.Normalized();
+        Ray ray(start, dir);
+
+        ThinLens(ray, _rng);
+
+        return ray;
+    }
+
+
+    /*
+    * Convergence test of adaptive sampling (also isPixelConverged() in rtCommon.glsl): the 95% confidence
+    * interval of the mean luminance, CONVERGENCE_CONFIDENCE standard errors, must be below adaptiveThreshold
+    * times the mean. The mean is bounded by CONVERGENCE_MIN_MEAN: a relative error would shrink with the
+    * mean, and dark pixels would need an absolute error they never reach, while noise that is dark in
+    * absolute terms is not visible. So the target is an absolute error below that mean.
+    */
+    const double CONVERGENCE_CONFIDENCE = 1.96;
+    const double CONVERGENCE_MIN_MEAN = 0.05;
+
+
+    /*
+    * Running mean and variance (Welford's algorithm) of the luminance of the samples of a pixel,
+    * a sample being the average of one sample of each of its 2x2 subpixels
+    */
+    struct PixelVariance
+    {
+        unsigned int n = 0;
+        double mean = 0.0;
+        double m2 = 0.0;    // sum of the squared differences to the mean
+
+        void Add(Color _sample)
         {
-            // Return light emission mirror reflection 
-            // (via recursive call using perfect reflection vector)
-            return obj.emission +
-                col.MultComponents(Radiance(Ray(hitpoint, _ray.dir - normal * 2 * normal.Dot(_ray.dir)),
-                    _depth, 1));
+            _sample.clamp();
+            double luminance = 0.2126 * _sample.x + 0.7152 * _sample.y + 0.0722 * _sample.z;
+            n++;
+            double delta = luminance - mean;
+            mean += delta / n;
+            m2 += delta * (luminance - mean);
         }
 
-        // Otherwise object transparent, i.e. assumed dielectric glass material
-        Ray reflRay(hitpoint, _ray.dir - normal * 2 * normal.Dot(_ray.dir));  // Prefect reflection
-        bool into = normal.Dot(nl) > 0;       // Bool for checking if ray from outside going in
-        double nc = 1.0;                      // Index of refraction of air (approximately)
-        double nt = 1.5;                      // Index of refraction of glass (approximately)
-        double nnt = 0.0;
+        // no more samples needed (cf. adaptiveThreshold and CONVERGENCE_CONFIDENCE)
+        bool IsConverged() const
+        {
+            if (n >= nbSamples)
+                return true;
+            if (n < minSamples || n < 2)
+                return false;
+            if (timeBudget > 0.0 && std::chrono::steady_clock::now() > renderDeadline)
+                return true;
+            return adaptiveThreshold > 0.0
+                && CONVERGENCE_CONFIDENCE * sqrt(m2 / (n - 1) / n) <= adaptiveThreshold * std::max(mean, CONVERGENCE_MIN_MEAN);
+        }
+    };
+
+
+    /*
+    * Contribution of a subpixel to the pixel average: clamped for 8-bit output only (cf. hdrOutput)
+    */
+    Color SubpixelValue(Color _radiance)
+    {
+        return hdrOutput ? _radiance : _radiance.clamp();
+    }
 
-        // Set ratio depending on hit from inside or outside
-        if (into)
-            nnt = nc / nt;
-        else
-            nnt = nt / nc;
 
-        double ddn = _ray.dir.Dot(nl);
-        double cos2t = 1.0 - nnt * nnt * (1.0 - ddn * ddn);
+    /*
+    * Computes the color of pixel (x, y), averaged over 2x2 subpixels
+    * camera: camera origin and viewing direction, cx, cy: image edge vectors
+    */
+    Color RenderPixel(const ImageSize& _img, const Ray& _camera, const Vector& _cx, const Vector& _cy, int x, int y)
+    {
+        Color accumulated_radiance[4];
+        PixelVariance variance;
 
-        // Check for total internal reflection, if so only reflect
-        if (cos2t <= 0.0)
+        // one sample of each subpixel at a time, until the pixel converges (nbSamples without adaptive sampling)
+        while (!variance.IsConverged())
         {
-            // move reflection ray origin to the sphere surface
-            Ray reflRay2(hitpoint + normal * dynamic_cast<Sphere&>(spheres.at(id)).radius, 
-                         _ray.dir - normal * 2 * normal.Dot(_ray.dir));
-            return obj.emission + col.MultComponents(Radiance(reflRay2, _depth, 1));
+            const int s = (int)variance.n;
+            Color pixelSample;
+
+            // 2x2 subsampling per pixel
+            for (int sy = 0; sy < 2; sy++)
+            {
+                for (int sx = 0; sx < 2; sx++)
+                {
+                    Rng rng = SampleRng(_img, x, y, sx, sy, s);
+                    Ray ray = CameraRay(_img, _camera, _cx, _cy, x, y, sx, sy, rng);
+                    Color radiance = Radiance(ray, rng);
+
+                    // Accumulate radiance
+                    accumulated_radiance[sy * 2 + sx] = accumulated_radiance[sy * 2 + sx] + radiance / (double)nbSamples;
+                    pixelSample = pixelSample + radiance * 0.25;
+                }
+            }
+            variance.Add(pixelSample);
         }
+        threadStats.pixelSamples += variance.n;
+
+        // samples are weighted for nbSamples, rescaled if the pixel stopped earlier (exactly 1 otherwise)
+        const double scale = (double)nbSamples / variance.n;
+        Color pixel;
+        for (int sub = 0; sub < 4; sub++)
+            pixel = pixel + SubpixelValue(accumulated_radiance[sub] * scale) * 0.25;
+        return pixel;
+    }
 
-        // Otherwise reflection and/or refraction occurs
-        Vector tdir;
 
-        // Determine transmitted ray direction for refraction
-        if (into)
-            tdir = (_ray.dir * nnt - normal * (ddn * nnt + sqrt(cos2t))).Normalized();
-        else
-            tdir = (_ray.dir * nnt + normal * (ddn * nnt + sqrt(cos2t))).Normalized();
+    /*
+    * Paths in flight for wavefront rendering, as Structure of Arrays
+    */
+    struct PathQueue
+    {
+        std::vector<Ray> rays;
+        std::vector<Color> throughputs;
+        std::vector<Color> radiances;
+        std::vector<Rng> rngs;
+        std::vector<double> bsdfPdfs;   // pdf of the last bounce of each path (cf. ShadeHit())
+        std::vector<uint32_t> slots;    // subpixel accumulating the radiance of each path
 
-        // Determine R0 for Schlicks approximation
-        double a = nt - nc;
-        double b = nt + nc;
-        double R0 = a * a / (b * b);
+        size_t size() const { return rays.size(); }
 
-        // Cosine of correct angle depending on outside/inside
-        double c;
-        if (into)
-            c = 1 + ddn;
-        else
-            c = 1 - tdir.Dot(normal);
-
-        // Compute Schlicks approximation of Fresnel equation
-        double Re = R0 + (1 - R0) * c * c * c * c * c;   // Reflectance
-        double Tr = 1 - Re;                              // Transmittance
-
-        // Probability for selecting reflectance or transmittance
-        double P = .25 + .5 * Re;
-        double RP = Re / P;         // Scaling factors for unbiased estimator
-        double TP = Tr / (1 - P);
-
-        if (_depth < 3)   // Initially both reflection and transmission
-            return obj.emission + col.MultComponents(Radiance(reflRay, _depth, 1) * Re +
-                Radiance(Ray(hitpoint, tdir), _depth, 1) * Tr);
-        else             // Russian Roulette
-            if (normRand() < P)
-                return obj.emission + col.MultComponents(Radiance(reflRay, _depth, 1) * RP);
-            else
-                return obj.emission + col.MultComponents(Radiance(Ray(hitpoint, tdir), _depth, 1) * TP);
+        void clear()
+        {
+            rays.clear(); throughputs.clear(); radiances.clear();
+            rngs.clear(); bsdfPdfs.clear(); slots.clear();
+        }
+
+        void push(const Ray& _ray, const Color& _throughput, const Color& _radiance, const Rng& _rng, double _bsdfPdf, uint32_t _slot)
+        {
+            rays.push_back(_ray); throughputs.push_back(_throughput); radiances.push_back(_radiance);
+            rngs.push_back(_rng); bsdfPdfs.push_back(_bsdfPdf); slots.push_back(_slot);
+        }
+    };
+
+
+    /*
+    * Wavefront rendering of a tile: one sample of every subpixel at a time,
+    * all the paths advance by one bounce together (bulk intersection,
+    * then shading sorted by material); only the pixels that have not converged
+    * get new samples (cf. PixelVariance); same result as RenderPixel()
+    * tileBuffer: output colors of the tile pixels
+    */
+    void RenderTileWavefront(const ImageSize& _img, const Ray& _camera, const Vector& _cx, const Vector& _cy,
+                             const tiles::Tile& _tile, std::vector<Color>& _tileBuffer)
+    {
+        // slot = 4 * pixel index in tile + subpixel index
+        const uint32_t nbSlots = (uint32_t)(_tile.width() * _tile.height() * 4);
+        std::vector<Color> accumulated_radiance(nbSlots);
+        std::vector<Color> sample_radiance(nbSlots);    // radiance of the current sample
+
+        // pixels (in tile) still receiving samples
+        std::vector<PixelVariance> variances(nbSlots / 4);
+        std::vector<uint32_t> activePixels(nbSlots / 4);
+        for (uint32_t pixel = 0; pixel < nbSlots / 4; pixel++)
+            activePixels[pixel] = pixel;
+
+        PathQueue queue, nextQueue;
+        std::vector<double> hitT;
+        std::vector<int> hitId;
+        std::vector<uint32_t> order;
+
+        // bucket 0 for paths leaving the scene or hitting a light source, then one bucket per material
+        const int nbBuckets = 4;
+        auto bucket = [&](size_t i) { return hitId[i] < 0 ? 0 : 1 + (int)GetPrimitive(hitId[i]).refl; };
+
+        for (int s = 0; !activePixels.empty(); s++)
+        {
+            // generate camera rays
+            queue.clear();
+            for (uint32_t pixel : activePixels)
+            {
+                int x = _tile.x0 + pixel % _tile.width();
+                int y = _tile.y0 + pixel / _tile.width();
+
+                for (uint32_t sub = 0; sub < 4; sub++)
+                {
+                    int sx = sub % 2;
+                    int sy = sub / 2;
+
+                    Rng rng = SampleRng(_img, x, y, sx, sy, s);
+                    Ray ray = CameraRay(_img, _camera, _cx, _cy, x, y, sx, sy, rng);
+                    queue.push(ray, Color(1.0, 1.0, 1.0), Color(), rng, 0.0, pixel * 4 + sub);
+                }
+            }
+
+            for (unsigned int depth = 1; depth <= maxDepth && queue.size() > 0; depth++)
+            {
+                auto bounceStart = std::chrono::steady_clock::now();
+
+                // intersect all the rays of the wavefront
+                hitT.resize(queue.size());
+                hitId.resize(queue.size());
+                for (size_t i = 0; i < queue.size(); i++)
+                    hitId[i] = IntersectPath(queue.rays[i], hitT[i], depth == 1);
+                threadStats.bounceRays[std::min(depth, RayStats::MAX_BOUNCES) - 1] += queue.size();
+
+                // sort paths by material (counting sort, queue order is kept inside a bucket)
+                size_t bucketStart[nbBuckets + 1] = { 0 };
+                for (size_t i = 0; i < queue.size(); i++)
+                    bucketStart[bucket(i) + 1]++;
+                for (int b = 0; b < nbBuckets; b++)
+                    bucketStart[b + 1] += bucketStart[b];
+                order.resize(queue.size());
+                for (size_t i = 0; i < queue.size(); i++)
+                    order[bucketStart[bucket(i)]++] = (uint32_t)i;
+
+                // shade, surviving paths make the next wavefront
+                nextQueue.clear();
+                for (uint32_t i : order)
+                {
+                    Color radiance = queue.radiances[i];
+
+                    if (hitId[i] == NO_HIT)
+                    {
+                        // no intersection with scene, add background color
+                        radiance = radiance + queue.throughputs[i].MultComponents(BackgroundColor);
+                    }
+                    else if (hitId[i] < NO_HIT)
+                    {
+                        radiance = radiance + queue.throughputs[i].MultComponents(
+                            LightEmission(queue.rays[i], LightOfHit(hitId[i]), queue.bsdfPdfs[i]));
+                    }
+                    else
+                    {
+                        Ray ray = queue.rays[i];
+                        Color throughput = queue.throughputs[i];
+                        Rng rng = queue.rngs[i];
+                        double bsdfPdf = queue.bsdfPdfs[i];
+
+                        if (ShadeHit(ray, hitT[i], hitId[i], bsdfPdf, throughput, radiance, rng) && depth < maxDepth)
+                        {
+                            nextQueue.push(ray, throughput, radiance, rng, bsdfPdf, queue.slots[i]);
+                            continue;
+                        }
+                    }
+
+                    // terminated path
+                    accumulated_radiance[queue.slots[i]] = accumulated_radiance[queue.slots[i]] + radiance / (double)nbSamples;
+                    sample_radiance[queue.slots[i]] = radiance;
+                }
+                std::swap(queue, nextQueue);
+
+                threadStats.bounceSeconds[std::min(depth, RayStats::MAX_BOUNCES) - 1] +=
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - bounceStart).count();
+            }
+
+            // update the statistics of the sampled pixels, converged ones leave the active list
+            size_t nbActive = 0;
+            for (uint32_t pixel : activePixels)
+            {
+                Color pixelSample;
+                for (uint32_t sub = 0; sub < 4; sub++)
+                    pixelSample = pixelSample + sample_radiance[pixel * 4 + sub] * 0.25;
+                variances[pixel].Add(pixelSample);
+                if (!variances[pixel].IsConverged())
+                    activePixels[nbActive++] = pixel;
+            }
+            activePixels.resize(nbActive);
+        }
+
+        // 2x2 subsampling per pixel (cf. RenderPixel() for the scale)
+        for (uint32_t pixel = 0; pixel < nbSlots / 4; pixel++)
+        {
+            threadStats.pixelSamples += variances[pixel].n;
+            const double scale = (double)nbSamples / variances[pixel].n;
+            Color color;
+            for (uint32_t sub = 0; sub < 4; sub++)
+                color = color + SubpixelValue(accumulated_radiance[pixel * 4 + sub] * scale) * 0.25;
+            _tileBuffer[pixel] = color;
+        }
+    }
+
+
+    /*
+    * Camera origin and viewing direction (negative z direction), image edge vectors for pixel sampling
+    */
+    Ray SetupCamera(const ImageSize& _img, Vector& _cx, Vector& _cy)
+    {
+        Ray camera(Vector(50.0, 52.0, 295.6), Vector(0.0, -0.042612, -1.0).Normalized());
+        _cx = Vector(_img.width * 0.5135 / _img.height, 0.0, 0.0);
+        _cy = (_cx.Cross(camera.dir)).Normalized() * 0.5135;
+        return camera;
+    }
+
+
+    /*
+    * Colors of the pixels of a tile, row by row in tileBuffer
+    */
+    void RenderTile(const ImageSize& _img, const Ray& _camera, const Vector& _cx, const Vector& _cy,
+                    const tiles::Tile& _tile, std::vector<Color>& _tileBuffer)
+    {
+        if (useWavefront)
+        {
+            RenderTileWavefront(_img, _camera, _cx, _cy, _tile, _tileBuffer);
+            return;
+        }
+        for (int y = _tile.y0; y < _tile.y1; y++)
+            for (int x = _tile.x0; x < _tile.x1; x++)
+                _tileBuffer[(y - _tile.y0) * _tile.width() + (x - _tile.x0)] = RenderPixel(_img, _camera, _cx, _cy, x, y);
     }
 
 
@@ -327,100 +1124,534 @@ namespace pathTracing
     * Key parameters
     * - Image dimensions: width, height
     * - Number of samples per subpixel (non-uniform filtering): samples
-    * Rendered result saved as PPM image file
+    * - Tile size: the image is rendered by tiles handed out to the threads
+    *   by a work-stealing scheduler (rows crossing the glass sphere cost much more than wall rows)
+    * size: image dimensions
+    * img, stream: finished tiles are written to the image, or to the stream if img is null
+    * Returns 1 if the tiles could not be written to the stream, 0 otherwise
     */
-    int Render(Image _img)
+    int Render(const ImageSize& _size, Image* _img, imageio::TileWriter* _stream)
     {
-        // Set camera origin and viewing direction (negative z direction)
-        Ray camera(Vector(50.0, 52.0, 295.6), Vector(0.0, -0.042612, -1.0).Normalized());
-
-        // Image edge vectors for pixel sampling
-        Vector cx = Vector(_img.width * 0.5135 / _img.height, 0.0, 0.0);
-        Vector cy = (cx.Cross(camera.dir)).Normalized() * 0.5135;
+        Vector cx, cy;
+        Ray camera = SetupCamera(_size, cx, cy);
 
         std::cout << "Starts rendering ... " << std::endl;
+        auto start = std::chrono::steady_clock::now();
+        renderDeadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeBudget));
+        renderStats = RayStats();
+
+        std::vector<tiles::Tile> imageTiles = tiles::MakeTiles(_size.width, _size.height, tileSize);
+        tiles::Scheduler scheduler(imageTiles, GetNbThreads());
 
-        // Loop over image rows
-        #pragma omp parallel for
-        for (int y = 0; y < _img.height; y++)
+        #pragma omp parallel
         {
-            // init pseudo-random number generator
-            srand(y * y * y);
+            // each worker renders in its own tile buffer, then copies it in the image
+            // (tiles do not overlap, no synchronization needed)
+            std::vector<Color> tileBuffer(tileSize * tileSize);
+            threadStats = RayStats();
+            tiles::Tile tile;
 
-            // Loop over row pixels
-            #pragma omp parallel for
-            for (int x = 0; x < _img.width; x++)
+            while (scheduler.Next(GetThreadId(), tile))
             {
-                // init current pixel with black
-                _img.setColor(x, y, Color());
+                RenderTile(_size, camera, cx, cy, tile, tileBuffer);
 
-                // 2x2 subsampling per pixel
-                for (int sy = 0; sy < 2; sy++)
+                if (!_img)
                 {
-                    for (int sx = 0; sx < 2; sx++)
-                    {
-                        Color accumulated_radiance;
+                    _stream->WriteTile(tile, tileBuffer);
+                    continue;
+                }
 
-                        // Compute radiance at subpixel using multiple samples
-                        for (int s = 0; s < nbSamples; s++)
-                        {
-                            const double r1 = 2.0 * normRand();
-                            const double r2 = 2.0 * normRand();
-
-                            // Transform uniform into non-uniform filter samples
-                            double dx;
-                            if (r1 < 1.0)
-                                dx = sqrt(r1) - 1.0;
-                            else
-                                dx = 1.0 - sqrt(2.0 - r1);
-
-                            double dy;
-                            if (r2 < 1.0)
-                                dy = sqrt(r2) - 1.0;
-                            else
-                                dy = 1.0 - sqrt(2.0 - r2);
-
-                            // Ray direction into scene from camera through sample
-                            Vector dir = cx * ((x + (sx + 0.5 + dx) / 2.0) / _img.width - 0.5) +
-                                         cy * ((y + (sy + 0.5 + dy) / 2.0) / _img.height - 0.5) +
-                                         camera.dir;
-
-                            // Extend camera ray to start inside box
-                            Vector start = camera.org + dir * 130.0;
-
-                            // build ray 
-                            dir = dir.Normalized();
-                            Ray ray(start, dir);
-
-                            ThinLens(ray);
-
-                            // Accumulate radiance
-                            accumulated_radiance = accumulated_radiance + Radiance(ray, 0, 1) / (double)nbSamples;
-                        }
+                for (int y = tile.y0; y < tile.y1; y++)
+                    for (int x = tile.x0; x < tile.x1; x++)
+                        _img->setColor(x, y, tileBuffer[(y - tile.y0) * tile.width() + (x - tile.x0)]);
+            }
 
-                        accumulated_radiance = accumulated_radiance.clamp() * 0.25;
+            #pragma omp critical
+            renderStats.Add(threadStats);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Done! " << seconds << " s, " << renderStats.TotalRays() / seconds * 1e-6 << " Mrays/s";
+        if (adaptiveThreshold > 0.0 || timeBudget > 0.0)
+            std::cout << ", " << (double)renderStats.pixelSamples / ((double)_size.width * _size.height) << " spp on average";
+        std::cout << std::endl;
 
-                        _img.addColor(x, y, accumulated_radiance);
-                    }
+        return (_stream && !_stream->good()) ? 1 : 0;
+    }
+
+    int Render(Image& _img)
+    {
+        return Render(_img, &_img, nullptr);
+    }
+
+
+    /*
+    * 64 bits FNV-1a hash
+    */
+    uint64_t Hash(const void* _data, size_t _size, uint64_t _hash = 0xcbf29ce484222325ULL)
+    {
+        const unsigned char* bytes = (const unsigned char*)_data;
+        for (size_t i = 0; i < _size; i++)
+            _hash = (_hash ^ bytes[i]) * 0x100000001b3ULL;
+        return _hash;
+    }
+
+
+    /*
+    * Hash of everything the pixels depend on (scene records and rendering parameters),
+    * for the workers to check that they render the same image as the coordinator
+    * (the number of threads and the wavefront mode do not change the pixels)
+    */
+    uint64_t JobKey()
+    {
+        uint64_t key = 0xcbf29ce484222325ULL;
+        for (const Sphere& light : lights)
+        {
+            scene::SphereRecord record = scene::ToRecord(light);
+            key = Hash(&record, sizeof(record), key);
+        }
+        for (const Sphere& sphere : spheres)
+        {
+            scene::SphereRecord record = scene::ToRecord(sphere);
+            key = Hash(&record, sizeof(record), key);
+        }
+        for (const Triangle& triangle : triangles)
+        {
+            scene::TriangleRecord record = scene::ToRecord(triangle);
+            key = Hash(&record, sizeof(record), key);
+        }
+        for (const Quad& quad : quads)
+        {
+            scene::QuadRecord record = scene::ToRecord(quad);
+            key = Hash(&record, sizeof(record), key);
+        }
+
+        const int32_t integers[] = { imageWidth, imageHeight, (int32_t)maxDepth, (int32_t)nbSamples, (int32_t)minSamples,
+                                     tileSize, useTriangles ? 1 : 0, useMIS ? 1 : 0, hdrOutput ? 1 : 0 };
+        const double reals[] = { aperture, focal_depth, adaptiveThreshold, timeBudget };
+        key = Hash(integers, sizeof(integers), key);
+        return Hash(reals, sizeof(reals), key);
+    }
+
+
+    /*
+    * Coordinator of a distributed render: hands out the tiles to the workers
+    * and assembles their results in the image (or writes them to the stream if img is null, cf. Render())
+    */
+    bool RenderCoordinator(const ImageSize& _size, Image* _img, imageio::TileWriter* _stream)
+    {
+        distributed::Coordinator coordinator(tiles::MakeTiles(_size.width, _size.height, tileSize), JobKey(), leaseSeconds);
+        if (!coordinator.Listen(servePort))
+            return false;
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Color> tileBuffer(tileSize * tileSize);
+        uint64_t nbRays = 0;
+        uint64_t nbPixelSamples = 0;
+        coordinator.Run([&](const tiles::Tile& _tile, const distributed::TileResult& _result)
+        {
+            for (int i = 0; i < _tile.width() * _tile.height(); i++)
+                tileBuffer[i] = _result.GetColor(i);
+            if (!_img)
+            {
+                _stream->WriteTile(_tile, tileBuffer);
+                return;
+            }
+            for (int y = _tile.y0; y < _tile.y1; y++)
+                for (int x = _tile.x0; x < _tile.x1; x++)
+                    _img->setColor(x, y, tileBuffer[(y - _tile.y0) * _tile.width() + (x - _tile.x0)]);
+        }, nbRays, nbPixelSamples);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Done! " << seconds << " s, " << nbRays / seconds * 1e-6 << " Mrays/s (all the workers)";
+        if (adaptiveThreshold > 0.0 || timeBudget > 0.0)
+            std::cout << ", " << (double)nbPixelSamples / ((double)_size.width * _size.height) << " spp on average";
+        std::cout << std::endl;
+        return !_stream || _stream->good();
+    }
+
+
+    /*
+    * Worker of a distributed render: renders the tiles handed out by the coordinator
+    * with all the threads, until the image is complete
+    * (the time budget starts with the worker)
+    */
+    bool RunWorker()
+    {
+        // tiles are sent to the coordinator, no image
+        const ImageSize size = { imageWidth, imageHeight };
+        Vector cx, cy;
+        Ray camera = SetupCamera(size, cx, cy);
+
+        distributed::Worker worker(workerAddress, JobKey(), GetNbThreads(), retrySeconds);
+        renderDeadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeBudget));
+        renderStats = RayStats();
+
+        #pragma omp parallel
+        {
+            std::vector<Color> tileBuffer(tileSize * tileSize);
+            threadStats = RayStats();
+            distributed::TileResult result;
+            tiles::Tile tile;
+
+            while (worker.Next(result, tile))
+            {
+                const uint64_t nbRays = threadStats.TotalRays();
+                const uint64_t nbPixelSamples = threadStats.pixelSamples;
+                RenderTile(size, camera, cx, cy, tile, tileBuffer);
+                result.Set(tileBuffer, (size_t)tile.width() * tile.height(),
+                           threadStats.TotalRays() - nbRays, threadStats.pixelSamples - nbPixelSamples);
+            }
+
+            #pragma omp critical
+            renderStats.Add(threadStats);
+        }
+
+        std::cout << "Worker done: " << worker.GetNbTiles() << " tiles, " << renderStats.TotalRays() << " rays" << std::endl;
+        return worker.IsComplete();
+    }
+
+
+    /*
+    * Random diffuse primitives inside the Cornell box, for the benchmark scenes
+    * (same scene for a given number and seed)
+    */
+    void AddRandomSpheres(unsigned int _nb, uint64_t _seed)
+    {
+        Rng rng(_seed);
+        for (unsigned int i = 0; i < _nb; i++)
+        {
+            Vector center(10.0 + 80.0 * rng.Next(), 5.0 + 70.0 * rng.Next(), 20.0 + 120.0 * rng.Next());
+            Color color(0.2 + 0.7 * rng.Next(), 0.2 + 0.7 * rng.Next(), 0.2 + 0.7 * rng.Next());
+            spheres.push_back(Sphere(0.5 + 2.5 * rng.Next(), center, Vector(), color, DIFF));
+        }
+    }
+
+    /*
+    * Random small light sources under the ceiling of the Cornell box, of random colors and powers
+    * (same lights for a given number and seed)
+    */
+    void AddRandomLights(unsigned int _nb, uint64_t _seed)
+    {
+        Rng rng(_seed);
+        for (unsigned int i = 0; i < _nb; i++)
+        {
+            Vector center(10.0 + 80.0 * rng.Next(), 60.0 + 15.0 * rng.Next(), 20.0 + 120.0 * rng.Next());
+            Color emission(0.2 + 0.8 * rng.Next(), 0.2 + 0.8 * rng.Next(), 0.2 + 0.8 * rng.Next());
+            lights.push_back(Sphere(0.5 + rng.Next(), center, emission * (50.0 + 350.0 * rng.Next()), Vector(), DIFF));
+        }
+    }
+
+    void AddRandomTriangles(unsigned int _nb, uint64_t _seed)
+    {
+        Rng rng(_seed);
+        for (unsigned int i = 0; i < _nb; i++)
+        {
+            Vector p0(10.0 + 80.0 * rng.Next(), 5.0 + 70.0 * rng.Next(), 20.0 + 120.0 * rng.Next());
+            Vector a(6.0 * rng.Next() - 3.0, 6.0 * rng.Next() - 3.0, 6.0 * rng.Next() - 3.0);
+            Vector b(6.0 * rng.Next() - 3.0, 6.0 * rng.Next() - 3.0, 6.0 * rng.Next() - 3.0);
+            Color color(0.2 + 0.7 * rng.Next(), 0.2 + 0.7 * rng.Next(), 0.2 + 0.7 * rng.Next());
+            triangles.push_back(Triangle(p0, a, b, Vector(), color));
+        }
+    }
+
+
+    /*
+    * Benchmark mode: renders fixed scenes (Cornell boxes of spheres and triangles,
+    * plus benchmarkPrimitives random spheres or triangles), at the current image size,
+    * spp and depth, with 1, 2, 4 ... threads up to all the cores, then once by
+    * wavefronts on all the cores for the time per bounce;
+    * results written in benchmarkFilename
+    */
+    bool RunBenchmark()
+    {
+        struct BenchmarkScene
+        {
+            const char* name;
+            bool isTriangles;
+            unsigned int nbRandom;
+        };
+        const BenchmarkScene benchmarkScenes[] = { { "cornell_spheres", false, 0 },
+                                                   { "cornell_triangles", true, 0 },
+                                                   { "random_spheres", false, benchmarkPrimitives },
+                                                   { "random_triangles", true, benchmarkPrimitives } };
+
+        const int maxThreads = nbThreads > 0 ? nbThreads : GetNbThreads();
+        std::vector<int> threadCounts;
+        for (int t = 1; t < maxThreads; t *= 2)
+            threadCounts.push_back(t);
+        threadCounts.push_back(maxThreads);
+
+        // built-in or loaded scene, restored for each benchmark scene
+        const std::vector<Sphere> baseSpheres = spheres;
+        const std::vector<Triangle> baseTriangles = triangles;
+        const bool baseUseTriangles = useTriangles;
+        const bool baseUseWavefront = useWavefront;
+
+        Image img(imageWidth, imageHeight);
+        std::vector<benchmark::Record> records;
+
+        for (const BenchmarkScene& benchmarkScene : benchmarkScenes)
+        {
+            spheres = baseSpheres;
+            triangles = baseTriangles;
+            useTriangles = benchmarkScene.isTriangles;
+            if (useTriangles)
+                AddRandomTriangles(benchmarkScene.nbRandom, 1);
+            else
+                AddRandomSpheres(benchmarkScene.nbRandom, 1);
+            BuildAccelerationStructures();
+
+            for (size_t run = 0; run <= threadCounts.size(); run++)
+            {
+                // last run: wavefronts on all the cores
+                const int threads = run < threadCounts.size() ? threadCounts[run] : maxThreads;
+                useWavefront = (run == threadCounts.size());
+#ifdef _OPENMP
+                omp_set_num_threads(threads);
+#endif
+
+                auto start = std::chrono::steady_clock::now();
+                Render(img);
+
+                benchmark::Record record;
+                record.renderer = "cpu";
+                record.scene = benchmarkScene.name;
+                record.mode = useWavefront ? "wavefront" : "scalar";
+                record.nbPrimitives = useTriangles ? triangles.size() : spheres.size();
+                record.width = imageWidth;
+                record.height = imageHeight;
+                record.samples = (int)nbSamples;
+                record.depth = (int)maxDepth;
+                record.threads = threads;
+                record.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                record.primaryRays = renderStats.bounceRays[0];
+                record.totalRays = renderStats.TotalRays();
+
+                // per bounce values, up to the last bounce reached
+                unsigned int nbBounces = RayStats::MAX_BOUNCES;
+                while (nbBounces > 0 && renderStats.bounceRays[nbBounces - 1] == 0)
+                    nbBounces--;
+                record.bounceRays.assign(renderStats.bounceRays, renderStats.bounceRays + nbBounces);
+                if (useWavefront)
+                    for (unsigned int b = 0; b < nbBounces; b++)
+                        record.bounceMs.push_back(renderStats.bounceSeconds[b] * 1e3);
+
+                benchmark::Print(record);
+                records.push_back(record);
+            }
+        }
+
+        spheres = baseSpheres;
+        triangles = baseTriangles;
+        useTriangles = baseUseTriangles;
+        useWavefront = baseUseWavefront;
+
+        return benchmark::Write(benchmarkFilename, records);
+    }
+
+
+    void PrintUsage(const char* _program)
+    {
+        std::cout << "Usage: " << _program << " [options]\n"
+                  << "  --width <w>            image width (" << imageWidth << ")\n"
+                  << "  --height <h>           image height (" << imageHeight << ")\n"
+                  << "  --spp <n>              samples per subpixel, 4 subpixels per pixel (" << nbSamples << ")\n"
+                  << "  --depth <d>            max path length (" << maxDepth << ")\n"
+                  << "  --adaptive <t>         stop sampling a pixel once its relative error is below t, 0 for off (" << adaptiveThreshold << ")\n"
+                  << "  --min-spp <n>          samples per subpixel before a pixel can stop (" << minSamples << ")\n"
+                  << "  --time-budget <s>      after s seconds, pixels stop at min-spp, 0 for no budget (" << timeBudget << ")\n"
+                  << "  --threads <n>          number of threads, 0 for all the cores (" << nbThreads << ")\n"
+                  << "  --tile <s>             tile size in pixels (" << tileSize << ")\n"
+                  << "  --aperture <r>         lens radius, 0 for no depth of field (" << aperture << ")\n"
+                  << "  --focal <d>            focal distance (" << focal_depth << ")\n"
+                  << "  --scene <file>         scene file (built-in Cornell box otherwise)\n"
+                  << "  --spheres|--triangles  geometry to render (" << (useTriangles ? "triangles" : "spheres") << ")\n"
+                  << "  --wavefront            trace paths by wavefronts\n"
+                  << "  --lights <n>           add n random light sources (" << nbRandomLights << ")\n"
+                  << "  --no-mis               light sampling only for direct lighting (no MIS with BSDF sampling)\n"
+                  << "  --output <file>        .ppm, .pfm or .png (" << outputFilename << ")\n"
+                  << "  --stream               write tiles to the output as they are rendered (PPM/PFM)\n"
+                  << "  --export-scene <file>  write the scene to a scene file and exit\n"
+                  << "  --serve <port>         distributed render: hand out the tiles to the workers connecting on port\n"
+                  << "  --worker <host:port>   distributed render: render tiles for the coordinator at host:port\n"
+                  << "                         (same scene, parameters and output format, .pfm or not, as the coordinator)\n"
+                  << "  --lease <s>            tiles not returned after s seconds go to other workers (" << leaseSeconds << ")\n"
+                  << "  --retry <s>            time a worker waits for the coordinator (" << retrySeconds << ")\n"
+                  << "  --benchmark <file>     render the benchmark scenes with the current size, spp and depth,\n"
+                  << "                         and write the results to <file> (.json or .csv)\n"
+                  << "  --bench-primitives <n> primitives of the random benchmark scenes (" << benchmarkPrimitives << ")\n"
+                  << "  --help                 print this message" << std::endl;
+    }
+
+
+    /*
+    * Set the rendering parameters from the command line
+    * exportFilename: set by --export-scene
+    * returns false if an argument is invalid (or --help)
+    */
+    bool ParseArguments(int argc, char* argv[], std::string& _exportFilename)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+
+            // options without value
+            if (arg == "--help")                { PrintUsage(argv[0]); return false; }
+            else if (arg == "--spheres")        { useTriangles = false; continue; }
+            else if (arg == "--triangles")      { useTriangles = true; continue; }
+            else if (arg == "--wavefront")      { useWavefront = true; continue; }
+            else if (arg == "--no-mis")         { useMIS = false; continue; }
+            else if (arg == "--stream")         { streamOutput = true; continue; }
+
+            if (i + 1 >= argc)
+            {
+                std::cerr << "[ERROR] ParseArguments(): missing value after " << arg << std::endl;
+                return false;
+            }
+            const std::string value = argv[++i];
+
+            try
+            {
+                if (arg == "--width")               imageWidth = std::stoi(value);
+                else if (arg == "--height")         imageHeight = std::stoi(value);
+                else if (arg == "--spp")            nbSamples = (unsigned int)std::stoul(value);
+                else if (arg == "--depth")          maxDepth = (unsigned int)std::stoul(value);
+                else if (arg == "--adaptive")       adaptiveThreshold = std::stod(value);
+                else if (arg == "--min-spp")        minSamples = (unsigned int)std::stoul(value);
+                else if (arg == "--time-budget")    timeBudget = std::stod(value);
+                else if (arg == "--threads")        nbThreads = std::stoi(value);
+                else if (arg == "--tile")           tileSize = std::stoi(value);
+                else if (arg == "--aperture")       aperture = std::stod(value);
+                else if (arg == "--focal")          focal_depth = std::stod(value);
+                else if (arg == "--scene")          sceneFilename = value;
+                else if (arg == "--lights")         nbRandomLights = (unsigned int)std::stoul(value);
+                else if (arg == "--output")         outputFilename = value;
+                else if (arg == "--export-scene")   _exportFilename = value;
+                else if (arg == "--serve")          servePort = std::stoi(value);
+                else if (arg == "--worker")         workerAddress = value;
+                else if (arg == "--lease")          leaseSeconds = std::stod(value);
+                else if (arg == "--retry")          retrySeconds = std::stod(value);
+                else if (arg == "--benchmark")      benchmarkFilename = value;
+                else if (arg == "--bench-primitives") benchmarkPrimitives = (unsigned int)std::stoul(value);
+                else
+                {
+                    std::cerr << "[ERROR] ParseArguments(): unknown option " << arg << std::endl;
+                    PrintUsage(argv[0]);
+                    return false;
                 }
             }
+            catch (const std::exception&)
+            {
+                std::cerr << "[ERROR] ParseArguments(): invalid value " << value << " for " << arg << std::endl;
+                return false;
+            }
+        }
+
+        hdrOutput = imageio::IsFloatFormat(outputFilename);
+
+        if (imageWidth <= 0 || imageHeight <= 0 || nbSamples == 0 || maxDepth == 0 || tileSize <= 0 || nbThreads < 0)
+        {
+            std::cerr << "[ERROR] ParseArguments(): image size, spp, depth and tile size must be positive" << std::endl;
+            return false;
+        }
+        if (adaptiveThreshold < 0.0 || timeBudget < 0.0)
+        {
+            std::cerr << "[ERROR] ParseArguments(): adaptive threshold and time budget cannot be negative" << std::endl;
+            return false;
+        }
+        if (servePort < 0 || servePort > 65535 || (servePort > 0 && !workerAddress.empty()) || leaseSeconds <= 0.0 || retrySeconds < 0.0)
+        {
+            std::cerr << "[ERROR] ParseArguments(): invalid port, a process is either --serve or --worker, lease must be positive" << std::endl;
+            return false;
         }
-        std::cout << "Done! " << std::endl;   
+        return true;
     }
 
 } //namespace pathTracing
 
 int main(int argc, char* argv[])
 {
-    // Image to store final rendering
-    const unsigned int width = 1024;
-    const unsigned int height = 768;
-    pathTracing::Image img(width, height);
+    std::string exportFilename;
+    if (!pathTracing::ParseArguments(argc, argv, exportFilename))
+        return 1;
+
+#ifdef _OPENMP
+    if (pathTracing::nbThreads > 0)
+        omp_set_num_threads(pathTracing::nbThreads);
+#endif
+
+    if (!pathTracing::sceneFilename.empty())
+    {
+        if (!pathTracing::scene::Load(pathTracing::sceneFilename))
+            return 1;
+
+        // scene files may contain only one kind of geometry (spheres and quads, or triangles)
+        const bool hasSphereScene = !pathTracing::spheres.empty() || !pathTracing::quads.empty();
+        if (pathTracing::useTriangles && pathTracing::triangles.empty() && hasSphereScene)
+        {
+            std::cerr << "[WARNING] no triangle in " << pathTracing::sceneFilename << ", rendering spheres" << std::endl;
+            pathTracing::useTriangles = false;
+        }
+        else if (!pathTracing::useTriangles && !hasSphereScene && !pathTracing::triangles.empty())
+        {
+            std::cerr << "[WARNING] no sphere in " << pathTracing::sceneFilename << ", rendering triangles" << std::endl;
+            pathTracing::useTriangles = true;
+        }
+    }
+
+    pathTracing::AddRandomLights(pathTracing::nbRandomLights, 1);
+
+    if (!exportFilename.empty())
+        return pathTracing::scene::Save(exportFilename) ? 0 : 1;
+
+    if (!pathTracing::benchmarkFilename.empty())
+        return pathTracing::RunBenchmark() ? 0 : 1;
+
+    // Image dimensions (the pixels are only allocated when the complete image is saved)
+    const pathTracing::ImageSize size = { pathTracing::imageWidth, pathTracing::imageHeight };
 
-    // Performs path tracing
-    pathTracing::Render(img);
+    // Build BVHs over the scene geometry
+    // (also on the coordinator of a distributed render, primitives are reordered before JobKey())
+    pathTracing::BuildAccelerationStructures();
 
-    // save image output
-    img.Save(std::string("result.ppm"));
+    if (!pathTracing::workerAddress.empty())
+        return pathTracing::RunWorker() ? 0 : 1;
+
+    if (pathTracing::streamOutput)
+    {
+        // Performs path tracing, image output written tile by tile
+        imageio::TileWriter writer(pathTracing::outputFilename, size.width, size.height);
+        if (!writer.good())
+            return 1;
+        if (pathTracing::servePort > 0)
+        {
+            if (!pathTracing::RenderCoordinator(size, nullptr, &writer))
+                return 1;
+        }
+        else if (pathTracing::Render(size, nullptr, &writer) != 0)
+            return 1;
+
+        // buffered pixels are only written when the file is closed
+        if (!writer.Close())
+            return 1;
+    }
+    else
+    {
+        // Image to store final rendering
+        pathTracing::Image img(size.width, size.height);
+
+        // Performs path tracing (by the workers in distributed mode)
+        if (pathTracing::servePort > 0)
+        {
+            if (!pathTracing::RenderCoordinator(img, &img, nullptr))
+                return 1;
+        }
+        else
+            pathTracing::Render(img);
+
+        // save image output
+        if (!imageio::Save(img, pathTracing::outputFilename))
+            return 1;
+    }
 
-}
\ No newline at end of file
+}
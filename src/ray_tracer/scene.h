@@ -0,0 +1,331 @@
+/******************************************************************
+*
+* scene.h
+*
+* Binary scene file of the path tracer, replaces the hard-coded
+* spheres, quads, triangles and light sources of utils.h.
+* Little endian, fixed size records (8 bytes aligned), so that
+* the file is mapped in memory and read in place:
+* - header: "RTSC", version, number of spheres, number of triangles,
+*   number of lights, number of quads
+* - light sources (sphere records), then the spheres
+* - the quads (double precision like the spheres, so that
+*   the walls of the built-in scene are stored exactly)
+* - the triangles (single precision, diffuse)
+*
+*******************************************************************/
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "utils.h"
+
+namespace pathTracing
+{
+namespace scene
+{
+
+const uint32_t FILE_VERSION = 1;
+
+struct FileHeader
+{
+    char magic[4];          // "RTSC"
+    uint32_t version;
+    uint32_t nbSpheres;     // light sources excluded
+    uint32_t nbTriangles;
+    uint32_t nbLights;
+    uint32_t nbQuads;
+};
+
+struct SphereRecord
+{
+    double radius;
+    double center[3];
+    double emission[3];
+    double color[3];
+    uint32_t refl;          // Refl_t
+    uint32_t pad;
+};
+
+struct TriangleRecord
+{
+    float p0[3], p1[3], p2[3];
+    float emission[3];
+    float color[3];
+};
+
+struct QuadRecord
+{
+    double p0[3];
+    double edgeA[3];        // p1 - p0
+    double edgeB[3];        // p3 - p0
+    double emission[3];
+    double color[3];
+};
+
+static_assert(sizeof(FileHeader) == 24 && sizeof(SphereRecord) == 88 && sizeof(TriangleRecord) == 60 && sizeof(QuadRecord) == 120,
+              "scene file records must be packed");
+
+
+/*
+ * Read-only view of a whole file: memory mapped, or read in a buffer
+ * when mapping is not available (Windows)
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& _filename) : data(nullptr), size(0)
+    {
+#ifndef _WIN32
+        int fd = open(_filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED)
+            {
+                data = (const unsigned char*)ptr;
+                size = (size_t)st.st_size;
+            }
+        }
+        close(fd);
+#else
+        FILE* f = fopen(_filename.c_str(), "rb");
+        if (!f)
+            return;
+        fseek(f, 0, SEEK_END);
+        long fileSize = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (fileSize > 0)
+        {
+            buffer.resize((size_t)fileSize);
+            if (fread(buffer.data(), 1, buffer.size(), f) == buffer.size())
+            {
+                data = buffer.data();
+                size = buffer.size();
+            }
+        }
+        fclose(f);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (data)
+            munmap((void*)data, size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data;
+    size_t size;
+
+private:
+#ifdef _WIN32
+    std::vector<unsigned char> buffer;
+#endif
+};
+
+
+inline Vector ToVector(const double _v[3]) { return Vector(_v[0], _v[1], _v[2]); }
+inline Vector ToVector(const float _v[3]) { return Vector(_v[0], _v[1], _v[2]); }
+
+inline Sphere ToSphere(const SphereRecord& _r)
+{
+    return Sphere(_r.radius, ToVector(_r.center), ToVector(_r.emission), ToVector(_r.color), (Refl_t)_r.refl);
+}
+
+inline SphereRecord ToRecord(const Sphere& _s)
+{
+    SphereRecord r = {};
+    r.radius = _s.radius;
+    r.center[0] = _s.center.x;   r.center[1] = _s.center.y;   r.center[2] = _s.center.z;
+    r.emission[0] = _s.emission.x; r.emission[1] = _s.emission.y; r.emission[2] = _s.emission.z;
+    r.color[0] = _s.color.x;     r.color[1] = _s.color.y;     r.color[2] = _s.color.z;
+    r.refl = (uint32_t)_s.refl;
+    return r;
+}
+
+inline void Store(float _dst[3], const Vector& _v)
+{
+    _dst[0] = (float)_v.x;
+    _dst[1] = (float)_v.y;
+    _dst[2] = (float)_v.z;
+}
+
+inline TriangleRecord ToRecord(const Triangle& _t)
+{
+    TriangleRecord r;
+    Store(r.p0, _t.p0);
+    Store(r.p1, _t.p0 + _t.edge_a);
+    Store(r.p2, _t.p0 + _t.edge_b);
+    Store(r.emission, _t.emission);
+    Store(r.color, _t.color);
+    return r;
+}
+
+inline void Store(double _dst[3], const Vector& _v)
+{
+    _dst[0] = _v.x;
+    _dst[1] = _v.y;
+    _dst[2] = _v.z;
+}
+
+inline QuadRecord ToRecord(const Quad& _q)
+{
+    QuadRecord r;
+    Store(r.p0, _q.p0);
+    Store(r.edgeA, _q.edge_a);
+    Store(r.edgeB, _q.edge_b);
+    Store(r.emission, _q.emission);
+    Store(r.color, _q.color);
+    return r;
+}
+
+
+/*
+ * Replace the scene (spheres, quads, triangles and light sources) by the content of a scene file
+ * returns false if the file cannot be read or is invalid (scene unchanged)
+ */
+inline bool Load(const std::string& _filename)
+{
+    MappedFile file(_filename);
+    if (!file.data)
+    {
+        std::cerr << "[ERROR] scene::Load(): cannot read " << _filename << std::endl;
+        return false;
+    }
+
+    FileHeader header = {};
+    if (file.size < sizeof(FileHeader))
+    {
+        std::cerr << "[ERROR] scene::Load(): " << _filename << " is not a scene file" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data, sizeof(FileHeader));
+
+    if (std::memcmp(header.magic, "RTSC", 4) != 0 || header.version != FILE_VERSION)
+    {
+        std::cerr << "[ERROR] scene::Load(): " << _filename << " is not a scene file (version " << FILE_VERSION << ")" << std::endl;
+        return false;
+    }
+
+    const size_t nbSphereRecords = (size_t)header.nbLights + header.nbSpheres;
+    const size_t expectedSize = sizeof(FileHeader) + nbSphereRecords * sizeof(SphereRecord) + (size_t)header.nbQuads * sizeof(QuadRecord)
+                              + (size_t)header.nbTriangles * sizeof(TriangleRecord);
+    if (file.size != expectedSize)
+    {
+        std::cerr << "[ERROR] scene::Load(): " << _filename << " is truncated or corrupted" << std::endl;
+        return false;
+    }
+
+    // records are read in place
+    const SphereRecord* sphereRecords = (const SphereRecord*)(file.data + sizeof(FileHeader));
+    const QuadRecord* quadRecords = (const QuadRecord*)(sphereRecords + nbSphereRecords);
+    const TriangleRecord* triangleRecords = (const TriangleRecord*)(quadRecords + header.nbQuads);
+
+    for (size_t i = 0; i < nbSphereRecords; i++)
+    {
+        if (sphereRecords[i].refl > REFR)
+        {
+            std::cerr << "[ERROR] scene::Load(): invalid material in sphere " << i << " of " << _filename << std::endl;
+            return false;
+        }
+    }
+
+    lights.clear();
+    lights.reserve(header.nbLights);
+    for (uint32_t i = 0; i < header.nbLights; i++)
+        lights.push_back(ToSphere(sphereRecords[i]));
+
+    spheres.clear();
+    spheres.reserve(header.nbSpheres);
+    for (size_t i = header.nbLights; i < nbSphereRecords; i++)
+        spheres.push_back(ToSphere(sphereRecords[i]));
+
+    triangles.clear();
+    triangles.reserve(header.nbTriangles);
+    for (uint32_t i = 0; i < header.nbTriangles; i++)
+    {
+        const TriangleRecord& r = triangleRecords[i];
+        const Vector p0 = ToVector(r.p0);
+        triangles.push_back(Triangle(p0, ToVector(r.p1) - p0, ToVector(r.p2) - p0, ToVector(r.emission), ToVector(r.color)));
+    }
+
+    quads.clear();
+    quads.reserve(header.nbQuads);
+    for (uint32_t i = 0; i < header.nbQuads; i++)
+    {
+        const QuadRecord& r = quadRecords[i];
+        quads.push_back(Quad(ToVector(r.p0), ToVector(r.edgeA), ToVector(r.edgeB), ToVector(r.emission), ToVector(r.color)));
+    }
+
+    return true;
+}
+
+
+/*
+ * Write the current scene in a scene file (e.g. to start from the built-in scenes)
+ */
+inline bool Save(const std::string& _filename)
+{
+    FileHeader header = { { 'R', 'T', 'S', 'C' }, FILE_VERSION, (uint32_t)spheres.size(), (uint32_t)triangles.size(),
+                          (uint32_t)lights.size(), (uint32_t)quads.size() };
+
+    std::vector<SphereRecord> sphereRecords;
+    sphereRecords.reserve(lights.size() + spheres.size());
+    for (const Sphere& light : lights)
+        sphereRecords.push_back(ToRecord(light));
+    for (const Sphere& sphere : spheres)
+        sphereRecords.push_back(ToRecord(sphere));
+
+    std::vector<QuadRecord> quadRecords;
+    quadRecords.reserve(quads.size());
+    for (const Quad& quad : quads)
+        quadRecords.push_back(ToRecord(quad));
+
+    std::vector<TriangleRecord> triangleRecords;
+    triangleRecords.reserve(triangles.size());
+    for (const Triangle& triangle : triangles)
+        triangleRecords.push_back(ToRecord(triangle));
+
+    FILE* f = fopen(_filename.c_str(), "wb");
+    if (!f)
+    {
+        std::cerr << "[ERROR] scene::Save(): cannot open " << _filename << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(FileHeader), 1, f) == 1
+           && fwrite(sphereRecords.data(), sizeof(SphereRecord), sphereRecords.size(), f) == sphereRecords.size()
+           && fwrite(quadRecords.data(), sizeof(QuadRecord), quadRecords.size(), f) == quadRecords.size()
+           && fwrite(triangleRecords.data(), sizeof(TriangleRecord), triangleRecords.size(), f) == triangleRecords.size();
+    fclose(f);
+
+    if (!ok)
+        std::cerr << "[ERROR] scene::Save(): cannot write " << _filename << std::endl;
+    return ok;
+}
+
+} //namespace scene
+} //namespace pathTracing
+
+#endif // SCENE_H
@@ -0,0 +1,139 @@
+/******************************************************************
+*
+* tiles.h
+*
+* Image tiles and work-stealing scheduler: each worker owns a
+* queue of tiles (a contiguous range of the Morton ordered list,
+* for cache locality) and steals from the other queues once
+* its own one is empty.
+*
+*******************************************************************/
+
+#ifndef TILES_H
+#define TILES_H
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+
+namespace tiles
+{
+
+/*
+ * Rectangle of pixels [x0, x1[ x [y0, y1[
+ */
+struct Tile
+{
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+};
+
+
+/*
+ * Interleave the bits of the tile coords (Z-order curve)
+ */
+inline uint32_t MortonCode(uint32_t _x, uint32_t _y)
+{
+    uint32_t code = 0;
+    for (uint32_t b = 0; b < 16; b++)
+        code |= ((_x >> b) & 1u) << (2 * b) | ((_y >> b) & 1u) << (2 * b + 1);
+    return code;
+}
+
+
+/*
+ * Split an image in tiles of _tileSize x _tileSize pixels (clipped at the borders),
+ * sorted in Morton order so that consecutive tiles are close in the image
+ */
+inline std::vector<Tile> MakeTiles(int _width, int _height, int _tileSize)
+{
+    std::vector<std::pair<uint32_t, Tile>> coded;
+    for (int ty = 0; ty * _tileSize < _height; ty++)
+    {
+        for (int tx = 0; tx * _tileSize < _width; tx++)
+        {
+            Tile tile = { tx * _tileSize, ty * _tileSize,
+                          std::min(_width, (tx + 1) * _tileSize), std::min(_height, (ty + 1) * _tileSize) };
+            coded.push_back(std::make_pair(MortonCode(tx, ty), tile));
+        }
+    }
+    std::sort(coded.begin(), coded.end(), [](const std::pair<uint32_t, Tile>& a, const std::pair<uint32_t, Tile>& b)
+              { return a.first < b.first; });
+
+    std::vector<Tile> tiles;
+    tiles.reserve(coded.size());
+    for (const auto& c : coded)
+        tiles.push_back(c.second);
+    return tiles;
+}
+
+
+/*
+ * Distributes tiles between _nbWorkers workers:
+ * owners pop from the front of their queue, thieves steal from the back of the others
+ */
+class Scheduler
+{
+public:
+    Scheduler(const std::vector<Tile>& _tiles, int _nbWorkers)
+    {
+        int nbWorkers = std::max(1, _nbWorkers);
+        for (int w = 0; w < nbWorkers; w++)
+            queues.push_back(std::make_unique<Queue>());
+
+        // contiguous chunks of the Morton order
+        for (size_t i = 0; i < _tiles.size(); i++)
+            queues[i * nbWorkers / _tiles.size()]->tiles.push_back(_tiles[i]);
+    }
+
+    /*
+     * Get the next tile to render for worker _workerId
+     * returns false when all the tiles have been distributed
+     */
+    bool Next(int _workerId, Tile& _tile)
+    {
+        int nbWorkers = (int)queues.size();
+        Queue& own = *queues[_workerId % nbWorkers];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tiles.empty())
+            {
+                _tile = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+
+        // own queue is empty: steal from the other workers, starting with the next one
+        for (int i = 1; i < nbWorkers; i++)
+        {
+            Queue& victim = *queues[(_workerId + i) % nbWorkers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tiles.empty())
+            {
+                _tile = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+};
+
+} //namespace tiles
+
+#endif // TILES_H
@@ -7,8 +7,12 @@
 *
 *******************************************************************/
 
+#ifndef RAY_TRACER_UTILS_H
+#define RAY_TRACER_UTILS_H
+
 #include <cmath>   
 #include <cstdlib> 
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -16,16 +20,46 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include "bvh.h"
+
 namespace pathTracing
 {
 
 const double eps = 1e-4;
 
-double normRand()
+/*
+ * PCG32 pseudo-random number generator (O'Neill, pcg-random.org)
+ * Small state, no shared global data: each pixel owns a generator,
+ * so results do not depend on the number of threads nor on scheduling
+ */
+struct Rng
 {
-    // returns a random double in the [0; 1] range
-    return (double)rand() / (double)RAND_MAX;
-}
+    uint64_t state;
+    uint64_t inc;       // stream selector (must be odd)
+
+    Rng(uint64_t _stream, uint64_t _seed = 0x853c49e6748fea9bULL)
+        : state(0), inc((_stream << 1u) | 1u)
+    {
+        NextUInt();
+        state += _seed;
+        NextUInt();
+    }
+
+    uint32_t NextUInt()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    // returns a random double in the [0; 1[ range
+    double Next()
+    {
+        return NextUInt() * (1.0 / 4294967296.0);
+    }
+};
 
 /*
  * Struct for standard Vector operations in 3D 
@@ -78,60 +112,76 @@ struct Ray
 
 
 /*
- * Struct holds pixels/colors of rendered image
+ * Pixel formats of images: 32 bit float channels, either RGB (12 bytes)
+ * or RGBA padded to 16 bytes (aligned, one SIMD register per pixel)
+ */
+struct PixelRGB
+{
+    float r, g, b;
+
+    PixelRGB() : r(0.0f), g(0.0f), b(0.0f) {}
+    PixelRGB(const Color &c) : r((float)c.x), g((float)c.y), b((float)c.z) {}
+
+    operator Color() const { return Color(r, g, b); }
+};
+
+struct alignas(16) PixelRGBA
+{
+    float r, g, b, a;   /* a is padding */
+
+    PixelRGBA() : r(0.0f), g(0.0f), b(0.0f), a(0.0f) {}
+    PixelRGBA(const Color &c) : r((float)c.x), g((float)c.y), b((float)c.z), a(0.0f) {}
+
+    operator Color() const { return Color(r, g, b); }
+};
+
+
+/*
+ * Dimensions of a rendered image, enough to sample it
+ * (renders streamed tile by tile do not allocate the pixels)
  */
-struct Image 
+struct ImageSize
 {
     int width, height;
-    Color *pixels;
+};
 
-    Image(int _w, int _h) : width(_w), height(_h) 
-    {
-        pixels = new Color[width * height];        
-    }
 
-    Color getColor(int x, int y) 
+/*
+ * Struct holds pixels/colors of rendered image
+ * (storage is released with the image)
+ */
+template<typename Pixel>
+struct ImageBuffer : ImageSize
+{
+    std::vector<Pixel> pixels;
+
+    ImageBuffer(int _w, int _h) : ImageSize{ _w, _h }, pixels((size_t)_w * _h) {}
+
+    Color getColor(int x, int y) const
     {
-        int image_index = (height-y-1) * width + x; 
+        size_t image_index = (size_t)(height-y-1) * width + x;
         return pixels[image_index];
     }
 
     void setColor(int x, int y, const Color &c) 
     {
-        int image_index = (height-y-1) * width + x; 
-        pixels[image_index] = c;
+        size_t image_index = (size_t)(height-y-1) * width + x;
+        pixels[image_index] = Pixel(c);
     }
 
     void addColor(int x, int y, const Color &c) 
     {
-        int image_index = (height-y-1) * width + x; 
-        pixels[image_index] = pixels[image_index] + c;
+        size_t image_index = (size_t)(height-y-1) * width + x;
+        Pixel& p = pixels[image_index];
+        p.r += (float)c.x;
+        p.g += (float)c.y;
+        p.b += (float)c.z;
     }
+};
 
-    int toInteger(double x)
-    { 
-        // Clamp to [0,1] 
-        if (x < 0.0)
-            x = 0.0;          
-        else if (x > 1.0)
-            x = 1.0;             
-
-        // Apply gamma correction and convert to integer
-        return int(pow(x,1/2.2) * 255 + 0.5); 
-    }
+/* float RGB storage (ImageBuffer<PixelRGBA> for aligned pixels) */
+typedef ImageBuffer<PixelRGB> Image;
 
-    void Save(const std::string &filename) 
-    {
-        /* Save image in PPM format */
-        FILE *f = fopen(filename.c_str(), "wb");
-        fprintf(f, "P3\n%d %d\n%d\n", width, height, 255);
-        for (int i = 0; i < width * height; i++)
-            fprintf(f,"%d %d %d ", toInteger(pixels[i].x), 
-                                   toInteger(pixels[i].y), 
-                                   toInteger(pixels[i].z));
-        fclose(f);
-    }
-};
 
 
 /*
@@ -168,10 +218,13 @@ class Sphere : public Primitive
 public:
     double radius;       
     Vector center; 
+    double radius2;     // radius * radius and 1 / radius, derived from radius by the constructor
+    double invRadius;
    
     
     Sphere(double radius_, Vector center_, Vector emission_, Vector color_, Refl_t refl_)
-        : radius(radius_), center(center_), Primitive(emission_, color_, refl_) 
+        : radius(radius_), center(center_), radius2(radius_ * radius_), invRadius(1.0 / radius_),
+          Primitive(emission_, color_, refl_) 
     {}
 
     double Intersect(const Ray &ray) const 
@@ -183,31 +236,44 @@ public:
         *     (( o + t*d ) - c )^2 - R^2 = 0
         *     (d.d)*t^2 + 2*(o-c)*d*t + ((o-c)*(o-c) - R^2) = 0
         * which is a quadratic eq of the form A*t^2 + B*t + C = 0
-        * solutions are therefore:
-        *     t = ( -B +/- sqrt(B^2 - 4*A*C) ) / (2*A)
-        * becomes:
-        *     t = b +/- sqrt(b^2 - ((o-c)*(o-c) + R^2)) 
-        * with b = (o-c).d 
+        * solutions are therefore (d is normalized):
+        *     t = b +/- sqrt(b^2 - C)
+        * with b = (c-o).d and C = (c-o)*(c-o) - R^2
+        * Numerically stable form of Hearn and Baker (cf. Haines et al., "Precision
+        * Improvements for Ray/Sphere Intersection", Ray Tracing Gems 2019):
+        * - the discriminant b^2 - C = R^2 - |(c-o) - b*d|^2 is computed from the distance
+        *   between the center and the ray, instead of the difference of two large terms
+        * - the root closest to 0 is C / q with q = b + sign(b) * sqrt(b^2 - C), the other one is q
         */
 
         Vector c2o = center - ray.org;  // sphere center to ray origin 
         double b = c2o.Dot(ray.dir);
-        double radicant = b*b - c2o.Dot(c2o) + radius*radius;
-        if (radicant < 0.0)
+        Vector l = c2o - ray.dir * b;   // closest point of the ray to the center
+        double discriminant = radius2 - l.Dot(l);
+        if (discriminant < 0.0)
             return 0.0;                 // No intersection  
-        else   
-            radicant = sqrt(radicant);
-        
-        double t = b - radicant;
+
+        double q = b + (b >= 0.0 ? sqrt(discriminant) : -sqrt(discriminant));
+        if (q == 0.0)
+            return 0.0;                 // ray tangent to a sphere centered on its origin
+        double t0 = (c2o.Dot(c2o) - radius2) / q;
+
+        double t = fmin(t0, q);
         if(t > eps)
             return t;
         
-        t = b + radicant;
+        t = fmax(t0, q);
         if(t > eps)
             return t;
         
         return 0.0;                     // No intersection in ray direction
     }
+
+    bvh::AABB Bounds() const
+    {
+        return bvh::AABB::FromDoubles(center.x - radius, center.y - radius, center.z - radius,
+                                      center.x + radius, center.y + radius, center.z + radius);
+    }
 };
 
 
@@ -218,117 +284,143 @@ class Triangle : public Primitive
 {
 public:
     Vector p0;
-    Vector p1;
-    Vector p2;
-    Vector edge_a, edge_b;
-    Vector normal;
-
-    double a_len, b_len;    // Edge lengths
+    Vector edge_a, edge_b;  // p1 - p0 and p2 - p0, precomputed for the intersection test
+    Vector normal;          // unit normal
 
     Triangle(const Vector p0_, const Vector &a_, const Vector &b_, const Color &emission_, const Color &color_) 
         : p0(p0_), edge_a(a_), edge_b(b_), Primitive(emission_, color_, DIFF) 
     {
         normal = edge_a.Cross(edge_b);
         normal = normal.Normalized();        
-        a_len = edge_a.Length();
-        b_len = edge_b.Length();
-        p1 = p0 + edge_a;
-        p2 = p0 + edge_b;
     }
 
 
-    // Triangle-ray intersection 
-    const double Intersect(const Ray &ray) 
+    /*
+     * Triangle-ray intersection (Moller-Trumbore)
+     * Solves  org + t*dir = (1-u-v)*p0 + u*p1 + v*p2  with Cramer's rule,
+     * all determinants share the scalar triple product det = edge_a.(dir x edge_b),
+     * so a single division is needed.
+     * Returns t (0.0 if no intersection) and the barycentric coords (u, v) of the hitpoint,
+     * used to interpolate vertex attributes (1-u-v, u and v are the weights of p0, p1 and p2)
+     */
+    const double Intersect(const Ray &ray, double &u, double &v) const
     {
-        // 1. Check for plane-ray intersection
-        const double t = (p0 - ray.org).Dot(normal) / ray.dir.Dot(normal);
-        if (t <= eps)
+        const Vector pvec = ray.dir.Cross(edge_b);
+        const double det = edge_a.Dot(pvec);
+
+        // ray parallel to the triangle plane (or degenerate triangle)
+        if (fabs(det) < 1e-12)
             return 0.0;
+        const double invDet = 1.0 / det;
 
-        // q = plane-ray intersection
-        Vector q = ray.org + ray.dir * t;
-
-
-        /* 2. Determine if p is within triangle
-         * Compute barycentric coords (lambda0, lambda1, lambda2 = 1 - lambda0 - lambda1)
-         * and check that they are in the [0,1] range
-         * Solving : q = lambda0*p0 + lambda1*p1 + (1-lambda0-lambda1)*p2
-         *
-         * system:       q_x = lambda0*p0_x + lambda1*p1_x + (1-lambda0-lambda1)*p2_x
-         *               q_y = lambda0*p0_y + lambda1*p1_y + (1-lambda0-lambda1)*p2_y
-         *               q_z = lambda0*p0_z + lambda1*p1_z + (1-lambda0-lambda1)*p2_z
-         *           
-         *  ->           q_x = lambda0(p0_x - p2_x) + lambda1(p1_x - p2_x) + p2_x
-         *               q_y = lambda0(p0_y - p2_y) + lambda1(p1_y - p2_y) + p2_y
-         *
-         *  ->           lambda0(p0_x - p2_x) + lambda1(p1_x - p2_x) = q_x - p2_x
-         *               lambda0(p0_y - p2_y) + lambda1(p1_y - p2_y) = q_y - p2_y
-         *
-         *  matrix form: |(p0_x - p2_x)  (p1_x - p2_x)| . |lambda0| = |q_x - p2_x|
-         *               |(p0_y - p2_y)  (p1_y - p2_y)|   |lambda1|   |q_y - p2_y|
-         *                          = matrix T
-         *
-         *  ->           |lambda0| = (1/detT)|(p1_y - p2_y)  (p2_x - p1_x)| . |q_x - p2_x|
-         *               |lambda1|          |(p2_y - p0_y)  (p0_x - p2_x)|    |q_y - p2_y|
-         *
-         *  ->           lambda0 = (1/detT) * ((p1_y - p2_y)*(q_x - p2_x) + (p2_x - p1_x)*(q_x - p2_x))
-         *               lambda1=  (1/detT) * ((p2_y - p0_y)*(q_y - p2_y) + (p0_x - p2_x)*(q_y - p2_y))
-         * with:         detT = (p0_x-p2_x)*(p1_y-p2_y) - (p0_y-p2_y)*(p1_x-p2_x)
-         *
-         * If some coords are identical, use the third line of the system
-         */
-        
-        double lambda_0 = ( (p1.y-p2.y)*(q.x-p2.x) + (p2.x-p1.x)*(q.y-p2.y) ) / ( (p0.x-p2.x)*(p1.y-p2.y) - (p0.y-p2.y)*(p1.x-p2.x) );
-        double lambda_1 = ( (p2.y-p0.y)*(q.x-p2.x) + (p0.x-p2.x)*(q.y-p2.y) ) / ( (p0.x-p2.x)*(p1.y-p2.y) - (p0.y-p2.y)*(p1.x-p2.x) );
-        
-        if( (p0.z == p2.z) && (p1.z == p2.z) )
-        {
-            lambda_0 = ( (p1.y-p2.y)*(q.x-p2.x) + (p2.x-p1.x)*(q.y-p2.y) ) / ( (p0.x-p2.x)*(p1.y-p2.y) - (p0.y-p2.y)*(p1.x-p2.x) );
-            lambda_1 = ( (p2.y-p0.y)*(q.x-p2.x) + (p0.x-p2.x)*(q.y-p2.y) ) / ( (p0.x-p2.x)*(p1.y-p2.y) - (p0.y-p2.y)*(p1.x-p2.x) );
-        }
-        else if( (p0.x == p2.x) && (p1.x == p2.x) )
-        {
-            lambda_0 = ( (p1.z-p2.z)*(q.y-p2.y) + (p2.y-p1.y)*(q.z-p2.z) ) / ( (p0.y-p2.y)*(p1.z-p2.z) - (p0.z-p2.z)*(p1.y-p2.y) );
-            lambda_1 = ( (p2.z-p0.z)*(q.y-p2.y) + (p0.y-p2.y)*(q.z-p2.z) ) / ( (p0.y-p2.y)*(p1.z-p2.z) - (p0.z-p2.z)*(p1.y-p2.y) );
-        }
-        else if( (p0.y == p2.y) && (p1.y == p2.y) )
-        {
-            lambda_0 = ( (p1.z-p2.z)*(q.x-p2.x) + (p2.x-p1.x)*(q.z-p2.z) ) / ( (p0.x-p2.x)*(p1.z-p2.z) - (p0.z-p2.z)*(p1.x-p2.x) );
-            lambda_1 = ( (p2.z-p0.z)*(q.x-p2.x) + (p0.x-p2.x)*(q.z-p2.z) ) / ( (p0.x-p2.x)*(p1.z-p2.z) - (p0.z-p2.z)*(p1.x-p2.x) );
-        }
-
-        double lambda_2 = 1.0 - lambda_0 - lambda_1;
-
-        if( (lambda_0 > 1.0) || (lambda_0  < 0.0) || (lambda_1 > 1.0) || (lambda_1  < 0.0) || (lambda_2 > 1.0) || (lambda_2  < 0.0) )
+        const Vector tvec = ray.org - p0;
+        const Vector qvec = tvec.Cross(edge_a);
+        u = tvec.Dot(pvec) * invDet;
+        v = ray.dir.Dot(qvec) * invDet;
+        const double t = edge_b.Dot(qvec) * invDet;
+
+        // hitpoint inside the triangle and in front of the ray origin, tested at once
+        const bool isHit = (u >= 0.0) & (v >= 0.0) & (u + v <= 1.0) & (t > eps);
+        return isHit ? t : 0.0;
+    }
+
+    const double Intersect(const Ray &ray) const
+    {
+        double u, v;
+        return Intersect(ray, u, v);
+    }
+
+    bvh::AABB Bounds() const
+    {
+        const Vector p1 = p0 + edge_a;
+        const Vector p2 = p0 + edge_b;
+        return bvh::AABB::FromDoubles(fmin(p0.x, fmin(p1.x, p2.x)), fmin(p0.y, fmin(p1.y, p2.y)), fmin(p0.z, fmin(p1.z, p2.z)),
+                                      fmax(p0.x, fmax(p1.x, p2.x)), fmax(p0.y, fmax(p1.y, p2.y)), fmax(p0.z, fmax(p1.z, p2.z)));
+    }
+};
+
+
+/*
+ * Quad geometry: parallelogram p0, p0 + edge_a, p0 + edge_a + edge_b, p0 + edge_b
+ * (diffuse, e.g. the walls of the sphere scene)
+ */
+class Quad : public Primitive
+{
+public:
+    Vector p0;
+    Vector edge_a, edge_b;
+    Vector normal;          // unit normal
+
+    Quad(const Vector p0_, const Vector &a_, const Vector &b_, const Color &emission_, const Color &color_)
+        : Primitive(emission_, color_, DIFF), p0(p0_), edge_a(a_), edge_b(b_)
+    {
+        normal = edge_a.Cross(edge_b);
+        normal = normal.Normalized();
+    }
+
+    /*
+     * Same test as Triangle::Intersect() (Moller-Trumbore),
+     * the hitpoint is inside the quad if both coords u, v along the edges are in [0, 1]
+     */
+    const double Intersect(const Ray &ray) const
+    {
+        const Vector pvec = ray.dir.Cross(edge_b);
+        const double det = edge_a.Dot(pvec);
+
+        // ray parallel to the quad plane (or degenerate quad)
+        if (fabs(det) < 1e-12)
             return 0.0;
+        const double invDet = 1.0 / det;
 
-        return t;
+        const Vector tvec = ray.org - p0;
+        const Vector qvec = tvec.Cross(edge_a);
+        const double u = tvec.Dot(pvec) * invDet;
+        const double v = ray.dir.Dot(qvec) * invDet;
+        const double t = edge_b.Dot(qvec) * invDet;
 
-    }  
+        const bool isHit = (u >= 0.0) & (u <= 1.0) & (v >= 0.0) & (v <= 1.0) & (t > eps);
+        return isHit ? t : 0.0;
+    }
 };
 
 
 /*
- * Hard-coded scene definition: the geometry is composed of spheres
- * (i.e. Cornell box walls are part of very large spheres). 
+ * Hard-coded scene definition: the geometry is composed of spheres,
+ * inside a Cornell box made of quads (cf. quads below).
  * These are defined by:
  * - radius, center 
  * - emitted light (light sources), surface reflectivity (~color), material
  */
 std::vector<Sphere> spheres = 
 {
-    Sphere( 1e5, Vector( 1e5  +1,      40.8,      81.6),  Vector(), Vector(.75,.25,.25), DIFF), /* Left wall */
-    Sphere( 1e5, Vector(-1e5 +99,      40.8,      81.6),  Vector(), Vector(.25,.25,.75), DIFF), /* Rght wall */
-    Sphere( 1e5, Vector(      50,      40.8,       1e5),  Vector(), Vector(.75,.75,.75), DIFF), /* Back wall */
-    Sphere( 1e5, Vector(      50,      40.8, -1e5 +170),  Vector(), Vector(),            DIFF), /* Front wall */
-    Sphere( 1e5, Vector(      50,       1e5,      81.6),  Vector(), Vector(.75,.75,.75), DIFF), /* Floor */
-    Sphere( 1e5, Vector(      50,-1e5 +81.6,      81.6),  Vector(), Vector(.75,.75,.75), DIFF), /* Ceiling */
-
     Sphere(16.5, Vector(27, 16.5, 47), Vector(), Vector(1,1,1)*.999,  SPEC), /* Mirror sphere */
     Sphere(16.5, Vector(73, 16.5, 78), Vector(), Vector(1,1,1)*.999,  REFR), /* Glas sphere */
 };
 
-Sphere LightSource( 1.5, Vector(50, 81.6-16.5, 81.6), Vector(4,4,4)*100, Vector(), DIFF);
+/*
+ * Walls of the sphere scene, box [1, 99] x [0, 81.6] x [0, 170]: exact planes,
+ * where very large spheres lose precision (and only few quads, tested without BVH)
+ */
+std::vector<Quad> quads =
+{
+    Quad(Vector( 1.0,  0.0,   0.0), Vector( 0.0, 81.6, 0.0), Vector(0.0,  0.0, 170.0), Vector(), Color(.75,.25,.25)), /* Left wall */
+    Quad(Vector(99.0,  0.0,   0.0), Vector( 0.0, 81.6, 0.0), Vector(0.0,  0.0, 170.0), Vector(), Color(.25,.25,.75)), /* Rght wall */
+    Quad(Vector( 1.0,  0.0,   0.0), Vector(98.0,  0.0, 0.0), Vector(0.0, 81.6,   0.0), Vector(), Color(.75,.75,.75)), /* Back wall */
+    Quad(Vector( 1.0,  0.0, 170.0), Vector(98.0,  0.0, 0.0), Vector(0.0, 81.6,   0.0), Vector(), Color()),            /* Front wall */
+    Quad(Vector( 1.0,  0.0,   0.0), Vector(98.0,  0.0, 0.0), Vector(0.0,  0.0, 170.0), Vector(), Color(.75,.75,.75)), /* Floor */
+    Quad(Vector( 1.0, 81.6,   0.0), Vector(98.0,  0.0, 0.0), Vector(0.0,  0.0, 170.0), Vector(), Color(.75,.75,.75)), /* Ceiling */
+};
+
+
+/*
+ * Light sources: spheres sampled explicitly from diffuse surfaces (one light
+ * picked per bounce, proportionally to its power), and hit by the paths;
+ * they only emit light and are not part of the scene BVHs
+ */
+std::vector<Sphere> lights =
+{
+    Sphere( 1.5, Vector(50, 81.6-16.5, 81.6), Vector(4,4,4)*100, Vector(), DIFF), /* Ceiling light */
+};
 
 
 /*
@@ -403,3 +495,5 @@ std::vector<Triangle> triangles =
 
 
 } //namespace pathTracing
+
+#endif // RAY_TRACER_UTILS_H
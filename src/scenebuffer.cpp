@@ -0,0 +1,400 @@
+/*********************************************************************************************************************
+ *
+ * scenebuffer.cpp
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#include "scenebuffer.h"
+#include "ray_tracer/aliastable.h"
+
+#include <algorithm>
+
+// traversal stacks of the shaders are sized for the deepest tree built by bvh::Build()
+static_assert(bvh::MAX_DEPTH + 1 == 32, "BVH_STACK_SIZE in rtCommon.glsl must be bvh::MAX_DEPTH + 1");
+
+
+SceneBuffer::SceneBuffer()
+    : m_ssbo(0), m_capacity(0), m_dirtyBegin(0), m_dirtyEnd(0), m_hasChanged(false), m_geometryChanged(false)
+    , m_ssboTriangles(0), m_trianglesChanged(false)
+    , m_materials({ Material(MATERIAL_DIFFUSE) }), m_ssboMaterials(0), m_materialsChanged(true)
+    , m_ssboLights(0)
+    , m_ssboBVHNodes(0), m_ssboBVHIndices(0)
+{
+}
+
+
+SceneBuffer::~SceneBuffer()
+{
+    glDeleteBuffers(1, &m_ssbo);
+    glDeleteBuffers(1, &m_ssboTriangles);
+    glDeleteBuffers(1, &m_ssboMaterials);
+    glDeleteBuffers(1, &m_ssboLights);
+    glDeleteBuffers(1, &m_ssboBVHNodes);
+    glDeleteBuffers(1, &m_ssboBVHIndices);
+}
+
+
+void SceneBuffer::createSpheresSSBO(const std::vector<Sphere>& _spheres)
+{
+    m_spheres = _spheres;
+
+    // Create and allocate SSBO
+    reserve(std::max(m_spheres.size(), (size_t)16));
+
+    // Populate SSBO with spheres
+    markDirty(0, m_spheres.size());
+    upload();
+}
+
+
+int SceneBuffer::addSphere(const Sphere& _sphere)
+{
+    m_spheres.push_back(_sphere);
+    markDirty(m_spheres.size() - 1, m_spheres.size());
+
+    return (int)m_spheres.size() - 1;
+}
+
+
+void SceneBuffer::removeSphere(int _id)
+{
+    if(_id < 0 || _id >= (int)m_spheres.size())
+    {
+        std::cerr << "[ERROR] SceneBuffer::removeSphere(): invalid sphere index " << _id << std::endl;
+        return;
+    }
+
+    m_spheres.erase(m_spheres.begin() + _id);
+
+    // following spheres are shifted, stale data after the last sphere is simply ignored by the shader
+    markDirty(_id, m_spheres.size());
+    m_hasChanged = true;
+}
+
+
+void SceneBuffer::updateSphere(int _id, const Sphere& _sphere)
+{
+    if(_id < 0 || _id >= (int)m_spheres.size())
+    {
+        std::cerr << "[ERROR] SceneBuffer::updateSphere(): invalid sphere index " << _id << std::endl;
+        return;
+    }
+
+    m_spheres[_id] = _sphere;
+    markDirty(_id, _id + 1);
+}
+
+
+int SceneBuffer::addMesh(const std::vector<glm::vec3>& _vertices, const std::vector<uint32_t>& _indices, const glm::vec3& _color,
+                         GLuint _materialId)
+{
+    int firstId = (int)m_triangles.size();
+
+    m_triangles.reserve(m_triangles.size() + _indices.size() / 3);
+    for(size_t i = 0; i + 2 < _indices.size(); i += 3)
+    {
+        if(_indices[i] >= _vertices.size() || _indices[i + 1] >= _vertices.size() || _indices[i + 2] >= _vertices.size())
+        {
+            std::cerr << "[ERROR] SceneBuffer::addMesh(): invalid vertex index in triangle " << i / 3 << std::endl;
+            continue;
+        }
+        m_triangles.push_back( Triangle(_vertices[_indices[i]], _vertices[_indices[i + 1]], _vertices[_indices[i + 2]], _color, _materialId) );
+    }
+
+    m_trianglesChanged = true;
+    m_hasChanged = true;
+
+    return firstId;
+}
+
+
+int SceneBuffer::addQuad(const glm::vec3& _v0, const glm::vec3& _v1, const glm::vec3& _v2, const glm::vec3& _color, GLuint _materialId)
+{
+    m_triangles.push_back( Triangle(_v0, _v1, _v2, _color, _materialId, true) );
+
+    m_trianglesChanged = true;
+    m_hasChanged = true;
+
+    return (int)m_triangles.size() - 1;
+}
+
+
+void SceneBuffer::clearTriangles()
+{
+    m_triangles.clear();
+    m_trianglesChanged = true;
+    m_hasChanged = true;
+}
+
+
+void SceneBuffer::setMaterials(const std::vector<Material>& _materials)
+{
+    if(_materials.empty())
+    {
+        std::cerr << "[ERROR] SceneBuffer::setMaterials(): the material table cannot be empty" << std::endl;
+        return;
+    }
+
+    m_materials = _materials;
+    m_materialsChanged = true;
+    m_hasChanged = true;
+}
+
+
+void SceneBuffer::updateMaterial(int _id, const Material& _material)
+{
+    if(_id < 0 || _id >= (int)m_materials.size())
+    {
+        std::cerr << "[ERROR] SceneBuffer::updateMaterial(): invalid material index " << _id << std::endl;
+        return;
+    }
+
+    m_materials[_id] = _material;
+    m_materialsChanged = true;
+    m_hasChanged = true;
+}
+
+
+bool SceneBuffer::upload()
+{
+    if(!m_hasChanged)
+        return false;
+
+    // make sure the buffer is large enough before touching it
+    reserve(m_spheres.size());
+
+    // can extend the modified ranges
+    checkMaterials();
+
+    // only send the modified range
+    if(m_dirtyEnd > m_dirtyBegin)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, m_dirtyBegin * sizeof(Sphere),
+                        (m_dirtyEnd - m_dirtyBegin) * sizeof(Sphere), &m_spheres[m_dirtyBegin]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    if(m_trianglesChanged || m_ssboTriangles == 0)
+        uploadTriangles();
+
+    if(m_materialsChanged || m_ssboMaterials == 0)
+        uploadMaterials();
+
+    // light sources depend on the spheres and on the materials
+    uploadLights();
+
+    // material edits (e.g. GUI sliders) keep the hierarchy
+    if(m_geometryChanged || m_trianglesChanged || m_ssboBVHNodes == 0)
+        buildBVH();
+
+    m_dirtyBegin = m_dirtyEnd = 0;
+    m_hasChanged = false;
+    m_geometryChanged = false;
+    m_trianglesChanged = false;
+    m_materialsChanged = false;
+
+    return true;
+}
+
+
+void SceneBuffer::reserve(size_t _capacity)
+{
+    if(_capacity <= m_capacity)
+        return;
+
+    // grow geometrically to keep incremental additions cheap
+    size_t newCapacity = std::max(_capacity, m_capacity * 2);
+
+    GLuint newSSBO;
+    glGenBuffers(1, &newSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, newSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, newCapacity * sizeof(Sphere), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if(m_capacity > 0)
+    {
+        // copy previous content on the GPU side
+        glBindBuffer(GL_COPY_READ_BUFFER, m_ssbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newSSBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, m_capacity * sizeof(Sphere));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &m_ssbo);
+    m_ssbo = newSSBO;
+    m_capacity = newCapacity;
+
+    // Bind SSBO to index 1, which corresponds to buffer SpheresBlock
+    // in compute shader (binding = 1)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_ssbo);
+}
+
+
+void SceneBuffer::markDirty(size_t _begin, size_t _end)
+{
+    if(m_dirtyEnd <= m_dirtyBegin)
+    {
+        m_dirtyBegin = _begin;
+        m_dirtyEnd = _end;
+    }
+    else
+    {
+        m_dirtyBegin = std::min(m_dirtyBegin, _begin);
+        m_dirtyEnd = std::max(m_dirtyEnd, _end);
+    }
+    m_hasChanged = true;
+    m_geometryChanged = true;
+}
+
+
+void SceneBuffer::buildBVH()
+{
+    // spheres first, then triangles
+    std::vector<bvh::AABB> bounds;
+    bounds.reserve(m_spheres.size() + m_triangles.size());
+    for(const Sphere& sphere : m_spheres)
+    {
+        bounds.push_back( bvh::AABB::FromDoubles(sphere.center.x - sphere.radius, sphere.center.y - sphere.radius, sphere.center.z - sphere.radius,
+                                                 sphere.center.x + sphere.radius, sphere.center.y + sphere.radius, sphere.center.z + sphere.radius) );
+    }
+    for(const Triangle& triangle : m_triangles)
+    {
+        glm::vec3 v1 = triangle.v0 + triangle.e1;
+        glm::vec3 v2 = triangle.v0 + triangle.e2;
+        glm::vec3 bboxMin = glm::min(triangle.v0, glm::min(v1, v2));
+        glm::vec3 bboxMax = glm::max(triangle.v0, glm::max(v1, v2));
+        if(triangle.isQuad != 0)
+        {
+            bboxMin = glm::min(bboxMin, v1 + triangle.e2);
+            bboxMax = glm::max(bboxMax, v1 + triangle.e2);
+        }
+        bounds.push_back( bvh::AABB::FromDoubles(bboxMin.x, bboxMin.y, bboxMin.z, bboxMax.x, bboxMax.y, bboxMax.z) );
+    }
+    bvh::Build(bounds, m_bvh);
+
+    // the shader tells primitive types apart with the high bit of leaf indices
+    uint32_t nbSpheres = (uint32_t)m_spheres.size();
+    for(uint32_t& id : m_bvh.primIndices)
+    {
+        if(id >= nbSpheres)
+            id = (id - nbSpheres) | TRIANGLE_FLAG;
+    }
+
+    if(m_ssboBVHNodes == 0)
+    {
+        glGenBuffers(1, &m_ssboBVHNodes);
+        glGenBuffers(1, &m_ssboBVHIndices);
+    }
+
+    // sizes change with the scene: re-allocate both buffers
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboBVHNodes);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_bvh.nodes.size() * sizeof(bvh::Node), m_bvh.nodes.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboBVHIndices);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max((size_t)1, m_bvh.primIndices.size()) * sizeof(uint32_t),
+                 m_bvh.primIndices.empty() ? nullptr : m_bvh.primIndices.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Bind SSBOs to index 3 and 4, which correspond to buffers BVHNodesBlock and BVHIndicesBlock
+    // in compute shader (binding = 3 and binding = 4)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_ssboBVHNodes);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_ssboBVHIndices);
+}
+
+
+void SceneBuffer::uploadTriangles()
+{
+    if(m_ssboTriangles == 0)
+        glGenBuffers(1, &m_ssboTriangles);
+
+    // meshes are added as a whole: re-allocate the buffer (keep at least one element so the binding stays valid)
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboTriangles);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max((size_t)1, m_triangles.size()) * sizeof(Triangle),
+                 m_triangles.empty() ? nullptr : m_triangles.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Bind SSBO to index 5, which corresponds to buffer TrianglesBlock
+    // in compute shader (binding = 5)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_ssboTriangles);
+}
+
+
+void SceneBuffer::checkMaterials()
+{
+    for(size_t i = 0; i < m_spheres.size(); i++)
+    {
+        if(m_spheres[i].materialId >= m_materials.size())
+        {
+            std::cerr << "[WARNING] SceneBuffer::checkMaterials(): sphere " << i << " uses undefined material "
+                      << m_spheres[i].materialId << ", replaced by material 0" << std::endl;
+            m_spheres[i].materialId = 0;
+            markDirty(i, i + 1);
+        }
+    }
+
+    for(size_t i = 0; i < m_triangles.size(); i++)
+    {
+        if(m_triangles[i].materialId >= m_materials.size())
+        {
+            std::cerr << "[WARNING] SceneBuffer::checkMaterials(): triangle " << i << " uses undefined material "
+                      << m_triangles[i].materialId << ", replaced by material 0" << std::endl;
+            m_triangles[i].materialId = 0;
+            m_trianglesChanged = true;
+        }
+    }
+}
+
+
+void SceneBuffer::uploadMaterials()
+{
+    if(m_ssboMaterials == 0)
+        glGenBuffers(1, &m_ssboMaterials);
+
+    // the table is small: re-allocate and send it as a whole
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboMaterials);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_materials.size() * sizeof(Material), m_materials.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Bind SSBO to index 10, which corresponds to buffer MaterialsBlock
+    // in compute shader (binding = 10)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, m_ssboMaterials);
+}
+
+
+void SceneBuffer::uploadLights()
+{
+    std::vector<GLuint> sphereIds;
+    std::vector<double> powers;
+    for(size_t i = 0; i < m_spheres.size(); i++)
+    {
+        const Material& material = m_materials[m_spheres[i].materialId];
+        if(material.type != MATERIAL_LIGHT)
+            continue;
+        double emission = (material.emission.x + material.emission.y + material.emission.z) / 3.0;
+        sphereIds.push_back((GLuint)i);
+        powers.push_back(emission * m_spheres[i].radius2);
+    }
+
+    // the table stays empty if the lights do not emit (nothing to sample)
+    m_lights.clear();
+    alias::AliasTable table;
+    table.Build(powers);
+    for(uint32_t i = 0; i < table.size(); i++)
+        m_lights.push_back({ sphereIds[i], (float)table.pmf[i], (float)table.threshold[i], table.alias[i] });
+
+    if(m_ssboLights == 0)
+        glGenBuffers(1, &m_ssboLights);
+
+    // keep at least one element so the binding stays valid
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboLights);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max((size_t)1, m_lights.size()) * sizeof(LightEntry),
+                 m_lights.empty() ? nullptr : m_lights.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Bind SSBO to index 11, which corresponds to buffer LightsBlock
+    // in compute shader (binding = 11)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, m_ssboLights);
+}
@@ -0,0 +1,264 @@
+/*********************************************************************************************************************
+ *
+ * scenebuffer.h
+ *
+ * GPU storage of the scene geometry
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef SCENEBUFFER_H
+#define SCENEBUFFER_H
+
+
+#include <vector>
+#include <iostream>
+
+#include "utils.h"
+#include "ray_tracer/bvh.h"
+
+
+
+/*!
+* \class SceneBuffer
+* \brief Scene geometry stored in a Shader Storage Buffer Object
+* Keeps a CPU copy of the spheres and only uploads the range modified since last upload.
+* The number of spheres is not fixed at compile time: the SSBO grows when needed.
+* Triangle meshes are stored in a second SSBO, as independent triangles with precomputed edges,
+* along with quads (cf. Triangle::isQuad, e.g. the walls of the Cornell box).
+* Spheres and triangles reference a table of materials (third SSBO), the spheres with a light material
+* are the light sources sampled by the shader, one per bounce picked by an alias table on their power.
+* A BVH (same builder and node layout as the offline renderer) over spheres and triangles is rebuilt
+* when the scene changes, primitives are not reordered: leaves reference them through an index buffer
+* (indices with TRIANGLE_FLAG set refer to triangles).
+*/
+class SceneBuffer
+{
+    public:
+
+        static const uint32_t TRIANGLE_FLAG = 0x80000000u; /*!< high bit of BVH leaf indices referencing a triangle */
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                        CONSTRUCTORS / DESTRUCTORS                                           |
+        +------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn SceneBuffer
+        * \brief Default constructor of SceneBuffer
+        */
+        SceneBuffer();
+
+
+        /*!
+        * \fn ~SceneBuffer
+        * \brief Destructor of SceneBuffer
+        */
+        ~SceneBuffer();
+
+        /*! the buffers are deleted by the destructor: not copyable */
+        SceneBuffer(const SceneBuffer&) = delete;
+        SceneBuffer& operator=(const SceneBuffer&) = delete;
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                              GETTERS/SETTERS                                                |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        inline int getNbSpheres() const { return (int)m_spheres.size(); }
+        inline const Sphere& getSphere(int _id) const { return m_spheres.at(_id); }
+        inline const std::vector<Sphere>& getSpheres() const { return m_spheres; }
+        inline int getNbTriangles() const { return (int)m_triangles.size(); }
+        inline int getNbMaterials() const { return (int)m_materials.size(); }
+        inline const Material& getMaterial(int _id) const { return m_materials.at(_id); }
+        inline const std::vector<Material>& getMaterials() const { return m_materials; }
+        inline int getNbLights() const { return (int)m_lights.size(); }
+        inline const bvh::BVH& getBVH() const { return m_bvh; }
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn createSpheresSSBO
+        * \brief Allocate the SSBO, bind it to index 1 and populate it with a set of spheres
+        * \param _spheres : initial geometry of the scene represented as spheres
+        */
+        void createSpheresSSBO(const std::vector<Sphere>& _spheres);
+
+
+        /*!
+        * \fn addSphere
+        * \brief Append a sphere to the scene (uploaded on next call to upload())
+        * \param _sphere : sphere to add
+        * \return index of the new sphere
+        */
+        int addSphere(const Sphere& _sphere);
+
+
+        /*!
+        * \fn removeSphere
+        * \brief Remove a sphere from the scene, following spheres are shifted (order is preserved)
+        * \param _id : index of the sphere to remove
+        */
+        void removeSphere(int _id);
+
+
+        /*!
+        * \fn updateSphere
+        * \brief Replace a sphere of the scene (uploaded on next call to upload())
+        * \param _id : index of the sphere to modify
+        * \param _sphere : new sphere values
+        */
+        void updateSphere(int _id, const Sphere& _sphere);
+
+
+        /*!
+        * \fn addMesh
+        * \brief Append the triangles of an indexed mesh to the scene (uploaded on next call to upload())
+        * \param _vertices : vertex positions
+        * \param _indices : triangle list (3 indices per triangle)
+        * \param _color : albedo of the whole mesh
+        * \param _materialId : material of the whole mesh
+        * \return index of the first triangle of the mesh
+        */
+        int addMesh(const std::vector<glm::vec3>& _vertices, const std::vector<uint32_t>& _indices, const glm::vec3& _color,
+                    GLuint _materialId = 0);
+
+
+        /*!
+        * \fn addQuad
+        * \brief Append a quad (parallelogram) to the scene, stored with the triangles (uploaded on next call to upload())
+        * \param _v0 : first corner
+        * \param _v1, _v2 : corners adjacent to _v0 (the last one is _v1 + _v2 - _v0)
+        * \param _color : albedo
+        * \param _materialId : material
+        * \return index of the quad in the triangles
+        */
+        int addQuad(const glm::vec3& _v0, const glm::vec3& _v1, const glm::vec3& _v2, const glm::vec3& _color, GLuint _materialId = 0);
+
+
+        /*!
+        * \fn setMaterials
+        * \brief Replace the material table (uploaded on next call to upload())
+        * \param _materials : materials referenced by Sphere::materialId and Triangle::materialId
+        */
+        void setMaterials(const std::vector<Material>& _materials);
+
+
+        /*!
+        * \fn updateMaterial
+        * \brief Replace a material of the table (uploaded on next call to upload())
+        * \param _id : index of the material to modify
+        * \param _material : new material values
+        */
+        void updateMaterial(int _id, const Material& _material);
+
+
+        /*!
+        * \fn clearTriangles
+        * \brief Remove all the triangles from the scene (spheres are kept)
+        */
+        void clearTriangles();
+
+
+        /*!
+        * \fn upload
+        * \brief Send the modified range of spheres to the GPU, the materials and the rebuilt BVH
+        * \return true if the scene changed since last upload
+        */
+        bool upload();
+
+
+    protected:
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                                ATTRIBUTES                                                   |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        std::vector<Sphere> m_spheres;  /*!< CPU copy of the scene geometry */
+
+        GLuint m_ssbo;                  /*!< Sphere geometry Shader Storage Buffer Object */
+        size_t m_capacity;              /*!< number of spheres the SSBO can store */
+
+        size_t m_dirtyBegin;            /*!< first sphere modified since last upload */
+        size_t m_dirtyEnd;              /*!< last sphere modified since last upload (excluded) */
+        bool m_hasChanged;              /*!< true if the scene changed since last upload (including removal at the end) */
+        bool m_geometryChanged;         /*!< true if spheres were added, removed or modified since last upload (BVH rebuild) */
+
+        std::vector<Triangle> m_triangles; /*!< CPU copy of the triangle meshes */
+        GLuint m_ssboTriangles;         /*!< Triangle geometry Shader Storage Buffer Object */
+        bool m_trianglesChanged;        /*!< true if triangles were added or removed since last upload */
+
+        std::vector<Material> m_materials; /*!< CPU copy of the material table */
+        GLuint m_ssboMaterials;         /*!< Material table Shader Storage Buffer Object */
+        bool m_materialsChanged;        /*!< true if the material table changed since last upload */
+
+        std::vector<LightEntry> m_lights; /*!< spheres with a light material and their alias table */
+        GLuint m_ssboLights;            /*!< Light sources Shader Storage Buffer Object */
+
+        bvh::BVH m_bvh;                 /*!< bounding volume hierarchy over spheres and triangles */
+        GLuint m_ssboBVHNodes;          /*!< BVH nodes Shader Storage Buffer Object */
+        GLuint m_ssboBVHIndices;        /*!< BVH leaves to primitive indices Shader Storage Buffer Object */
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn reserve
+        * \brief Grow the SSBO so it can store at least _capacity spheres (previous content is kept)
+        * \param _capacity : required number of spheres
+        */
+        void reserve(size_t _capacity);
+
+
+        /*!
+        * \fn markDirty
+        * \brief Extend the range of spheres to upload
+        * \param _begin : first modified sphere
+        * \param _end : last modified sphere (excluded)
+        */
+        void markDirty(size_t _begin, size_t _end);
+
+
+        /*!
+        * \fn buildBVH
+        * \brief Rebuild the BVH over all the primitives and upload it (nodes to index 3, primitive indices to index 4)
+        */
+        void buildBVH();
+
+
+        /*!
+        * \fn uploadTriangles
+        * \brief Re-allocate the triangle SSBO, send all the triangles and bind it to index 5
+        */
+        void uploadTriangles();
+
+
+        /*!
+        * \fn checkMaterials
+        * \brief Replace undefined material indices by material 0
+        */
+        void checkMaterials();
+
+
+        /*!
+        * \fn uploadMaterials
+        * \brief Re-allocate the material SSBO, send the table and bind it to index 10
+        */
+        void uploadMaterials();
+
+
+        /*!
+        * \fn uploadLights
+        * \brief Gather the spheres with a light material, build their alias table (power: mean emission times squared radius),
+        * re-allocate the light SSBO, send the table and bind it to index 11
+        */
+        void uploadLights();
+
+};
+#endif // SCENEBUFFER_H
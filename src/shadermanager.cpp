@@ -0,0 +1,413 @@
+/*********************************************************************************************************************
+ *
+ * shadermanager.cpp
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#include "shadermanager.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+
+// GL_COMPLETION_STATUS_KHR, same value as GL_COMPLETION_STATUS_ARB
+const GLenum COMPLETION_STATUS = 0x91B1;
+
+// header of the cache files, followed by the program binary
+struct ProgramBinaryHeader
+{
+    char magic[4];          // "RCPB"
+    GLenum format;          // binary format (driver specific)
+    uint64_t key;           // cache key, also in the file name
+    uint32_t length;        // size of the binary in bytes
+    uint32_t pad;
+};
+
+
+// 64 bits FNV-1a hash
+static uint64_t hashString(const std::string& _str, uint64_t _hash = 14695981039346656037ull)
+{
+    for(unsigned char c : _str)
+    {
+        _hash ^= c;
+        _hash *= 1099511628211ull;
+    }
+    return _hash;
+}
+
+
+static const char* getShaderTypeName(GLenum _type)
+{
+    switch(_type)
+    {
+        case GL_COMPUTE_SHADER:  return "Compute";
+        case GL_VERTEX_SHADER:   return "Vertex";
+        case GL_FRAGMENT_SHADER: return "Fragment";
+        default:                 return "Unknown";
+    }
+}
+
+
+ShaderManager::ShaderManager(const std::string& _cacheDir)
+    : m_cacheDir(_cacheDir), m_isParallelCompile(false), m_isHotReloadOn(false)
+    , m_lastPoll(std::chrono::steady_clock::now()), m_nbCacheHits(0), m_nbCompiled(0)
+{
+    m_driverId = std::string((const char*)glGetString(GL_VENDOR)) + "\n" + (const char*)glGetString(GL_RENDERER) + "\n"
+               + (const char*)glGetString(GL_VERSION) + "\n" + (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION) + "\n";
+
+    // binaries cannot be read back without any binary format
+    GLint nbBinaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nbBinaryFormats);
+    if(nbBinaryFormats <= 0 && !m_cacheDir.empty())
+    {
+        std::cerr << "[WARNING] ShaderManager::ShaderManager(): program binaries not supported by the driver, cache disabled" << std::endl;
+        m_cacheDir.clear();
+    }
+
+    // let the driver choose its number of compiler threads
+#ifdef GL_KHR_parallel_shader_compile
+    if(GLEW_KHR_parallel_shader_compile)
+    {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+        m_isParallelCompile = true;
+    }
+#endif
+#ifdef GL_ARB_parallel_shader_compile
+    if(!m_isParallelCompile && GLEW_ARB_parallel_shader_compile)
+    {
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+        m_isParallelCompile = true;
+    }
+#endif
+}
+
+
+ShaderManager::~ShaderManager()
+{
+    for(Build& build : m_pendingBuilds)
+        cancelBuild(build);
+}
+
+
+GLuint ShaderManager::buildProgram(const std::vector<ShaderStage>& _stages)
+{
+    Build build = startBuild(_stages);
+    finishBuild(build);
+    return build.program;
+}
+
+
+void ShaderManager::addProgram(GLuint& _program, const std::vector<ShaderStage>& _stages)
+{
+    Build build = startBuild(_stages);
+    finishBuild(build);
+    _program = build.program;
+
+    // watched even if compilation failed, so that fixing the shader loads it
+    m_programs.push_back( { &_program, _stages, build.files } );
+    watchFiles(build.files);
+}
+
+
+void ShaderManager::addComputeProgram(GLuint& _program, const std::string& _compShaderFilename, const std::string& _defines)
+{
+    addProgram(_program, { { GL_COMPUTE_SHADER, _compShaderFilename, _defines } });
+}
+
+
+void ShaderManager::addShaderProgram(GLuint& _program, const std::string& _vertShaderFilename, const std::string& _fragShaderFilename,
+                                     const std::string& _vertHeader, const std::string& _fragHeader)
+{
+    addProgram(_program, { { GL_VERTEX_SHADER, _vertShaderFilename, _vertHeader }, { GL_FRAGMENT_SHADER, _fragShaderFilename, _fragHeader } });
+}
+
+
+bool ShaderManager::update()
+{
+    bool isSwapped = false;
+
+    // swap the rebuilt programs together, once all of them are complete
+    if(!m_pendingBuilds.empty() && std::all_of(m_pendingBuilds.begin(), m_pendingBuilds.end(),
+                                               [this](const Build& _build) { return isBuildComplete(_build); }))
+    {
+        bool isSuccess = true;
+        for(Build& build : m_pendingBuilds)
+            isSuccess = finishBuild(build) && isSuccess;
+
+        if(isSuccess)
+        {
+            for(Build& build : m_pendingBuilds)
+            {
+                WatchedProgram& watched = m_programs[build.watchedId];
+                if(*watched.program)
+                    glDeleteProgram(*watched.program);
+                *watched.program = build.program;
+                // includes may have changed
+                watched.files = build.files;
+                watchFiles(build.files);
+            }
+            std::cout << "Reloaded " << m_pendingBuilds.size() << " shader program(s)" << std::endl;
+            isSwapped = true;
+        }
+        else
+        {
+            for(Build& build : m_pendingBuilds)
+                cancelBuild(build);
+            std::cerr << "[ERROR] ShaderManager::update(): shader reload failed, current programs are kept" << std::endl;
+        }
+        m_pendingBuilds.clear();
+    }
+
+    if(!m_isHotReloadOn)
+        return isSwapped;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now - m_lastPoll < std::chrono::milliseconds(POLL_INTERVAL_MS))
+        return isSwapped;
+    m_lastPoll = now;
+
+    // files modified since the last poll (a file being written is seen as modified again once done)
+    std::vector<std::string> modifiedFiles;
+    for(auto& [filename, lastTime] : m_fileTimes)
+    {
+        std::error_code error;
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(filename, error);
+        if(!error && time != lastTime)
+        {
+            lastTime = time;
+            modifiedFiles.push_back(filename);
+        }
+    }
+    if(modifiedFiles.empty())
+        return isSwapped;
+
+    // restart the programs still being built (from an earlier modification) with the latest sources,
+    // together with the programs using the modified files
+    std::vector<bool> isRebuilt(m_programs.size(), false);
+    for(Build& build : m_pendingBuilds)
+    {
+        isRebuilt[build.watchedId] = true;
+        cancelBuild(build);
+    }
+    m_pendingBuilds.clear();
+
+    for(size_t i = 0; i < m_programs.size(); i++)
+    {
+        const std::vector<std::string>& files = m_programs[i].files;
+        bool isModified = std::any_of(files.begin(), files.end(), [&modifiedFiles](const std::string& _file)
+                                      { return std::find(modifiedFiles.begin(), modifiedFiles.end(), _file) != modifiedFiles.end(); });
+        if(isModified || isRebuilt[i])
+        {
+            m_pendingBuilds.push_back(startBuild(m_programs[i].stages));
+            m_pendingBuilds.back().watchedId = i;
+        }
+    }
+
+    return isSwapped;
+}
+
+
+ShaderManager::Build ShaderManager::startBuild(const std::vector<ShaderStage>& _stages)
+{
+    Build build;
+
+    // the key covers the preprocessed sources: defines and included files are part of it
+    std::vector<std::string> sources;
+    build.key = hashString(m_driverId);
+    for(const ShaderStage& stage : _stages)
+    {
+        build.files.push_back(stage.filename);
+        sources.push_back(loadShaderSource(stage.filename, stage.defines, &build.files));
+        build.key = hashString(std::to_string(stage.type) + "\n" + sources.back(), build.key);
+    }
+
+    build.program = loadBinary(build.key);
+    if(build.program)
+        return build;
+
+    build.program = glCreateProgram();
+    for(size_t i = 0; i < _stages.size(); i++)
+    {
+        GLuint shader = glCreateShader(_stages[i].type);
+        const char* sourcePtr = sources[i].c_str();
+        glShaderSource(shader, 1, &sourcePtr, nullptr);
+        glCompileShader(shader);
+        glAttachShader(build.program, shader);
+        build.shaders.push_back(shader);
+    }
+    if(isCacheOn())
+        glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    // errors are checked by finishBuild(), so that the compilation can run in the background
+    glLinkProgram(build.program);
+
+    return build;
+}
+
+
+bool ShaderManager::isBuildComplete(const Build& _build) const
+{
+    if(!m_isParallelCompile || _build.shaders.empty())
+        return true;
+
+    GLint isComplete = GL_FALSE;
+    glGetProgramiv(_build.program, COMPLETION_STATUS, &isComplete);
+    return isComplete == GL_TRUE;
+}
+
+
+bool ShaderManager::finishBuild(Build& _build)
+{
+    // loaded from the cache
+    if(_build.shaders.empty())
+    {
+        m_nbCacheHits++;
+        return _build.program != 0;
+    }
+
+    bool isSuccess = true;
+    for(GLuint shader : _build.shaders)
+    {
+        GLint success = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if(!success)
+        {
+            GLint type = 0;
+            glGetShaderiv(shader, GL_SHADER_TYPE, &type);
+            std::cerr << "[ERROR] ShaderManager::finishBuild(): " << getShaderTypeName((GLenum)type) << " shader compilation failed:" << std::endl;
+            showShaderInfoLog(shader);
+            isSuccess = false;
+        }
+    }
+
+    if(isSuccess)
+    {
+        GLint success = 0;
+        glGetProgramiv(_build.program, GL_LINK_STATUS, &success);
+        if(!success)
+        {
+            std::cerr << "[ERROR] ShaderManager::finishBuild(): Linking failed:" << std::endl;
+            showProgramInfoLog(_build.program);
+            isSuccess = false;
+        }
+    }
+
+    if(!isSuccess)
+    {
+        cancelBuild(_build);
+        return false;
+    }
+
+    for(GLuint shader : _build.shaders)
+    {
+        glDetachShader(_build.program, shader);
+        glDeleteShader(shader);
+    }
+    _build.shaders.clear();
+    m_nbCompiled++;
+
+    saveBinary(_build.key, _build.program);
+    return true;
+}
+
+
+void ShaderManager::cancelBuild(Build& _build)
+{
+    for(GLuint shader : _build.shaders)
+        glDeleteShader(shader);
+    _build.shaders.clear();
+    if(_build.program)
+        glDeleteProgram(_build.program);
+    _build.program = 0;
+}
+
+
+void ShaderManager::watchFiles(const std::vector<std::string>& _files)
+{
+    for(const std::string& filename : _files)
+    {
+        if(m_fileTimes.count(filename))
+            continue;
+        std::error_code error;
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(filename, error);
+        if(!error)
+            m_fileTimes[filename] = time;
+    }
+}
+
+
+std::string ShaderManager::getCacheFilename(uint64_t _key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)_key);
+    return m_cacheDir + name;
+}
+
+
+GLuint ShaderManager::loadBinary(uint64_t _key) const
+{
+    if(!isCacheOn())
+        return 0;
+
+    FILE* f = fopen(getCacheFilename(_key).c_str(), "rb");
+    if(!f)
+        return 0;
+
+    ProgramBinaryHeader header = {};
+    std::vector<char> binary;
+    bool isValid = fread(&header, sizeof(header), 1, f) == 1 && std::memcmp(header.magic, "RCPB", 4) == 0 && header.key == _key;
+    if(isValid)
+    {
+        binary.resize(header.length);
+        isValid = header.length > 0 && fread(binary.data(), 1, binary.size(), f) == binary.size();
+    }
+    fclose(f);
+    if(!isValid)
+        return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success)
+    {
+        // e.g. binary of another driver version: compiled again (and overwritten)
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+
+void ShaderManager::saveBinary(uint64_t _key, GLuint _program) const
+{
+    if(!isCacheOn())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+
+    ProgramBinaryHeader header = { { 'R', 'C', 'P', 'B' }, 0, _key, (uint32_t)length, 0 };
+    std::vector<char> binary(length);
+    glGetProgramBinary(_program, length, nullptr, &header.format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(m_cacheDir, error);
+    std::string filename = getCacheFilename(_key);
+    FILE* f = fopen(filename.c_str(), "wb");
+    if(!f)
+    {
+        std::cerr << "[WARNING] ShaderManager::saveBinary(): cannot write " << filename << std::endl;
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(binary.data(), 1, binary.size(), f) == binary.size();
+    fclose(f);
+    // a truncated file would be rejected anyway, but would be read at each start
+    if(!ok)
+        std::remove(filename.c_str());
+}
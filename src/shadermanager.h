@@ -0,0 +1,260 @@
+/*********************************************************************************************************************
+ *
+ * shadermanager.h
+ *
+ * Shader programs: binary cache and hot reload
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef SHADERMANAGER_H
+#define SHADERMANAGER_H
+
+
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <filesystem>
+
+#include "utils.h"
+
+
+
+/*!
+* \struct ShaderStage
+* \brief shader of a program: type, file and preprocessor definitions (inserted after the #version directive)
+*/
+struct ShaderStage
+{
+    GLenum type;            /*!< GL_COMPUTE_SHADER, GL_VERTEX_SHADER, GL_FRAGMENT_SHADER */
+    std::string filename;   /*!< shader file (#include directives are resolved relatively to its directory) */
+    std::string defines;    /*!< specialization defines, or empty */
+};
+
+
+
+/*!
+* \class ShaderManager
+* \brief Builds the shader programs, and rebuilds them when their files change
+* Program binaries (glGetProgramBinary()) are cached in files named after a hash of the preprocessed sources
+* and of the driver (vendor, renderer and version strings): the next runs skip compilation. A binary rejected
+* by the driver (e.g. after an update) is compiled again and replaces the cache file.
+* Hot reload polls the modification time of the shader files and of their includes. The programs using
+* a modified file are rebuilt with KHR/ARB_parallel_shader_compile when available (compilation runs in
+* driver threads, update() only checks for completion), and all of them replace the current ones at once
+* in the same update(), only if they all compiled: the current programs are kept on errors.
+*/
+class ShaderManager
+{
+    public:
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                        CONSTRUCTORS / DESTRUCTORS                                           |
+        +------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn ShaderManager
+        * \brief Constructor of ShaderManager (needs a current GL context)
+        * \param _cacheDir : directory of the program binaries (created at first write, ending with a separator),
+        *                    empty to disable the cache
+        */
+        ShaderManager(const std::string& _cacheDir);
+
+
+        /*!
+        * \fn ~ShaderManager
+        * \brief Destructor of ShaderManager, deletes the programs being rebuilt
+        * (the registered programs belong to the caller)
+        */
+        ~ShaderManager();
+
+        /*! the programs being rebuilt are deleted by the destructor: not copyable */
+        ShaderManager(const ShaderManager&) = delete;
+        ShaderManager& operator=(const ShaderManager&) = delete;
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                              GETTERS/SETTERS                                                |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        inline bool isHotReloadOn() const { return m_isHotReloadOn; }
+        inline void setHotReload(bool _isOn) { m_isHotReloadOn = _isOn; }
+        inline bool isCacheOn() const { return !m_cacheDir.empty(); }
+        /*! number of programs loaded from the cache / compiled since the start */
+        inline int getNbCacheHits() const { return m_nbCacheHits; }
+        inline int getNbCompiled() const { return m_nbCompiled; }
+        inline bool isReloading() const { return !m_pendingBuilds.empty(); }
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn buildProgram
+        * \brief Load a program from the cache, or compile it (blocking)
+        * \param _stages : shaders of the program
+        * \return program, 0 if compilation failed
+        */
+        GLuint buildProgram(const std::vector<ShaderStage>& _stages);
+
+
+        /*!
+        * \fn addProgram
+        * \brief Build a program (cf. buildProgram()) and register it for hot reload
+        * \param _program : handle of the program, replaced by the rebuilt program in update()
+        *                   (must stay at the same address while the manager exists)
+        * \param _stages : shaders of the program
+        */
+        void addProgram(GLuint& _program, const std::vector<ShaderStage>& _stages);
+
+
+        /*!
+        * \fn addComputeProgram
+        * \brief Same as loadCompShaderProgram() with the cache and hot reload (cf. addProgram())
+        * \param _program : handle of the program
+        * \param _compShaderFilename : compute shader filename
+        * \param _defines : optional preprocessor definitions inserted after the #version directive
+        */
+        void addComputeProgram(GLuint& _program, const std::string& _compShaderFilename, const std::string& _defines = "");
+
+
+        /*!
+        * \fn addShaderProgram
+        * \brief Same as loadShaderProgram() with the cache and hot reload (cf. addProgram())
+        * \param _program : handle of the program
+        * \param _vertShaderFilename : vertex shader filename
+        * \param _fragShaderFilename : fragment shader filename
+        * \param _vertHeader : optional header of the vertex shader, inserted after its #version directive
+        * \param _fragHeader : optional header of the fragment shader, inserted after its #version directive
+        */
+        void addShaderProgram(GLuint& _program, const std::string& _vertShaderFilename, const std::string& _fragShaderFilename,
+                              const std::string& _vertHeader = "", const std::string& _fragHeader = "");
+
+
+        /*!
+        * \fn update
+        * \brief Hot reload: swap the rebuilt programs once they are all compiled, and start rebuilding
+        * the programs whose files changed (files are polled every POLL_INTERVAL_MS)
+        * \return true if programs were replaced
+        */
+        bool update();
+
+
+    protected:
+
+        static const int POLL_INTERVAL_MS = 500;    /*!< time between two checks of the shader files */
+
+        /*!
+        * \struct WatchedProgram
+        * \brief program registered for hot reload
+        */
+        struct WatchedProgram
+        {
+            GLuint* program;                    /*!< handle owned by the caller */
+            std::vector<ShaderStage> stages;    /*!< shaders of the program */
+            std::vector<std::string> files;     /*!< shader files and their includes */
+        };
+
+        /*!
+        * \struct Build
+        * \brief program being compiled and linked (or loaded from the cache if shaders is empty)
+        */
+        struct Build
+        {
+            GLuint program = 0;
+            std::vector<GLuint> shaders;        /*!< compiled shaders, deleted once linked */
+            uint64_t key = 0;                   /*!< cache key of the sources */
+            std::vector<std::string> files;     /*!< shader files and their includes */
+            size_t watchedId = 0;               /*!< program replaced by the build (hot reload only) */
+        };
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                                ATTRIBUTES                                                   |
+        +------------------------------------------------------------------------------------------------------------*/
+
+        std::string m_cacheDir;                 /*!< directory of the program binaries, empty if the cache is disabled */
+        std::string m_driverId;                 /*!< vendor, renderer and version strings, part of the cache keys */
+        bool m_isParallelCompile;               /*!< KHR/ARB_parallel_shader_compile is available */
+
+        bool m_isHotReloadOn;                   /*!< poll the shader files in update() */
+        std::vector<WatchedProgram> m_programs; /*!< programs registered for hot reload */
+        std::map<std::string, std::filesystem::file_time_type> m_fileTimes; /*!< last modification time of the watched files */
+        std::chrono::steady_clock::time_point m_lastPoll; /*!< time of the last check of the files */
+        std::vector<Build> m_pendingBuilds;     /*!< programs being rebuilt, swapped all at once */
+
+        int m_nbCacheHits;                      /*!< number of programs loaded from the cache */
+        int m_nbCompiled;                       /*!< number of programs compiled */
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn startBuild
+        * \brief Load a program from the cache, or start its compilation (without waiting for the results)
+        * \param _stages : shaders of the program
+        * \return build to complete with finishBuild()
+        */
+        Build startBuild(const std::vector<ShaderStage>& _stages);
+
+
+        /*!
+        * \fn isBuildComplete
+        * \brief Check if the compilation of a program is complete, without blocking (always true without parallel compilation)
+        */
+        bool isBuildComplete(const Build& _build) const;
+
+
+        /*!
+        * \fn finishBuild
+        * \brief Check the compilation of a program (blocks until it is complete), print its errors
+        * and store its binary in the cache
+        * \param _build : build, its program is deleted if compilation failed
+        * \return false if compilation failed
+        */
+        bool finishBuild(Build& _build);
+
+
+        /*!
+        * \fn cancelBuild
+        * \brief Delete the program and shaders of a build
+        */
+        void cancelBuild(Build& _build);
+
+
+        /*!
+        * \fn watchFiles
+        * \brief Record the modification time of files (untouched if already watched)
+        */
+        void watchFiles(const std::vector<std::string>& _files);
+
+
+        /*!
+        * \fn getCacheFilename
+        * \return cache file of a key
+        */
+        std::string getCacheFilename(uint64_t _key) const;
+
+
+        /*!
+        * \fn loadBinary
+        * \brief Create a program from its cached binary
+        * \return program, 0 if not cached or rejected by the driver
+        */
+        GLuint loadBinary(uint64_t _key) const;
+
+
+        /*!
+        * \fn saveBinary
+        * \brief Write the binary of a linked program in the cache
+        */
+        void saveBinary(uint64_t _key, GLuint _program) const;
+
+};
+#endif // SHADERMANAGER_H
@@ -20,10 +20,20 @@ void main()
 		// final color
 		vec4 color = vec4(1.0f);
 		
-		// fetch image dimensions
+		// fetch image dimensions (can be lower than the window resolution, cf. render scale)
 		ivec2 dims = imageSize(u_screenTex); 
-		//read color from image
-		color.rgb = imageLoad(u_screenTex, ivec2(vert_uv.x * dims.x, vert_uv.y * dims.y) ).rgb; // for image2D input
+		
+		// bilinear upscaling: blend the 4 texels around the fragment (texel centers at half-integer coordinates)
+		// returns the texel itself when image and window have the same resolution
+		vec2 coords = vec2(vert_uv.x * dims.x, vert_uv.y * dims.y) - 0.5;
+		ivec2 p0 = ivec2(floor(coords));
+		vec2 f = coords - vec2(p0);
+		ivec2 maxCoords = dims - ivec2(1);
+		vec3 c00 = imageLoad(u_screenTex, clamp(p0,               ivec2(0), maxCoords) ).rgb;
+		vec3 c10 = imageLoad(u_screenTex, clamp(p0 + ivec2(1, 0), ivec2(0), maxCoords) ).rgb;
+		vec3 c01 = imageLoad(u_screenTex, clamp(p0 + ivec2(0, 1), ivec2(0), maxCoords) ).rgb;
+		vec3 c11 = imageLoad(u_screenTex, clamp(p0 + ivec2(1, 1), ivec2(0), maxCoords) ).rgb;
+		color.rgb = mix( mix(c00, c10, f.x), mix(c01, c11, f.x), f.y );
 		
 		frag_color = color;
 }
@@ -0,0 +1,726 @@
+// ------------------------------------------------------------------------------------------------
+// Scene description and ray tracing functions shared by the compute shaders
+// (rayTrace.comp and the kernels of the wavefront pipeline, wavefront.comp)
+// included with #include "rtCommon.glsl" (cf. resolveShaderIncludes() in utils.h)
+// ------------------------------------------------------------------------------------------------
+
+
+// Per-frame parameters
+// Must be consistent with struct FrameParams defined in utils.h
+// Using binding = 2 allows us to read the buffer bound to index 2 (cf createFrameParamsUBO())
+layout (std140, binding = 2) uniform FrameParams {
+	int u_screenWidth;
+	int u_screenHeight;
+	int u_nbSamples;
+	int u_nbBounces;
+	float u_lightIntensity;
+	uint u_frameIndex;      // number of frames already accumulated (0 to restart accumulation)
+	int u_nbSpheres;        // number of spheres in SpheresBlock
+	int u_nbTriangles;      // number of triangles in TrianglesBlock
+	int u_isGBufferOn;      // write img_gNormalDepth and img_gAlbedo
+	int u_nbLights;         // number of light sources in LightsBlock
+	float u_adaptiveThreshold;  // adaptive sampling: max relative error of a converged pixel (0 for off)
+	int u_adaptiveMinFrames;    // adaptive sampling: frames accumulated before a pixel can converge
+	vec3 u_cameraPosition;      // camera (cf. cameraRay()): center of the image plane
+	float u_cameraFocal;        // distance between the image plane and the eye
+	vec3 u_cameraRight;         // image x axis
+	float u_cameraHalfHeight;   // half height of the image plane
+	vec3 u_cameraDown;          // image y axis
+	float u_cameraPad1;
+	vec3 u_cameraForward;       // viewing direction
+	float u_cameraPad2;
+};
+
+// Material types, must be consistent with enum MaterialType defined in utils.h
+#define MATERIAL_DIFFUSE 0
+#define MATERIAL_MIRROR 1
+#define MATERIAL_GLASS 2
+#define MATERIAL_LIGHT 3
+
+// Material structure
+// Must be consistent with struct Material defined in utils.h (32 bytes)
+struct Material
+{
+	vec3 emission;          // light sources: color of the emitted light
+	uint type;              // MATERIAL_*
+	float ior;              // glass: index of refraction
+	float roughness;        // mirror: blur of the reflection
+	float pad1;
+	float pad2;
+};
+
+// Using binding = 10 allows us to read the buffer bound to index 10 (cf SceneBuffer::uploadMaterials())
+layout (std430, binding = 10) readonly buffer MaterialsBlock {
+	Material materials[];
+};
+
+// Light source: sphere with a MATERIAL_LIGHT material, and its bin of the alias table
+// sampling the lights proportionally to their power (cf. SceneBuffer::checkMaterials(), ray_tracer/aliastable.h)
+// Must be consistent with struct LightEntry defined in utils.h (16 bytes)
+struct Light
+{
+	uint sphereId;          // index in SpheresBlock
+	float pmf;              // probability to pick this light
+	float threshold;        // the bin picks this light below threshold, its alias above
+	uint alias;
+};
+
+// Using binding = 11 allows us to read the buffer bound to index 11 (cf SceneBuffer::uploadLights())
+layout (std430, binding = 11) readonly buffer LightsBlock {
+	Light lights[];
+};
+
+// Sphere structure
+// Must be consistent with struct Sphere defined in utils.h
+struct Sphere
+{
+	// Contains intermediate padding for block alignement
+    // cf. https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL
+  	vec3 center;
+	uint materialId;        // index in MaterialsBlock
+	vec3 color;
+	float invRadius;        // 1 / radius
+	float radius;
+	float radius2;          // radius * radius
+	float pad4;
+	float pad5;
+};
+
+// Shader Storage Buffer Object layout
+// Using binding = 1 allows us to read the buffer bound to index 1 (cf SceneBuffer::createSpheresSSBO())
+// The array is unsized: the buffer can be larger than the scene, u_nbSpheres gives the actual count
+// Using std430 memory layout requires to add padding values in Sphere struct attributes
+layout (std430, binding = 1) readonly buffer SpheresBlock {
+	Sphere spheres[];
+};
+
+
+// Triangle structure
+// Must be consistent with struct Triangle defined in utils.h
+// Edges are precomputed (e1 = v1 - v0, e2 = v2 - v0), albedo is packed as RGBA8 (48 bytes per triangle)
+// Quads (parallelograms v0, v1, v1 + v2 - v0, v2) use the same record
+struct Triangle
+{
+	vec3 v0;
+	uint color;
+	vec3 e1;
+	uint materialId;
+	vec3 e2;
+	uint isQuad;            // 1 for a quad
+};
+
+// Using binding = 5 allows us to read the buffer bound to index 5 (cf SceneBuffer::uploadTriangles())
+layout (std430, binding = 5) readonly buffer TrianglesBlock {
+	Triangle triangles[];
+};
+
+
+// Bounding Volume Hierarchy over spheres and triangles (cf SceneBuffer::buildBVH())
+// Must be consistent with struct bvh::Node defined in ray_tracer/bvh.h (32 bytes, std430 packs each uint after its vec3)
+// - interior node (count == 0): children are nodes leftFirst and leftFirst + 1
+// - leaf (count > 0): primitive indices bvhIndices[leftFirst] to bvhIndices[leftFirst + count - 1]
+//   (sphere index, or triangle index with TRIANGLE_FLAG set)
+struct BVHNode
+{
+	vec3 bboxMin;
+	uint leftFirst;
+	vec3 bboxMax;
+	uint count;
+};
+
+layout (std430, binding = 3) readonly buffer BVHNodesBlock {
+	BVHNode bvhNodes[];
+};
+
+layout (std430, binding = 4) readonly buffer BVHIndicesBlock {
+	uint bvhIndices[];
+};
+
+
+// Must be consistent with SceneBuffer::TRIANGLE_FLAG
+#define TRIANGLE_FLAG 0x80000000u
+
+// Size of the traversal stacks, must be bvh::MAX_DEPTH + 1 (ray_tracer/bvh.h):
+// the builder bounds the depth of the tree, so the stacks never overflow
+#define BVH_STACK_SIZE 32
+
+// distance returned by intersectNode() when a box is missed
+const float NO_HIT = 1e30;
+
+
+// light source sampled at the current bounce (cf. selectLight())
+vec3 lightPos;
+int lightSphereId = -1;     // -1 if the scene has no light
+float lightPmf = 1.0;       // probability of picking it
+
+float eps = 1e-4;
+
+// offset of the origin of the rays leaving a surface, along its normal (avoids self-intersections)
+const float RAY_OFFSET = 1e-3;
+
+
+const float PI = 3.14159265359;
+
+
+
+
+
+// Calculate if there is a ray/sphere intersection and return factor t 
+// intesection x = _rayOrig + t * _rayDir
+float hasIntersect(vec3 _rayOrig, vec3 _rayDir, uint _sphereId)
+{
+	// Check for ray-sphere intersection by solving for t (_rayDir is normalized):
+	//       	t^2 - 2 * t * (c2o).d + (c2o).(c2o) - R^2 = 0
+	//
+	// in the numerically stable form of Hearn and Baker (cf. Haines et al., "Precision Improvements
+	// for Ray/Sphere Intersection", Ray Tracing Gems 2019):
+	// - the discriminant R^2 - |c2o - ((c2o).d) d|^2 uses the distance between the sphere center and the ray,
+	//   both terms of ((c2o).d)^2 - ((c2o)^2 - R^2) are large for distant or big spheres and cancel out in float
+	// - the root closest to 0 is c / q with q = (c2o).d + sign * sqrt(discriminant), the other one is q
+	//   (no subtraction of close values either)
+
+	// define vector between  ray origin and sphere center
+	vec3 c2o = spheres[_sphereId].center - _rayOrig;
+	float b = dot(c2o , _rayDir);
+	vec3 l = c2o - b * _rayDir;
+	float radius2 = spheres[_sphereId].radius2;
+
+	float discriminant = radius2 - dot(l, l);
+	if(discriminant < 0.0)
+	{
+		// no intersection
+		return 0.0;
+	}
+
+	float q = b + ((b >= 0.0) ? sqrt(discriminant) : -sqrt(discriminant));
+	if(q == 0.0)
+	{
+		// ray tangent to a sphere centered on its origin
+		return 0.0;
+	}
+	float c = dot(c2o, c2o) - radius2;
+	float t0 = c / q;
+	float tNear = min(t0, q);
+	float tFar = max(t0, q);
+
+	// check smaller root first
+	if(tNear > eps)
+	{
+		return tNear;
+	}
+	// then second root (ray origin inside the sphere)
+	if(tFar > eps)
+	{
+		return tFar;
+	}
+	return 0.0;
+}
+
+
+// Calculate if there is a ray/triangle intersection and return factor t (Moller-Trumbore)
+// intesection x = _rayOrig + t * _rayDir, both faces of the triangle can be hit;
+// a quad only differs by the range of the barycentric coords (u and v in [0, 1])
+float hasIntersectTriangle(vec3 _rayOrig, vec3 _rayDir, uint _triangleId)
+{
+	vec3 e1 = triangles[_triangleId].e1;
+	vec3 e2 = triangles[_triangleId].e2;
+
+	vec3 p = cross(_rayDir, e2);
+	float det = dot(e1, p);
+	// ray parallel to the triangle plane
+	if(abs(det) < 1e-8)
+	{
+		return 0.0;
+	}
+	float invDet = 1.0 / det;
+
+	// barycentric coords of the hitpoint
+	vec3 s = _rayOrig - triangles[_triangleId].v0;
+	float u = dot(s, p) * invDet;
+	if(u < 0.0 || u > 1.0)
+	{
+		return 0.0;
+	}
+	vec3 q = cross(s, e1);
+	float v = dot(_rayDir, q) * invDet;
+	if(v < 0.0 || (triangles[_triangleId].isQuad != 0u ? v : u + v) > 1.0)
+	{
+		return 0.0;
+	}
+
+	float t = dot(e2, q) * invDet;
+	return (t > eps) ? t : 0.0;
+}
+
+
+// Intersection with a primitive referenced by a BVH leaf (sphere or triangle)
+float hasIntersectPrimitive(vec3 _rayOrig, vec3 _rayDir, uint _primId)
+{
+	if((_primId & TRIANGLE_FLAG) != 0u)
+	{
+		return hasIntersectTriangle(_rayOrig, _rayDir, _primId & ~TRIANGLE_FLAG);
+	}
+	return hasIntersect(_rayOrig, _rayDir, _primId);
+}
+
+// BVH traversal ------------------------
+
+// Slab test between a ray and the box of a node
+// returns the entry distance, or NO_HIT if the box is missed or further than _tMax
+float intersectNode(uint _nodeId, vec3 _rayOrig, vec3 _invDir, float _tMax)
+{
+	vec3 t0 = (bvhNodes[_nodeId].bboxMin - _rayOrig) * _invDir;
+	vec3 t1 = (bvhNodes[_nodeId].bboxMax - _rayOrig) * _invDir;
+	vec3 tSmall = min(t0, t1);
+	vec3 tBig = max(t0, t1);
+	float tNear = max(max(tSmall.x, tSmall.y), max(tSmall.z, 0.0));
+	float tFar = min(min(tBig.x, tBig.y), min(tBig.z, _tMax));
+	return tNear <= tFar ? tNear : NO_HIT;
+}
+
+
+// Inverse of the ray direction, avoiding divisions by zero
+vec3 safeInverse(vec3 _dir)
+{
+	vec3 signDir = mix(vec3(1.0), vec3(-1.0), lessThan(_dir, vec3(0.0)));
+	return 1.0 / mix(_dir, signDir * 1e-8, lessThan(abs(_dir), vec3(1e-8)));
+}
+
+
+// Find the closest primitive hit by a ray
+// _minT : in = max distance, out = distance to the closest hit
+// _idSphere, _idTriangle : index of the closest sphere or triangle (the other one is -1)
+// returns true if something was hit
+bool intersectScene(vec3 _rayOrig, vec3 _rayDir, inout float _minT, out int _idSphere, out int _idTriangle)
+{
+	uint idPrim = 0u;
+	bool isHit = false;
+	_idSphere = -1;
+	_idTriangle = -1;
+	vec3 invDir = safeInverse(_rayDir);
+
+	uint stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+
+	// an empty scene has an empty root box
+	if(u_nbSpheres + u_nbTriangles == 0 || intersectNode(0, _rayOrig, invDir, _minT) == NO_HIT)
+	{
+		return false;
+	}
+
+	uint nodeId = 0;
+	while(true)
+	{
+		if(bvhNodes[nodeId].count > 0)
+		{
+			// leaf: test its primitives
+			uint first = bvhNodes[nodeId].leftFirst;
+			uint last = first + bvhNodes[nodeId].count;
+			for(uint i = first; i < last; i++)
+			{
+				float t = hasIntersectPrimitive(_rayOrig, _rayDir, bvhIndices[i]);
+				if(t != 0.0 && t < _minT)
+				{
+					_minT = t;
+					idPrim = bvhIndices[i];
+					isHit = true;
+				}
+			}
+		}
+		else
+		{
+			// interior node: visit closest child first, keep the other one for later
+			uint nearId = bvhNodes[nodeId].leftFirst;
+			uint farId = nearId + 1;
+			float tNear = intersectNode(nearId, _rayOrig, invDir, _minT);
+			float tFar = intersectNode(farId, _rayOrig, invDir, _minT);
+			if(tFar < tNear)
+			{
+				float tTmp = tNear; tNear = tFar; tFar = tTmp;
+				uint idTmp = nearId; nearId = farId; farId = idTmp;
+			}
+
+			if(tNear != NO_HIT)
+			{
+				if(tFar != NO_HIT)
+				{
+					stack[stackSize++] = farId;
+				}
+				nodeId = nearId;
+				continue;
+			}
+		}
+
+		// pop next node, skipping those further than the closest hit found so far
+		bool found = false;
+		while(stackSize > 0 && !found)
+		{
+			nodeId = stack[--stackSize];
+			found = intersectNode(nodeId, _rayOrig, invDir, _minT) != NO_HIT;
+		}
+		if(!found)
+		{
+			break;
+		}
+	}
+
+	if(isHit)
+	{
+		if((idPrim & TRIANGLE_FLAG) != 0u)
+			_idTriangle = int(idPrim & ~TRIANGLE_FLAG);
+		else
+			_idSphere = int(idPrim);
+	}
+	return isHit;
+}
+
+
+// Check if any primitive (except sphere _ignoredId) lies on a ray before distance _maxT
+// returns as soon as an occluder is found (no need for the closest one)
+bool isOccluded(vec3 _rayOrig, vec3 _rayDir, float _maxT, int _ignoredId)
+{
+	vec3 invDir = safeInverse(_rayDir);
+
+	uint stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	if(u_nbSpheres + u_nbTriangles > 0)
+	{
+		stack[stackSize++] = 0;
+	}
+
+	while(stackSize > 0)
+	{
+		uint nodeId = stack[--stackSize];
+		if(intersectNode(nodeId, _rayOrig, invDir, _maxT) == NO_HIT)
+		{
+			continue;
+		}
+
+		if(bvhNodes[nodeId].count > 0)
+		{
+			uint first = bvhNodes[nodeId].leftFirst;
+			uint last = first + bvhNodes[nodeId].count;
+			for(uint i = first; i < last; i++)
+			{
+				if(bvhIndices[i] == uint(_ignoredId))
+				{
+					continue;
+				}
+				float t = hasIntersectPrimitive(_rayOrig, _rayDir, bvhIndices[i]);
+				if(t != 0.0 && t < _maxT)
+				{
+					return true;
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize++] = bvhNodes[nodeId].leftFirst + 1;
+			stack[stackSize++] = bvhNodes[nodeId].leftFirst;
+		}
+	}
+
+	return false;
+}
+
+
+// Pseudo random numbers ------------------------
+// Stateless hash-based generator: no texture fetch nor uniform array,
+// each (pixel, sample, bounce) gets its own decorrelated random sequence.
+// RNG selects how a sequence advances: PCG hash at each number (default), or a cheaper
+// xorshift32 step from the hashed seed (Marsaglia 2003), set when compiling a shader variant.
+#define RNG_PCG 0
+#define RNG_XORSHIFT 1
+#ifndef RNG
+#define RNG RNG_PCG
+#endif
+
+// PCG hash, cf. Jarzynski and Olano, "Hash Functions for GPU Rendering" (JCGT 2020)
+uint pcgHash(uint _v)
+{
+	uint state = _v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// Build a random seed from the pixel coords, the (global) sample index and the bounce index
+uint randomSeed(ivec2 _pixelCoords, int _cptSample, int _cptBounce)
+{
+	return pcgHash( uint(_pixelCoords.x) + pcgHash( uint(_pixelCoords.y) + pcgHash( uint(_cptSample) + pcgHash( uint(_cptBounce) ) ) ) );
+}
+
+// Returns a random float in [0;1[ and advances the seed
+float randomFloat(inout uint _seed)
+{
+#if RNG == RNG_XORSHIFT
+	// 0 is a fixed point of xorshift
+	_seed = max(_seed, 1u);
+	_seed ^= _seed << 13u;
+	_seed ^= _seed >> 17u;
+	_seed ^= _seed << 5u;
+#else
+	_seed = pcgHash(_seed);
+#endif
+	// use the 24 upper bits, which are exactly representable as a float
+	return float(_seed >> 8) * (1.0 / 16777216.0);
+}
+// ------------------------------------------------
+
+
+
+// Camera ray through a point of the image (pixel coords, jittered inside the pixel):
+// rays start on the image plane and converge to the eye, u_cameraFocal behind it
+void cameraRay(vec2 _imagePos, ivec2 _dims, out vec3 _rayOrig, out vec3 _rayDir)
+{
+	// transform pixel coords to normalized coords in image plan (with origin at center)
+	float aspectRatio = float(u_screenWidth) / float(u_screenHeight);
+	float x = (_imagePos.x - 0.5 * float(_dims.x)) / float(_dims.x);
+	float y = (_imagePos.y - 0.5 * float(_dims.y)) / float(_dims.y);
+
+	// map image coords to camera viewport
+	vec3 offset = u_cameraRight * (x * (u_cameraHalfHeight * aspectRatio)) + u_cameraDown * (y * u_cameraHalfHeight);
+	_rayOrig = u_cameraPosition + offset;
+	_rayDir = normalize(offset + u_cameraForward * u_cameraFocal);
+}
+
+
+// Calculate a random reflection vector.
+// Direction of reflection is randomly sampled in a hemisphere around surface normal,
+// with a cosine-weighted distribution (i.e., importance sampling of the Lambertian BRDF).
+vec3 randomReflection(vec3 _normalVec, ivec2 _pixelCoords, int _cptBounce, int _cptSample)
+{
+	uint seed = randomSeed(_pixelCoords, _cptSample, _cptBounce);
+
+	// random polar coords on the unit disk
+	float r1 = 2.0 * PI * randomFloat(seed);
+	float r2 = randomFloat(seed);
+	float r2s = sqrt(r2);
+
+	// set up local orthogonal coordinate system u,v,w on surface
+	vec3 w = _normalVec;
+	vec3 u = normalize( cross( (abs(w.x) > 0.1 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)), w ) );
+	vec3 v = cross(w, u);
+
+	// project disk sample on the hemisphere
+	vec3 sampleVec = u * cos(r1) * r2s + v * sin(r1) * r2s + w * sqrt(1.0 - r2);
+
+	return normalize(sampleVec);
+}
+
+
+// Shading ------------------------
+// The megakernel (rayTrace.comp) and the wavefront kernels (wavefront.comp) share the same estimator:
+// clamped direct light at each bounce, then a new ray depending on the material of the hitpoint
+
+// Material of the primitive hit by a ray (cf. intersectScene())
+uint materialOf(int _idSphere, int _idTriangle)
+{
+	return (_idSphere != -1) ? spheres[_idSphere].materialId : triangles[_idTriangle].materialId;
+}
+
+// Pick the light source of a bounce proportionally to its power in O(1) (alias table),
+// with a random number decorrelated from the one of randomReflection()
+void selectLight(ivec2 _pixelCoords, int _cptBounce, int _cptSample)
+{
+	lightSphereId = -1;
+	lightPmf = 1.0;
+	lightPos = vec3(0.0);
+	if(u_nbLights <= 0)
+	{
+		return;
+	}
+
+	uint bin = 0u;
+	float u = 0.0;
+	if(u_nbLights > 1)
+	{
+		uint seed = randomSeed(_pixelCoords, _cptSample, _cptBounce) ^ 0x68bc21ebu;
+		float x = randomFloat(seed) * float(u_nbLights);
+		bin = min(uint(x), uint(u_nbLights - 1));
+		u = x - float(bin);
+	}
+	uint id = (u < lights[bin].threshold) ? bin : lights[bin].alias;
+
+	lightSphereId = int(lights[id].sphereId);
+	lightPmf = lights[id].pmf;
+	lightPos = spheres[lightSphereId].center;
+}
+
+
+// Position, normal, albedo and light vector at the hitpoint of a ray (cf. intersectScene())
+void hitSurface(vec3 _rayOrig, vec3 _rayDir, float _t, int _idSphere, int _idTriangle,
+                out vec3 _pos, out vec3 _normalVec, out vec3 _albedoColor, out vec3 _lightVec)
+{
+	// hitpoint coords
+	_pos = _rayOrig + _t * _rayDir;
+
+	if(_idSphere != -1)
+	{
+		// get sphere color
+		_albedoColor = spheres[_idSphere].color;
+		// surface normal
+		_normalVec = (_pos - spheres[_idSphere].center) * spheres[_idSphere].invRadius;
+		// light vector
+		_lightVec = normalize(lightPos - spheres[_idSphere].center);
+	}
+	else
+	{
+		// get triangle color
+		_albedoColor = unpackUnorm4x8(triangles[_idTriangle].color).rgb;
+		// geometric normal, facing the incoming ray
+		_normalVec = normalize(cross(triangles[_idTriangle].e1, triangles[_idTriangle].e2));
+		if(dot(_normalVec, _rayDir) > 0.0)
+		{
+			_normalVec = -_normalVec;
+		}
+		// light vector
+		_lightVec = normalize(lightPos - _pos);
+	}
+}
+
+
+// Light received from the light source picked by selectLight() at a hitpoint which is not in shadow,
+// divided by the probability of picking it (sum over all the lights on average)
+vec3 directLight(vec3 _pos, vec3 _normalVec, vec3 _lightVec, vec3 _albedoColor)
+{
+	Sphere light = spheres[lightSphereId];
+	float cos_a_max = sqrt(1.0 - light.radius2 / dot( (_pos - light.center),(_pos - light.center) ) );
+	float omega = 2 * 3.14 * (1 - cos_a_max);
+	vec3 emission = materials[light.materialId].emission;
+
+	// diffusely reflected light from light source; note constant BRDF 1/PI 
+	return clamp( _albedoColor * emission * (u_lightIntensity * dot(_lightVec, _normalVec) * omega) * (1.0/3.14), vec3(0.0), vec3(1.0) ) / lightPmf;
+}
+
+
+// Build the ray leaving a hitpoint
+// _type : type of the material (given separately so that it can be a compile-time constant)
+// _materialId : index of the material, for its parameters
+// _rayOrig, _rayDir : in = incoming ray, out = reflected or refracted ray
+void scatterRay(uint _type, uint _materialId, vec3 _pos, vec3 _normalVec, ivec2 _pixelCoords, int _cptBounce, int _cptSample,
+                inout vec3 _rayOrig, inout vec3 _rayDir)
+{
+	// origin is hitpoint ( add normal offset to avoid shadow acnee)
+	_rayOrig = _pos + RAY_OFFSET * _normalVec;
+
+	if(_type == MATERIAL_MIRROR)
+	{
+		// If the hitpoint belongs to mirror sphere:
+		// perfect reflection (mirror-like)
+		// http://paulbourke.net/geometry/reflected/
+		vec3 reflected = normalize( _rayDir - _normalVec * 2 * dot(_normalVec , _rayDir) );
+
+		// rough mirror: reflection blurred towards a cosine lobe around it, kept above the surface
+		float roughness = materials[_materialId].roughness;
+		if(roughness > 0.0)
+		{
+			vec3 glossy = normalize( mix(reflected, randomReflection(reflected, _pixelCoords, _cptBounce, _cptSample), roughness) );
+			if(dot(glossy, _normalVec) > 0.0)
+			{
+				reflected = glossy;
+			}
+		}
+		_rayDir = reflected;
+	}
+	else if(_type == MATERIAL_GLASS)
+	{
+		vec3 normalInit = _normalVec;
+		vec3 normalVec = _normalVec;
+		bool isEntering = true;
+		if (dot(normalVec, _rayDir) >= 0.0)
+		{
+			// reverse normal when the ray comes from INSIDE the sphere
+			normalVec = -1.0 * normalVec;
+			isEntering = false;
+		}
+
+		// If the hitpoint belongs to transparent sphere:
+		// 1. reflection (mirror-like)
+		vec3 reflec = normalize( _rayDir - normalInit * 2 * dot(normalInit , _rayDir) );
+		// 2. refraction:
+		float nc = 1.0;                        // Index of refraction of air (approximately)
+		float nt = materials[_materialId].ior; // Index of refraction of glass
+		float nnt;
+
+		if(isEntering)      // Set ratio depending on hit from inside or outside 
+			nnt = nc/nt;
+		else
+			nnt = nt/nc;
+
+		float ddn = dot(_rayDir, normalVec);
+		float cos2t = 1 - nnt * nnt * (1 - ddn*ddn);
+
+		// Check for total internal reflection, if so only reflect 
+		if(cos2t < 0.0)
+		{
+			_rayDir = reflec;
+		}
+		else 
+		{
+			// Otherwise reflection and/or refraction occurs 
+			vec3 tdir;
+
+			// Determine transmitted ray direction for refraction 
+			if(isEntering)
+			{
+				_rayOrig = _pos - RAY_OFFSET * normalInit;
+				tdir = normalize(_rayDir * nnt - normalInit * (ddn * nnt + sqrt(cos2t)));
+			}
+			else
+			{
+				_rayOrig = _pos + RAY_OFFSET * normalInit;
+				tdir = normalize(_rayDir * nnt + normalInit * (ddn * nnt + sqrt(cos2t)));
+			}
+
+			_rayDir = tdir;
+		}
+	}
+	else
+	{
+		// Lambertian material (uniform reflection in all direction, simulated by average of several random reflections (Monte-Carlo)
+		_rayDir = randomReflection(_normalVec, _pixelCoords, _cptBounce, _cptSample);
+	}
+}
+
+
+
+// Adaptive sampling ------------------------
+// Statistics of the frames accumulated in a pixel (cf. img_pixelStats, written with the accumulation buffer):
+// x = sum of the luminances of the frames, y = sum of their squares, z = number of frames.
+// A pixel stops receiving samples once the 95% confidence interval of its mean luminance
+// is below u_adaptiveThreshold times the mean, with the same constants as the offline tracer
+// (cf. CONVERGENCE_CONFIDENCE in ray_tracer/pathTracing.cpp for the bound on the mean).
+const float CONVERGENCE_CONFIDENCE = 1.96;
+const float CONVERGENCE_MIN_MEAN = 0.05;
+
+bool isPixelConverged(vec4 _stats)
+{
+	float n = _stats.z;
+	if(u_adaptiveThreshold <= 0.0 || u_frameIndex == 0u || n < float(max(u_adaptiveMinFrames, 2)))
+	{
+		return false;
+	}
+	float mean = _stats.x / n;
+	float variance = max(_stats.y - _stats.x * mean, 0.0) / (n - 1.0);
+	return CONVERGENCE_CONFIDENCE * sqrt(variance / n) <= u_adaptiveThreshold * max(mean, CONVERGENCE_MIN_MEAN);
+}
+
+// Add a new frame of the pixel (average of its u_nbSamples samples) to its statistics
+// (restarted with the accumulation)
+vec4 addFrameStats(vec4 _stats, vec3 _frameColor)
+{
+	if(u_frameIndex == 0u)
+	{
+		_stats = vec4(0.0);
+	}
+	float luminance = dot(clamp(_frameColor, vec3(0.0), vec3(1.0)), vec3(0.2126, 0.7152, 0.0722));
+	return _stats + vec4(luminance, luminance * luminance, 1.0, 0.0);
+}
+
+// Number of frames already accumulated in the pixel, i.e. the blend weight of the new frame is 1 / (n + 1)
+// (u_frameIndex if the pixel never converged)
+float accumulatedFrames(vec4 _stats)
+{
+	return (u_frameIndex == 0u) ? 0.0 : _stats.z;
+}
+// ------------------------------------------------
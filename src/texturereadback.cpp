@@ -0,0 +1,108 @@
+/*********************************************************************************************************************
+ *
+ * texturereadback.cpp
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#include "texturereadback.h"
+
+#include <cstring>
+
+
+TextureReadback::TextureReadback()
+    : m_pbo(0), m_capacity(0), m_fence(nullptr), m_width(0), m_height(0)
+{
+    glGenBuffers(1, &m_pbo);
+}
+
+
+TextureReadback::~TextureReadback()
+{
+    if(m_fence)
+        glDeleteSync(m_fence);
+    glDeleteBuffers(1, &m_pbo);
+}
+
+
+void TextureReadback::start(GLuint _tex, unsigned int _width, unsigned int _height)
+{
+    if(m_fence)
+    {
+        std::cerr << "[ERROR] TextureReadback::start(): previous copy is still pending" << std::endl;
+        return;
+    }
+
+    m_width = _width;
+    m_height = _height;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+    size_t size = (size_t)m_width * m_height * 4;
+    if(size > m_capacity)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        m_capacity = size;
+    }
+
+    // with a PBO bound, glGetTexImage() writes to the buffer (offset 0) and returns without waiting
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, _tex);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // make sure the commands are submitted, so the fence gets signaled even if nothing else is rendered
+    glFlush();
+}
+
+
+bool TextureReadback::isReady()
+{
+    if(!m_fence)
+        return false;
+
+    GLenum status = glClientWaitSync(m_fence, 0, 0);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+
+bool TextureReadback::finish(std::vector<unsigned char>& _pixels)
+{
+    if(!m_fence)
+    {
+        std::cerr << "[ERROR] TextureReadback::finish(): no pending copy" << std::endl;
+        return false;
+    }
+
+    // wait by steps of 1 s (GL_TIMEOUT_EXPIRED), until the copy is done or fails
+    GLenum status = GL_TIMEOUT_EXPIRED;
+    while(status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glDeleteSync(m_fence);
+    m_fence = nullptr;
+
+    if(status == GL_WAIT_FAILED)
+    {
+        std::cerr << "[ERROR] TextureReadback::finish(): wait failed" << std::endl;
+        return false;
+    }
+
+    size_t size = (size_t)m_width * m_height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+    const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if(!data)
+    {
+        std::cerr << "[ERROR] TextureReadback::finish(): cannot map the PBO" << std::endl;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return false;
+    }
+    _pixels.resize(size);
+    std::memcpy(_pixels.data(), data, size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return true;
+}
@@ -0,0 +1,108 @@
+/*********************************************************************************************************************
+ *
+ * texturereadback.h
+ *
+ * Asynchronous copy of a texture to CPU memory
+ *
+ * Ray_compute
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef TEXTUREREADBACK_H
+#define TEXTUREREADBACK_H
+
+
+#include <vector>
+#include <iostream>
+
+#include "utils.h"
+
+
+
+/*!
+* \class TextureReadback
+* \brief Reads an RGBA8 texture back through a Pixel Buffer Object
+* start() only queues the copy to the PBO and a fence, so rendering can go on while the copy is done;
+* the PBO is mapped once the fence is signaled, instead of stalling in glGetTexImage().
+* A single copy can be in flight at a time.
+*/
+class TextureReadback
+{
+    public:
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                        CONSTRUCTORS / DESTRUCTORS                                           |
+        +------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn TextureReadback
+        * \brief Default constructor of TextureReadback
+        */
+        TextureReadback();
+
+
+        /*!
+        * \fn ~TextureReadback
+        * \brief Destructor of TextureReadback
+        */
+        ~TextureReadback();
+
+        /*! the PBO and the fence are deleted by the destructor: not copyable */
+        TextureReadback(const TextureReadback&) = delete;
+        TextureReadback& operator=(const TextureReadback&) = delete;
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                              GETTERS/SETTERS                                                |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        inline bool isPending() const { return m_fence != nullptr; }
+        inline unsigned int getWidth() const { return m_width; }
+        inline unsigned int getHeight() const { return m_height; }
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                               OTHER METHODS                                                 |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        /*!
+        * \fn start
+        * \brief Queue the copy of a texture to the PBO (the texture must have been written before, cf. glMemoryBarrier())
+        * \param _tex : RGBA8 texture
+        * \param _width, _height : texture dimensions
+        */
+        void start(GLuint _tex, unsigned int _width, unsigned int _height);
+
+
+        /*!
+        * \fn isReady
+        * \brief Check without waiting if the pending copy is finished
+        * \return true if finish() will not wait
+        */
+        bool isReady();
+
+
+        /*!
+        * \fn finish
+        * \brief Wait for the pending copy (if needed) and read the pixels from the PBO
+        * \param _pixels : output RGBA8 pixels, in the row order of the texture
+        * \return false if no copy is pending or the PBO cannot be mapped
+        */
+        bool finish(std::vector<unsigned char>& _pixels);
+
+
+    protected:
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                                ATTRIBUTES                                                   |
+        +-------------------------------------------------------------------------------------------------------------*/
+
+        GLuint m_pbo;                   /*!< Pixel Buffer Object receiving the texture */
+        size_t m_capacity;              /*!< size of the PBO (bytes) */
+        GLsync m_fence;                 /*!< signaled when the copy to the PBO is finished, nullptr if no copy is pending */
+        unsigned int m_width;           /*!< dimensions of the pending copy */
+        unsigned int m_height;
+
+};
+#endif // TEXTUREREADBACK_H
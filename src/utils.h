@@ -20,6 +20,7 @@
 #include <sstream>
 #include <iostream>
 #include <random>
+#include <cstdlib>
 
 #define GLM_FORCE_RADIANS
 
@@ -32,68 +33,283 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <lodepng.h>
+
 
 
         /*------------------------------------------------------------------------------------------------------------+
         |                                             GEOMETRY BUFFER                                                 |
         +------------------------------------------------------------------------------------------------------------*/
 
-const GLuint NB_SPHERES = 9;
-
 // sphere structure
+// Material types, must be consistent with MATERIAL_* defined in rtCommon.glsl
+enum MaterialType : GLuint { MATERIAL_DIFFUSE = 0, MATERIAL_MIRROR = 1, MATERIAL_GLASS = 2, MATERIAL_LIGHT = 3 };
+
+// Entry of the material table, referenced by spheres and triangles (albedo stays per primitive)
+struct Material
+{
+    Material(MaterialType _type, float _ior = 1.5f, glm::vec3 _emission = glm::vec3(0.0f), float _roughness = 0.0f)
+        : emission(_emission), type(_type), ior(_ior), roughness(_roughness)
+        , pad1(0.0f), pad2(0.0f)
+    {}
+
+    // Must be consistent with struct Material defined in compute shader
+    // (std430 layout packs type after emission: 32 bytes per material)
+    glm::vec3 emission;     /*!< light sources: color of the emitted light (scaled by the light intensity) */
+    GLuint type;            /*!< MaterialType */
+    float ior;              /*!< glass: index of refraction */
+    float roughness;        /*!< mirror: 0 for a perfect reflection, up to 1 for a diffuse-like lobe */
+    float pad1;
+    float pad2;
+};
+
+
+// Light source of the scene: a sphere with a light material, and its bin of the alias table
+// picking the lights proportionally to their power (cf. SceneBuffer::uploadLights())
+struct LightEntry
+{
+    // Must be consistent with struct Light defined in compute shader (16 bytes per light)
+    GLuint sphereId;        /*!< index of the sphere */
+    float pmf;              /*!< probability to pick this light */
+    float threshold;        /*!< the bin picks this light below threshold, its alias above */
+    GLuint alias;
+};
+
+
 struct Sphere
 {
-    Sphere(glm::vec3 _center, glm::vec3 _color, float _radius)
-        : center(_center), color(_color), radius(_radius)
-        , pad1(0.0f), pad2(0.0f), pad3(0.0f)
+    Sphere(glm::vec3 _center, glm::vec3 _color, float _radius, GLuint _materialId = 0)
+        : center(_center), materialId(_materialId), color(_color), invRadius(1.0f / _radius), radius(_radius)
+        , radius2(_radius * _radius), pad4(0.0f), pad5(0.0f)
     {}
 
     // Add intermediate padding for block alignement
     // cf. https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL
     // Must be consistent with struct Sphere defined in compute shader
-    // and allows us to use the std140 layout
+    // and allows us to use the std140/std430 layouts (48 bytes per sphere)
+    // (invRadius and radius2 are derived from radius by the constructor: build a new sphere to change it)
   	glm::vec3 center;
-    float pad1;         
+    GLuint materialId;  /*!< index in the material table (cf. SceneBuffer::setMaterials()) */
     glm::vec3 color;
-    float pad2;
+    float invRadius;    /*!< 1 / radius, normals are computed without normalization */
 	float radius;
-    glm::vec3 pad3;
+    float radius2;      /*!< radius * radius, for the intersection test */
+    float pad4;
+    float pad5;
+};
+
+
+// Triangles are stored with two precomputed edges (Moller-Trumbore test needs no vertex fetch)
+// and a packed RGBA8 albedo, so each triangle fits in a single cache line;
+// the same record describes a quad (parallelogram v0, v1, v1 + v2 - v0, v2), e.g. the walls of the Cornell box
+struct Triangle
+{
+    Triangle(const glm::vec3& _v0, const glm::vec3& _v1, const glm::vec3& _v2, const glm::vec3& _color, GLuint _materialId = 0,
+             bool _isQuad = false)
+        : v0(_v0), color(glm::packUnorm4x8(glm::vec4(_color, 1.0f)))
+        , e1(_v1 - _v0), materialId(_materialId), e2(_v2 - _v0), isQuad(_isQuad ? 1 : 0)
+    {}
+
+    // Must be consistent with struct Triangle defined in compute shader
+    // (std430 layout packs a scalar after each vec3: 48 bytes per triangle)
+    glm::vec3 v0;
+    GLuint color;       /*!< albedo, unpacked with unpackUnorm4x8() */
+    glm::vec3 e1;       /*!< v1 - v0 */
+    GLuint materialId;  /*!< index in the material table */
+    glm::vec3 e2;       /*!< v2 - v0 */
+    GLuint isQuad;      /*!< 1 for a quad: the 4th corner is v0 + e1 + e2 */
+};
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                              FRAME PARAMETERS                                               |
+        +------------------------------------------------------------------------------------------------------------*/
+
+// per-frame renderer parameters
+struct FrameParams
+{
+    // Must be consistent with uniform block FrameParams defined in compute shader
+    // (std140 layout: scalars are packed, block is padded to a multiple of 16 bytes)
+    GLint screenWidth = 0;
+    GLint screenHeight = 0;
+    GLint nbSamples = 1;
+    GLint nbBounces = 1;
+    GLfloat lightIntensity = 0.0f;
+    GLuint frameIndex = 0;
+    GLint nbSpheres = 0;
+    GLint nbTriangles = 0;
+    GLint isGBufferOn = 0;      // write the G-buffer of the denoiser
+    GLint nbLights = 0;         // number of light sources (cf. SceneBuffer::uploadLights())
+    GLfloat adaptiveThreshold = 0.0f;   // relative error of the converged pixels, 0 to sample all the pixels
+    GLint adaptiveMinFrames = 8;        // frames accumulated before a pixel can converge
+    // camera (cf. class Camera): vec3 + float packed in 16 bytes
+    glm::vec3 cameraPosition = glm::vec3(0.0f);     // center of the image plane
+    GLfloat cameraFocal = 3.0f;                     // distance between the image plane and the eye
+    glm::vec3 cameraRight = glm::vec3(1.0f, 0.0f, 0.0f);
+    GLfloat cameraHalfHeight = 2.5f;                // half height of the image plane
+    glm::vec3 cameraDown = glm::vec3(0.0f, 1.0f, 0.0f);
+    GLfloat pad1 = 0.0f;
+    glm::vec3 cameraForward = glm::vec3(0.0f, 0.0f, -1.0f);
+    GLfloat pad2 = 0.0f;
 };
 
 
 /*!
-* \fn createSpheresUBO
-* \brief Creates a Uniform Buffer Object to send geometry of the scene to compute shader
-* \param _spheres : geometry of the scene represented as spheres
-* \param _ubo : UBO to be allocated and populated
-* \return populated _ubo
+* \fn createFrameParamsUBO
+* \brief Creates a Uniform Buffer Object to send per-frame parameters to compute shader
+* \param _ubo : UBO to be allocated
+* \return allocated _ubo, bound to index 2
 */
-inline void createSpheresUBO(std::vector<Sphere>& _spheres, GLuint& _ubo)
+inline void createFrameParamsUBO(GLuint& _ubo)
 {
-    // 48 bytes per sphere (with intermediate padding)
-    size_t NBytes = sizeof(Sphere);
-
-    // Create and allocate UBO
     glGenBuffers(1, &_ubo);
     glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
-    glBufferData(GL_UNIFORM_BUFFER, NBytes * _spheres.size(), NULL, GL_STATIC_DRAW);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameParams), NULL, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-    // Bind UBO to an indexed buffer target
-    // Here using the index 1, which is correspond to uniform ValBlock 
-    // in compute shader (binding = 1)
-    // This way we don't have to use glGetUniformBlockIndex() and glUniformBlockBinding()
-    glBindBufferBase(GL_UNIFORM_BUFFER, 1, _ubo); 
+    // Bind UBO to index 2, which corresponds to uniform FrameParams in compute shader (binding = 2)
+    glBindBufferBase(GL_UNIFORM_BUFFER, 2, _ubo);
+}
 
-    // Populate UBO with spheres
-    glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, NBytes * _spheres.size(), _spheres.data() ); 
 
+/*!
+* \fn updateFrameParamsUBO
+* \brief Upload per-frame parameters (single buffer update per frame)
+* \param _params : parameters of the current frame
+* \param _ubo : UBO created by createFrameParamsUBO()
+*/
+inline void updateFrameParamsUBO(const FrameParams& _params, GLuint _ubo)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameParams), &_params);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 
 
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                                 LOAD MESHES                                                 |
+        +------------------------------------------------------------------------------------------------------------*/
+
+
+/*!
+* \fn loadOBJ
+* \brief read vertex positions and faces of a Wavefront OBJ file (other attributes are ignored)
+* polygonal faces are triangulated as fans, negative (relative) indices are supported
+* \param _filename : OBJ file name
+* \param _vertices : output vertex positions
+* \param _indices : output triangle list (3 indices per triangle)
+* \return true if the file was read
+*/
+inline bool loadOBJ(const std::string& _filename, std::vector<glm::vec3>& _vertices, std::vector<uint32_t>& _indices)
+{
+    std::ifstream file(_filename);
+    if(!file.is_open())
+    {
+        std::cerr << "[ERROR] loadOBJ(): cannot open " << _filename << std::endl;
+        return false;
+    }
+
+    _vertices.clear();
+    _indices.clear();
+
+    std::string line;
+    while(std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if(keyword == "v")
+        {
+            glm::vec3 v;
+            stream >> v.x >> v.y >> v.z;
+            _vertices.push_back(v);
+        }
+        else if(keyword == "f")
+        {
+            // each corner is "v", "v/vt", "v//vn" or "v/vt/vn": only keep v
+            std::vector<uint32_t> face;
+            std::string corner;
+            while(stream >> corner)
+            {
+                long id = std::strtol(corner.c_str(), nullptr, 10);
+                id = (id < 0) ? (long)_vertices.size() + id : id - 1;
+                if(id < 0 || id >= (long)_vertices.size())
+                {
+                    std::cerr << "[ERROR] loadOBJ(): invalid vertex index in " << _filename << std::endl;
+                    return false;
+                }
+                face.push_back((uint32_t)id);
+            }
+
+            for(size_t i = 2; i < face.size(); i++)
+            {
+                _indices.push_back(face[0]);
+                _indices.push_back(face[i - 1]);
+                _indices.push_back(face[i]);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+
+        /*------------------------------------------------------------------------------------------------------------+
+        |                                                 SAVE IMAGES                                                 |
+        +------------------------------------------------------------------------------------------------------------*/
+
+
+/*!
+* \fn saveImage
+* \brief Write RGBA8 pixels to an image file: PNG if the extension is .png, binary PPM otherwise (alpha is dropped)
+* \param _filename : output file name
+* \param _pixels : RGBA8 pixels read from a screen texture (first row is the top of the view, cf. DrawableMesh::createQuadVAO())
+* \param _width, _height : image dimensions
+* \return true if the file was written
+*/
+inline bool saveImage(const std::string& _filename, const std::vector<unsigned char>& _pixels, unsigned int _width, unsigned int _height)
+{
+    std::vector<unsigned char> rgb((size_t)_width * _height * 3);
+    for(unsigned int y = 0; y < _height; y++)
+    {
+        const unsigned char* src = &_pixels[(size_t)y * _width * 4];
+        unsigned char* dst = &rgb[(size_t)y * _width * 3];
+        for(unsigned int x = 0; x < _width; x++)
+        {
+            dst[3 * x + 0] = src[4 * x + 0];
+            dst[3 * x + 1] = src[4 * x + 1];
+            dst[3 * x + 2] = src[4 * x + 2];
+        }
+    }
+
+    std::string ext = _filename.substr(_filename.find_last_of('.') + 1);
+    if(ext == "png")
+    {
+        unsigned error = lodepng::encode(_filename, rgb, _width, _height, LCT_RGB, 8);
+        if(error != 0)
+        {
+            std::cerr << "[ERROR] saveImage(): " << lodepng_error_text(error) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::ofstream file(_filename, std::ios::binary);
+    if(!file)
+    {
+        std::cerr << "[ERROR] saveImage(): cannot open " << _filename << std::endl;
+        return false;
+    }
+    file << "P6\n" << _width << " " << _height << "\n255\n";
+    file.write((const char*)rgb.data(), rgb.size());
+    return (bool)file;
+}
+
+
+
         /*------------------------------------------------------------------------------------------------------------+
         |                                         READ AND COMPILE SHADERS                                            |
         +------------------------------------------------------------------------------------------------------------*/
@@ -116,6 +332,66 @@ inline std::string readShaderSource(const std::string& _filename)
 
 
 
+/*!
+* \fn resolveShaderIncludes
+* \brief replace the #include "file" directives of a shader source by the content of the files (GLSL has no include)
+* \param _shaderSource : shader source
+* \param _directory : directory of the included files (ending with a separator, or empty)
+* \param _depth : recursion depth (included files can include other ones)
+* \param _includedFiles : optional list the included files are appended to (e.g., to watch them)
+* \return shader source without #include directives
+*/
+inline std::string resolveShaderIncludes(const std::string& _shaderSource, const std::string& _directory, int _depth = 0,
+                                         std::vector<std::string>* _includedFiles = nullptr)
+{
+    std::istringstream input(_shaderSource);
+    std::string result;
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(input, line))
+    {
+        lineNumber++;
+        size_t directivePos = line.find_first_not_of(" \t");
+        if(directivePos == std::string::npos || line.compare(directivePos, 8, "#include") != 0)
+        {
+            result += line + "\n";
+            continue;
+        }
+
+        size_t first = line.find('"', directivePos);
+        size_t last = (first == std::string::npos) ? std::string::npos : line.find('"', first + 1);
+        if(last == std::string::npos)
+        {
+            std::cerr << "[ERROR] resolveShaderIncludes(): invalid directive " << line << std::endl;
+            continue;
+        }
+        std::string filename = _directory + line.substr(first + 1, last - first - 1);
+        if(_depth >= 8)
+        {
+            std::cerr << "[ERROR] resolveShaderIncludes(): too many nested includes in " << filename << std::endl;
+            continue;
+        }
+        std::ifstream file(filename);
+        if(!file)
+        {
+            std::cerr << "[ERROR] resolveShaderIncludes(): cannot open " << filename << std::endl;
+            continue;
+        }
+
+        if(_includedFiles)
+            _includedFiles->push_back(filename);
+        size_t separatorPos = filename.find_last_of("/\\");
+        std::string directory = (separatorPos == std::string::npos) ? "" : filename.substr(0, separatorPos + 1);
+        result += resolveShaderIncludes(readShaderSource(filename), directory, _depth + 1, _includedFiles);
+        // keep the line numbers of the including file in compilation errors
+        result += "#line " + std::to_string(lineNumber + 1) + "\n";
+    }
+
+    return result;
+}
+
+
+
 /*!
 * \fn showShaderInfoLog
 * \brief print out shader info log (i.e. compilation errors)
@@ -150,35 +426,64 @@ inline void showProgramInfoLog(GLuint _program)
 
 
 
+/*!
+* \fn addShaderDefines
+* \brief insert preprocessor definitions in a shader source, right after its #version directive
+* \param _shaderSource : shader source (must start with a #version directive)
+* \param _defines : definitions to insert (e.g., "#define LOCAL_SIZE 8\n")
+* \return shader source containing the definitions
+*/
+inline std::string addShaderDefines(const std::string& _shaderSource, const std::string& _defines)
+{
+    if(_defines.empty())
+        return _shaderSource;
+
+    // #version must remain the first directive of the shader
+    size_t versionPos = _shaderSource.find("#version");
+    if(versionPos == std::string::npos)
+        return _defines + _shaderSource;
+
+    size_t lineEnd = _shaderSource.find('\n', versionPos);
+    if(lineEnd == std::string::npos)
+        return _shaderSource + "\n" + _defines;
+
+    return _shaderSource.substr(0, lineEnd + 1) + _defines + _shaderSource.substr(lineEnd + 1);
+}
+
+
+
+/*!
+* \fn loadShaderSource
+* \brief read a shader file, resolve its #include directives and insert preprocessor definitions
+* \param _filename : shader filename (#include "file" directives are resolved relatively to its directory)
+* \param _defines : optional preprocessor definitions inserted after the #version directive
+* \param _includedFiles : optional list the included files are appended to
+* \return shader source ready to compile
+*/
+inline std::string loadShaderSource(const std::string& _filename, const std::string& _defines = "", std::vector<std::string>* _includedFiles = nullptr)
+{
+    size_t separatorPos = _filename.find_last_of("/\\");
+    std::string directory = (separatorPos == std::string::npos) ? "" : _filename.substr(0, separatorPos + 1);
+    return addShaderDefines(resolveShaderIncludes(readShaderSource(_filename), directory, 0, _includedFiles), _defines);
+}
+
+
+
 /*!
 * \fn loadShaderProgram
 * \brief load shader program from shader files
 * \param _vertShaderFilename : vertex shader filename
 * \param _fragShaderFilename : fragment shader filename
+* \param _vertHeader : optional header of the vertex shader, inserted after its #version directive (e.g., specialization defines)
+* \param _fragHeader : optional header of the fragment shader, inserted after its #version directive
 */
 inline GLuint loadShaderProgram(const std::string& _vertShaderFilename, const std::string& _fragShaderFilename, const std::string& _vertHeader="", const std::string& _fragHeader="")
 {
-    // read headers
-    std::string vertHeaderSource, fragHeaderSource;
-    vertHeaderSource = readShaderSource(_vertHeader);
-    fragHeaderSource = readShaderSource(_fragHeader);
-
-
     // Load and compile vertex shader
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    std::string vertexShaderSource = readShaderSource(_vertShaderFilename);
-    if(!_vertHeader.empty() )
-    {
-        // if headers are provided, add them to the shader
-        const char *vertSources[2] = {vertHeaderSource.c_str(), vertexShaderSource.c_str()};
-        glShaderSource(vertexShader, 2, vertSources, nullptr);
-    }
-    else
-    {
-        // if no header provided, the shader is contained in a single file
-        const char *vertexShaderSourcePtr = vertexShaderSource.c_str();
-        glShaderSource(vertexShader, 1, &vertexShaderSourcePtr, nullptr);
-    }
+    std::string vertexShaderSource = loadShaderSource(_vertShaderFilename, _vertHeader);
+    const char *vertexShaderSourcePtr = vertexShaderSource.c_str();
+    glShaderSource(vertexShader, 1, &vertexShaderSourcePtr, nullptr);
     glCompileShader(vertexShader);
     GLint success = 0;
     glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
@@ -193,19 +498,9 @@ inline GLuint loadShaderProgram(const std::string& _vertShaderFilename, const st
 
     // Load and compile fragment shader
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    std::string fragmentShaderSource = readShaderSource(_fragShaderFilename);
-    if(!_fragHeader.empty() )
-    {
-        // if headers are provided, add them to the shader
-        const char *fragSources[2] = {fragHeaderSource.c_str(), fragmentShaderSource.c_str()};
-        glShaderSource(fragmentShader, 2, fragSources, nullptr);
-    }
-    else
-    {
-        // if no header provided, the shader is contained in a single file
-        const char *fragmentShaderSourcePtr = fragmentShaderSource.c_str();
-        glShaderSource(fragmentShader, 1, &fragmentShaderSourcePtr, nullptr);
-    }
+    std::string fragmentShaderSource = loadShaderSource(_fragShaderFilename, _fragHeader);
+    const char *fragmentShaderSourcePtr = fragmentShaderSource.c_str();
+    glShaderSource(fragmentShader, 1, &fragmentShaderSourcePtr, nullptr);
     glCompileShader(fragmentShader);
     success = 0;
     glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
@@ -246,19 +541,28 @@ inline GLuint loadShaderProgram(const std::string& _vertShaderFilename, const st
     // Clean up
     glDetachShader(program, vertexShader);
     glDetachShader(program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
 
     return program;
 }
 
 
 
-inline GLuint loadCompShaderProgram(const std::string& _compShaderFilename)
+/*!
+* \fn loadCompShaderProgram
+* \brief load compute shader program from shader file
+* \param _compShaderFilename : compute shader filename
+* \param _defines : optional preprocessor definitions inserted after the #version directive
+* #include "file" directives are resolved relatively to the directory of the shader
+*/
+inline GLuint loadCompShaderProgram(const std::string& _compShaderFilename, const std::string& _defines = "")
 {
     // create compute shader
     GLuint compShader = glCreateShader(GL_COMPUTE_SHADER);
 
     // read shader
-    std::string compShaderSource = readShaderSource(_compShaderFilename);
+    std::string compShaderSource = loadShaderSource(_compShaderFilename, _defines);
     const char *compShaderSourcePtr = compShaderSource.c_str();
     glShaderSource(compShader, 1, &compShaderSourcePtr, nullptr);
 
@@ -300,6 +604,7 @@ inline GLuint loadCompShaderProgram(const std::string& _compShaderFilename)
 
     // Clean up
     glDetachShader(program, compShader);
+    glDeleteShader(compShader);
 
 
     return program;
@@ -311,8 +616,14 @@ inline GLuint loadCompShaderProgram(const std::string& _compShaderFilename)
         +------------------------------------------------------------------------------------------------------------*/
 
 
-// Init screen texture
-inline void buildScreenTex(GLuint *_screenTex, unsigned int _texWidth, unsigned int _texHeight)
+/*!
+* \fn buildScreenTex
+* \brief Init screen texture (empty texture to be written by compute shader)
+* \param _screenTex : texture to be allocated
+* \param _texWidth, _texHeight : texture dimensions
+* \param _internalFormat : GL_RGBA8 for display, GL_RGBA32F/GL_RGBA16F for accumulation and G-buffers
+*/
+inline void buildScreenTex(GLuint *_screenTex, unsigned int _texWidth, unsigned int _texHeight, GLenum _internalFormat = GL_RGBA8)
 {
 
     // generate texture
@@ -327,8 +638,9 @@ inline void buildScreenTex(GLuint *_screenTex, unsigned int _texWidth, unsigned
     
     // create and empty texture with given dimensions
     // GL_RGBA8 (UNSIGNED_BYTE) -> declared as rgba8 in compute shader 
+    // GL_RGBA32F (FLOAT) -> declared as rgba32f in compute shader 
     // https://www.khronos.org/opengl/wiki/Image_Load_Store#Format_qualifiers
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,  _texWidth, _texHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, _internalFormat,  _texWidth, _texHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 
 }
 